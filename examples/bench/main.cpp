@@ -0,0 +1,304 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <boost/lexical_cast.hpp>
+
+#include <freesrp.hpp>
+
+#include "optionparser.hpp"
+
+using namespace std;
+using namespace FreeSRP;
+
+typedef chrono::steady_clock bench_clock;
+
+enum optionIndex {NONE, HELP, OUTFILE, ITERATIONS, FREQ, RATE, SETTLE};
+const option::Descriptor usage[] = {
+        {NONE,       0, "",  "",           option::Arg::None,     "usage: freesrp-bench [options]\n"
+                                                                  "       measures command round trip and retune latency, output is JSON\noptions:"},
+        {HELP,       0, "h", "help",       option::Arg::None,     "  -h, --help                     Print usage and exit"},
+        {OUTFILE,    0, "o", "out",        option::Arg::Optional, "  -o[filename], --out=[filename] Output to specified file (default: stdout)"},
+        {ITERATIONS, 0, "n", "iterations", option::Arg::Optional, "  -n[count], --iterations=[count] Measurements per command (default 200)"},
+        {FREQ,       0, "f", "freq",       option::Arg::Optional, "  -f[freq], --freq=[freq]        Retune between this frequency and freq + rate (default 2.4e9)"},
+        {RATE,       0, "r", "rate",       option::Arg::Optional, "  -r[rate], --rate=[rate]        RX sample rate in hertz (default 10e6)"},
+        {SETTLE,     0, "",  "settle",     option::Arg::Optional, "  --settle=[samples]             Samples to discard after a retune (default 2 ms)"},
+        {NONE,       0, "",  "",           option::Arg::None,     "\nexample: freesrp-bench -n1000 -obench.json"},
+        {0,0,0,0,0,0}
+};
+
+struct command_def
+{
+    const char *name;
+    command_id id;
+};
+
+// Each SET_* command is sent with the value read back from its GET_* counterpart, so the configuration is not changed
+const command_def bench_commands[] = {
+    {"GET_TX_LO_FREQ", GET_TX_LO_FREQ}, {"SET_TX_LO_FREQ", SET_TX_LO_FREQ},
+    {"GET_TX_SAMP_FREQ", GET_TX_SAMP_FREQ}, {"SET_TX_SAMP_FREQ", SET_TX_SAMP_FREQ},
+    {"GET_TX_RF_BANDWIDTH", GET_TX_RF_BANDWIDTH}, {"SET_TX_RF_BANDWIDTH", SET_TX_RF_BANDWIDTH},
+    {"GET_TX_ATTENUATION", GET_TX_ATTENUATION}, {"SET_TX_ATTENUATION", SET_TX_ATTENUATION},
+    {"GET_TX_FIR_EN", GET_TX_FIR_EN}, {"SET_TX_FIR_EN", SET_TX_FIR_EN},
+    {"GET_RX_LO_FREQ", GET_RX_LO_FREQ}, {"SET_RX_LO_FREQ", SET_RX_LO_FREQ},
+    {"GET_RX_SAMP_FREQ", GET_RX_SAMP_FREQ}, {"SET_RX_SAMP_FREQ", SET_RX_SAMP_FREQ},
+    {"GET_RX_RF_BANDWIDTH", GET_RX_RF_BANDWIDTH}, {"SET_RX_RF_BANDWIDTH", SET_RX_RF_BANDWIDTH},
+    {"GET_RX_GC_MODE", GET_RX_GC_MODE}, {"SET_RX_GC_MODE", SET_RX_GC_MODE},
+    {"GET_RX_RF_GAIN", GET_RX_RF_GAIN}, {"SET_RX_RF_GAIN", SET_RX_RF_GAIN},
+    {"GET_RX_FIR_EN", GET_RX_FIR_EN}, {"SET_RX_FIR_EN", SET_RX_FIR_EN},
+    {"GET_FPGA_VERSION", GET_FPGA_VERSION}
+};
+
+// Latency distribution in microseconds, printed as a JSON object
+struct distribution
+{
+    vector<double> us;
+
+    void add(bench_clock::duration d)
+    {
+        us.push_back(chrono::duration<double, micro>(d).count());
+    }
+
+    double percentile(double p)
+    {
+        sort(us.begin(), us.end());
+        return us[(size_t) (p * (us.size() - 1) + 0.5)];
+    }
+
+    void print(ostream &out)
+    {
+        if(us.empty())
+        {
+            out << "null";
+            return;
+        }
+
+        out << "{\"count\": " << us.size() << ", \"p50_us\": " << percentile(0.5) << ", \"p99_us\": " << percentile(0.99)
+            << ", \"max_us\": " << us.back() << "}";
+    }
+};
+
+// Notes the time at which the first sample after a number of settling samples arrives
+struct settle_probe
+{
+    mutex mut;
+    condition_variable cond;
+    atomic<bool> armed{false};
+    unsigned long remaining = 0;
+    bench_clock::time_point first_sample;
+
+    void rx(const vector<sample> &samples)
+    {
+        if(!armed.load(memory_order_acquire))
+        {
+            return;
+        }
+
+        if(remaining >= samples.size())
+        {
+            remaining -= samples.size();
+            return;
+        }
+
+        first_sample = bench_clock::now();
+        lock_guard<mutex> lock(mut);
+        armed.store(false, memory_order_release);
+        cond.notify_one();
+    }
+};
+
+int main(int argc, char *argv[])
+{
+    // Parse options
+    argc-=(argc>0); argv+=(argc>0); // Skip program name (argv[0]), if present
+    option::Stats stats(usage, argc, argv);
+    option::Option options[stats.options_max], buffer[stats.buffer_max];
+    option::Parser parse(usage, argc, argv, options, buffer);
+
+    if(parse.error())
+    {
+        return 1;
+    }
+
+    if(options[HELP])
+    {
+        option::printUsage(cout, usage);
+        return 0;
+    }
+
+    unsigned int iterations = 200;
+    double freq = 2.4e9, rate = 10e6;
+    unsigned long settle = 0;
+
+    try
+    {
+        if(options[ITERATIONS].arg) iterations = boost::lexical_cast<unsigned int>(options[ITERATIONS].arg);
+        if(options[FREQ].arg) freq = boost::lexical_cast<double>(options[FREQ].arg);
+        if(options[RATE].arg) rate = boost::lexical_cast<double>(options[RATE].arg);
+        if(options[SETTLE].arg) settle = boost::lexical_cast<unsigned long>(options[SETTLE].arg);
+    }
+    catch(boost::bad_lexical_cast)
+    {
+        cerr << "Error: Please specify valid numerical values" << endl;
+        return 1;
+    }
+
+    if(iterations == 0)
+    {
+        cerr << "Error: Please specify at least one iteration" << endl;
+        return 1;
+    }
+
+    if(settle == 0)
+    {
+        settle = (unsigned long) (rate * 0.002);
+    }
+
+    ofstream of;
+    ostream *out = &cout;
+    if(options[OUTFILE] && options[OUTFILE].arg)
+    {
+        of.open(options[OUTFILE].arg, ios::out);
+        out = &of;
+    }
+
+    try
+    {
+        FreeSRP::FreeSRP srp;
+
+        if(!srp.fpga_loaded())
+        {
+            cerr << "FPGA not configured. Please configure the FPGA first, e.g. with freesrp-ctl --fpga=/path/to/bitstream.bin" << endl;
+            return 1;
+        }
+
+        freesrp_version version = srp.version();
+
+        radio_config config;
+        config.rx_samp_freq = rate;
+        config.rx_rf_bandwidth = rate;
+        config.rx_lo_freq = freq;
+        radio_config_result applied = srp.apply(config);
+        if(!applied.ok())
+        {
+            cerr << "Could not configure FreeSRP, " << applied.failed.front() << endl;
+            return 1;
+        }
+
+        // Round trip latency of every command
+        vector<distribution> round_trips(sizeof(bench_commands) / sizeof(bench_commands[0]));
+        for(size_t c = 0; c < round_trips.size(); c++)
+        {
+            command cmd{bench_commands[c].id, 0};
+            if(cmd.cmd != GET_FPGA_VERSION && (cmd.cmd % 2) == 0)
+            {
+                cmd.param = srp.send_cmd({(command_id) (cmd.cmd - 1), 0}, true).param;
+            }
+
+            for(unsigned int i = 0; i < iterations; i++)
+            {
+                bench_clock::time_point start = bench_clock::now();
+                srp.send_cmd(cmd, true);
+                round_trips[c].add(bench_clock::now() - start);
+            }
+        }
+
+        // Retune latency while receiving
+        settle_probe probe;
+        distribution retune_response, retune_first_sample;
+
+        if(srp.send_cmd({SET_DATAPATH_EN, 1}).error != CMD_OK)
+        {
+            cerr << "Error enabling FreeSRP datapath!" << endl;
+            return 1;
+        }
+
+        srp.start_rx([&probe](const vector<sample> &samples) {
+            probe.rx(samples);
+        });
+
+        for(unsigned int i = 0; i < iterations; i++)
+        {
+            command retune = srp.make_command(SET_RX_LO_FREQ, (i % 2) ? freq : freq + rate);
+
+            bench_clock::time_point start = bench_clock::now();
+            srp.send_cmd(retune);
+            bench_clock::time_point responded = bench_clock::now();
+
+            probe.remaining = settle;
+            probe.armed.store(true, memory_order_release);
+
+            unique_lock<mutex> lock(probe.mut);
+            if(!probe.cond.wait_for(lock, chrono::seconds(1), [&probe]() { return !probe.armed.load(memory_order_acquire); }))
+            {
+                probe.armed.store(false);
+                cerr << "No samples received after retune" << endl;
+                break;
+            }
+
+            retune_response.add(responded - start);
+            retune_first_sample.add(probe.first_sample - start);
+        }
+
+        srp.stop_rx();
+        srp.send_cmd({SET_DATAPATH_EN, 0});
+
+        *out << fixed << setprecision(1);
+        *out << "{" << endl;
+        *out << "  \"fx3_version\": \"" << version.fx3 << "\"," << endl;
+        *out << "  \"fpga_version\": \"" << version.fpga << "\"," << endl;
+        *out << "  \"iterations\": " << iterations << "," << endl;
+        *out << "  \"round_trip\": {" << endl;
+        for(size_t c = 0; c < round_trips.size(); c++)
+        {
+            *out << "    \"" << bench_commands[c].name << "\": ";
+            round_trips[c].print(*out);
+            *out << (c + 1 < round_trips.size() ? "," : "") << endl;
+        }
+        *out << "  }," << endl;
+        *out << "  \"retune\": {" << endl;
+        *out << "    \"freq_hz\": " << freq << ", \"rate_hz\": " << rate << ", \"settle_samples\": " << settle << "," << endl;
+        *out << "    \"response\": ";
+        retune_response.print(*out);
+        *out << "," << endl;
+        *out << "    \"first_settled_sample\": ";
+        retune_first_sample.print(*out);
+        *out << endl << "  }" << endl;
+        *out << "}" << endl;
+
+        return 0;
+    }
+    catch(const ConnectionError &e)
+    {
+        cerr << "Could not connect to FreeSRP: " << e.what() << endl;
+    }
+    catch(const runtime_error &e)
+    {
+        cerr << "Unexpected exception occurred! " << e.what() << endl;
+    }
+
+    return 1;
+}
@@ -0,0 +1,319 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+// Converts sample files between the formats freesrp-io writes, e.g. to unpack cs12packed captures for other tools.
+
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <vector>
+#include <boost/lexical_cast.hpp>
+
+#include <freesrp_capture.hpp>
+#include <freesrp_formats.hpp>
+
+#include "optionparser.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+using namespace std;
+using namespace FreeSRP;
+
+// Samples converted at a time
+#define CONVERT_CHUNK_SAMPLES (1 << 16)
+
+enum optionIndex {NONE, HELP, INFILE, OUTFILE, FROM, TO, HEADER, NO_HEADER, RATE, CENTER_FREQ, GAIN, START, DURATION, INFO, INDEX};
+const option::Descriptor usage[] = {
+        {NONE,        0, "",  "",          option::Arg::None,     "usage: freesrp-convert [options] --to=[fmt] -i[filename] -o[filename]\n"
+                                                                  "       formats: cs8, cs16, cf32, cs12packed, raw\noptions:"},
+        {HELP,        0, "h", "help",      option::Arg::None,     "  -h, --help                     Print usage and exit"},
+        {INFILE,      0, "i", "in",        option::Arg::Optional, "  -i[filename], --in=[filename]  Read from specified file ('-i-' for stdin)"},
+        {OUTFILE,     0, "o", "out",       option::Arg::Optional, "  -o[filename], --out=[filename] Output to specified file ('-o-' for stdout)"},
+        {FROM,        0, "",  "from",      option::Arg::Optional, "  --from=[fmt]                   Input format if the input has no header (default cs16)"},
+        {TO,          0, "",  "to",        option::Arg::Optional, "  --to=[fmt]                     Output format"},
+        {HEADER,      0, "",  "header",    option::Arg::None,     "  --header                       Start the output with a capture header (default for cs12packed)"},
+        {NO_HEADER,   0, "",  "no-header", option::Arg::None,     "  --no-header                    Write samples only"},
+        {RATE,        0, "r", "rate",      option::Arg::Optional, "  -r[rate], --rate=[rate]        Sample rate in hertz to store in the header"},
+        {CENTER_FREQ, 0, "f", "freq",      option::Arg::Optional, "  -f[freq], --freq=[freq]        Center frequency in hertz to store in the header"},
+        {GAIN,        0, "g", "gain",      option::Arg::Optional, "  -g[gain], --gain=[gain]        Gain in decibels to store in the header"},
+        {START,       0, "",  "start",     option::Arg::Optional, "  --start=[s]                    Convert from this many seconds into the input file"},
+        {DURATION,    0, "",  "duration",  option::Arg::Optional, "  --duration=[s]                 Convert this many seconds of the input file"},
+        {INFO,        0, "",  "info",      option::Arg::None,     "  --info                         Print the input's header and exit"},
+        {INDEX,       0, "",  "index",     option::Arg::None,     "  --index                        Print the input file's time and power index as CSV and exit"},
+        {NONE,        0, "",  "",          option::Arg::None,     "\nexample: freesrp-convert --to=cf32 -icapture.cs12 -ocapture.cf32"},
+        {0,0,0,0,0,0}
+};
+
+static void print_header(const capture_header &header)
+{
+    cout << "format:      " << sample_format_name(header.format) << endl;
+    cout << fixed << setprecision(0);
+    cout << "sample rate: " << header.samp_rate << " Hz" << endl;
+    cout << "frequency:   " << header.center_freq << " Hz" << endl;
+    cout << setprecision(1);
+    cout << "gain:        " << header.gain << " dB" << endl;
+    if(header.start_time > 0)
+    {
+        time_t start = (time_t) header.start_time;
+        char formatted[64];
+        strftime(formatted, sizeof(formatted), "%Y-%m-%d %H:%M:%S UTC", gmtime(&start));
+        cout << "start time:  " << formatted << endl;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    // Parse options
+    argc-=(argc>0); argv+=(argc>0); // Skip program name (argv[0]), if present
+    option::Stats stats(usage, argc, argv);
+    option::Option options[stats.options_max], buffer[stats.buffer_max];
+    option::Parser parse(usage, argc, argv, options, buffer);
+
+    if(parse.error())
+    {
+        return 1;
+    }
+
+    if(options[HELP])
+    {
+        option::printUsage(cout, usage);
+        return 0;
+    }
+
+    if(!options[INFILE].arg)
+    {
+        cerr << "Error: Please specify an input file. See 'freesrp-convert --help'." << endl;
+        return 1;
+    }
+
+    FILE *in = stdin;
+    if(string(options[INFILE].arg) != "-")
+    {
+        in = fopen(options[INFILE].arg, "rb");
+        if(in == nullptr)
+        {
+            cerr << "Error: Could not open '" << options[INFILE].arg << "': " << strerror(errno) << endl;
+            return 1;
+        }
+    }
+
+    // Use the input's header if it has one, otherwise the samples start right away
+    capture_header header;
+    header.format = FORMAT_CS16;
+    vector<unsigned char> pending(FREESRP_CAPTURE_HEADER_SIZE);
+    pending.resize(fread(pending.data(), 1, pending.size(), in));
+    bool has_header = decode_capture_header(pending.data(), pending.size(), header);
+    if(has_header)
+    {
+        pending.clear();
+    }
+    else if(options[FROM] && (!options[FROM].arg || !parse_sample_format(options[FROM].arg, header.format)))
+    {
+        cerr << "Error: --from expects cs8, cs16, cf32, cs12packed or raw. See 'freesrp-convert --help'." << endl;
+        return 1;
+    }
+
+    // Time ranges and the index need random access, which the capture reader provides for files
+    bool input_is_file = string(options[INFILE].arg) != "-";
+    unique_ptr<capture_reader> reader;
+    if(options[START] || options[DURATION] || options[INDEX])
+    {
+        if(!input_is_file)
+        {
+            cerr << "Error: --start, --duration and --index need an input file" << endl;
+            return 1;
+        }
+        try
+        {
+            reader.reset(new capture_reader(options[INFILE].arg, header.format));
+        }
+        catch(const runtime_error &e)
+        {
+            cerr << "Error: " << e.what() << endl;
+            return 1;
+        }
+    }
+
+    if(options[INDEX])
+    {
+        cout << "sample,time,power" << endl;
+        cout << fixed;
+        for(const capture_index_entry &entry : reader->index())
+        {
+            cout << entry.sample << "," << setprecision(6) << entry.time << "," << setprecision(2) << entry.power << "\n";
+        }
+        return 0;
+    }
+
+    if(options[INFO])
+    {
+        if(!has_header)
+        {
+            cerr << "Error: The input has no capture header" << endl;
+            return 1;
+        }
+        print_header(header);
+        return 0;
+    }
+
+    sample_format out_format;
+    if(!options[TO].arg || !parse_sample_format(options[TO].arg, out_format))
+    {
+        cerr << "Error: --to expects cs8, cs16, cf32, cs12packed or raw. See 'freesrp-convert --help'." << endl;
+        return 1;
+    }
+
+    double start = 0, duration = -1;
+
+    try
+    {
+        if(options[RATE].arg) header.samp_rate = boost::lexical_cast<double>(options[RATE].arg);
+        if(options[CENTER_FREQ].arg) header.center_freq = boost::lexical_cast<double>(options[CENTER_FREQ].arg);
+        if(options[GAIN].arg) header.gain = boost::lexical_cast<double>(options[GAIN].arg);
+        if(options[START].arg) start = boost::lexical_cast<double>(options[START].arg);
+        if(options[DURATION].arg) duration = boost::lexical_cast<double>(options[DURATION].arg);
+    }
+    catch(boost::bad_lexical_cast)
+    {
+        cerr << "Error: Please specify valid numerical values" << endl;
+        return 1;
+    }
+
+    if(!options[OUTFILE].arg)
+    {
+        cerr << "Error: Please specify an output file. See 'freesrp-convert --help'." << endl;
+        return 1;
+    }
+
+    FILE *out = stdout;
+    if(string(options[OUTFILE].arg) != "-")
+    {
+        out = fopen(options[OUTFILE].arg, "wb");
+        if(out == nullptr)
+        {
+            cerr << "Error: Could not open '" << options[OUTFILE].arg << "': " << strerror(errno) << endl;
+            return 1;
+        }
+    }
+
+    unsigned long long first = 0, last = 0;
+    if(reader)
+    {
+        if(header.samp_rate <= 0)
+        {
+            cerr << "Error: The input has no sample rate, please specify it with -r" << endl;
+            return 1;
+        }
+
+        first = min(reader->samples(), (unsigned long long) (max(start, 0.0) * header.samp_rate));
+        last = duration < 0 ? reader->samples() : min(reader->samples(), first + (unsigned long long) (duration * header.samp_rate));
+        if(header.start_time > 0)
+        {
+            header.start_time += first / header.samp_rate;
+        }
+    }
+
+    sample_format in_format = header.format;
+    header.format = out_format;
+
+    bool write_header = !options[NO_HEADER] && (options[HEADER] || out_format == FORMAT_CS12_PACKED);
+    if(write_header)
+    {
+        unsigned char encoded[FREESRP_CAPTURE_HEADER_SIZE];
+        encode_capture_header(header, encoded);
+        fwrite(encoded, 1, sizeof(encoded), out);
+    }
+
+    size_t in_size = sample_format_size(in_format);
+    size_t out_size = sample_format_size(out_format);
+
+    vector<unsigned char> in_buf(CONVERT_CHUNK_SAMPLES * in_size);
+    vector<sample> samples(CONVERT_CHUNK_SAMPLES);
+    vector<unsigned char> out_buf(CONVERT_CHUNK_SAMPLES * out_size);
+
+    // Bytes read while looking for a header are the first samples, unless the samples are read through the reader
+    size_t available = reader ? 0 : pending.size();
+    memcpy(in_buf.data(), pending.data(), available);
+
+    unsigned long long converted = 0;
+    if(reader)
+    {
+        // Read straight from the mapped file, the kernel reads ahead of the conversion
+        reader->view(first, (size_t) (last - first), ACCESS_SEQUENTIAL);
+        for(unsigned long long pos = first; pos < last; pos += CONVERT_CHUNK_SAMPLES)
+        {
+            size_t count = reader->read(pos, (size_t) min((unsigned long long) CONVERT_CHUNK_SAMPLES, last - pos), samples.data());
+            convert_samples(samples.data(), count, out_format, out_buf.data());
+            if(fwrite(out_buf.data(), out_size, count, out) != count)
+            {
+                cerr << "Error writing output: " << strerror(errno) << endl;
+                return 1;
+            }
+            converted += count;
+        }
+    }
+
+    while(!reader)
+    {
+        available += fread(in_buf.data() + available, 1, in_buf.size() - available, in);
+        size_t count = available / in_size;
+        if(count == 0)
+        {
+            break;
+        }
+
+        convert_to_samples(in_buf.data(), count, in_format, samples.data());
+        convert_samples(samples.data(), count, out_format, out_buf.data());
+        if(fwrite(out_buf.data(), out_size, count, out) != count)
+        {
+            cerr << "Error writing output: " << strerror(errno) << endl;
+            return 1;
+        }
+        converted += count;
+
+        // Keep a partial sample for the next read
+        available -= count * in_size;
+        memmove(in_buf.data(), in_buf.data() + count * in_size, available);
+    }
+
+    if(ferror(in))
+    {
+        cerr << "Error reading input: " << strerror(errno) << endl;
+        return 1;
+    }
+    if(available > 0)
+    {
+        cerr << "Warning: Ignored " << available << " trailing bytes that do not form a whole sample" << endl;
+    }
+
+    if(fclose(out) != 0)
+    {
+        cerr << "Error writing output: " << strerror(errno) << endl;
+        return 1;
+    }
+
+    cerr << "Converted " << converted << " samples from " << sample_format_name(in_format) << " to "
+         << sample_format_name(out_format) << endl;
+
+    return 0;
+}
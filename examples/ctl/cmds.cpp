@@ -20,13 +20,16 @@
 #include "cmds.hpp"
 #include <iostream>
 #include <iomanip>
+#include <chrono>
+#include <thread>
+#include <atomic>
 #include <boost/lexical_cast.hpp>
 
 using namespace std;
 
 namespace cmds
 {
-    int cmd_help(const FreeSRP::FreeSRP &srp, vector<string> &params)
+    int cmd_help(FreeSRP::FreeSRP &srp, vector<string> &params)
     {
         cout << left;
         cout << setw(12) << "Command" << setw(100) << "Description" << endl;
@@ -75,7 +78,7 @@ namespace cmds
         {"rx_fir_en", "get receiver FIR filter status [1|0]", FreeSRP::GET_RX_FIR_EN}
     };
 
-    int cmd_set(const FreeSRP::FreeSRP &srp, vector<string> &params)
+    int cmd_set(FreeSRP::FreeSRP &srp, vector<string> &params)
     {
         if(params.size() == 0)
         {
@@ -148,19 +151,26 @@ namespace cmds
         return 0;
     }
 
-    int cmd_get(const FreeSRP::FreeSRP &srp, vector<string> &params)
+    int cmd_get(FreeSRP::FreeSRP &srp, vector<string> &params)
     {
         if(params.size() == 0)
         {
             // No parameters specified. Print help message.
 
-            cout << "Usage: get [param]" << endl;
+            cout << "Usage: get [param] [device]" << endl;
             cout << "[param]: Name of the parameter to set" << endl;
+            cout << "[device]: (optional) read the parameter from the FreeSRP instead of the settings cache" << endl;
             cout << "Type 'get params' for a list of parameters." << endl;
         }
 
-        if(params.size() == 1)
+        if(params.size() == 2 && params[1] != "device")
+        {
+            cout << "Invalid option '" << params[1] << "'. Type 'get' for usage information." << endl;
+        }
+        else if(params.size() == 1 || params.size() == 2)
         {
+            bool read_from_device = params.size() == 2;
+
             // Parameter without value specified
             if(params[0] == "params")
             {
@@ -184,7 +194,7 @@ namespace cmds
                         not_found = false;
 
                         FreeSRP::command cmd{def.id};
-                        FreeSRP::response res = srp.send_cmd(cmd);
+                        FreeSRP::response res = srp.send_cmd(cmd, read_from_device);
                         if(res.error != FreeSRP::CMD_OK)
                         {
                             cerr << "FreeSRP reported error " << res.error << " getting the parameter" << endl;
@@ -207,4 +217,245 @@ namespace cmds
 
         return 0;
     }
+
+    int cmd_bench(FreeSRP::FreeSRP &srp, vector<string> &params)
+    {
+        unsigned int count = 1000;
+
+        if(params.size() == 1)
+        {
+            try
+            {
+                count = boost::lexical_cast<unsigned int>(params[0]);
+            }
+            catch(boost::bad_lexical_cast)
+            {
+                cout << "'" << params[0] << "' is not a valid number of commands!" << endl;
+                return 0;
+            }
+        }
+        else if(params.size() > 1)
+        {
+            cout << "Usage: bench [count]" << endl;
+            cout << "[count]: Number of commands to send with each method (default 1000)" << endl;
+            return 0;
+        }
+
+        // Only query commands are used so that the benchmark does not change the configuration
+        vector<FreeSRP::command> cmds;
+        const FreeSRP::command_id query_ids[] = {FreeSRP::GET_RX_LO_FREQ, FreeSRP::GET_RX_SAMP_FREQ, FreeSRP::GET_RX_RF_BANDWIDTH, FreeSRP::GET_RX_RF_GAIN};
+        for(unsigned int i = 0; i < count; i++)
+        {
+            cmds.push_back({query_ids[i % 4], 0});
+        }
+
+        auto start = chrono::steady_clock::now();
+        for(const FreeSRP::command &cmd : cmds)
+        {
+            srp.send_cmd(cmd, true);
+        }
+        double sync_s = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        start = chrono::steady_clock::now();
+        vector<FreeSRP::response> responses = srp.send_cmds(cmds, true);
+        double async_s = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        unsigned int mismatched = 0;
+        for(unsigned int i = 0; i < count; i++)
+        {
+            if(responses[i].cmd != cmds[i].cmd)
+            {
+                mismatched++;
+            }
+        }
+
+        cout << fixed << setprecision(1);
+        cout << "send_cmd:  " << count / sync_s << " commands/s" << endl;
+        cout << "send_cmds: " << count / async_s << " commands/s (" << FREESRP_CMD_MAX_IN_FLIGHT << " in flight)" << endl;
+        if(mismatched > 0)
+        {
+            cerr << mismatched << " responses did not match their commands!" << endl;
+        }
+
+        return 0;
+    }
+
+    int cmd_hop(FreeSRP::FreeSRP &srp, vector<string> &params)
+    {
+        if(params.size() < 4 || (params[0] != "rx" && params[0] != "tx"))
+        {
+            cout << "Usage: hop [rx|tx] [dwell] [count] [freq]..." << endl;
+            cout << "[rx|tx]: Hop the receiver or the transmitter LO" << endl;
+            cout << "[dwell]: Time between hops [us]" << endl;
+            cout << "[count]: Number of hops to perform" << endl;
+            cout << "[freq]: Frequencies to hop across, in order [Hz]" << endl;
+            return 0;
+        }
+
+        FreeSRP::command_id id = params[0] == "rx" ? FreeSRP::SET_RX_LO_FREQ : FreeSRP::SET_TX_LO_FREQ;
+        unsigned long dwell_us, count;
+        vector<FreeSRP::hop> hops;
+
+        try
+        {
+            dwell_us = boost::lexical_cast<unsigned long>(params[1]);
+            count = boost::lexical_cast<unsigned long>(params[2]);
+            for(size_t i = 3; i < params.size(); i++)
+            {
+                hops.push_back({id, boost::lexical_cast<double>(params[i])});
+            }
+        }
+        catch(boost::bad_lexical_cast)
+        {
+            cout << "Please specify valid numerical values" << endl;
+            return 0;
+        }
+
+        if(count == 0)
+        {
+            cout << "Please specify a number of hops greater than zero" << endl;
+            return 0;
+        }
+
+        srp.start_hopping(hops, chrono::microseconds(dwell_us), count);
+
+        while(srp.hopping())
+        {
+            this_thread::sleep_for(chrono::milliseconds(10));
+        }
+        FreeSRP::hop_report report = srp.stop_hopping();
+
+        cout << fixed << setprecision(1);
+        cout << "hops: " << report.hops << " (" << report.failed << " failed)" << endl;
+        cout << "latency [us]:  p50 " << report.latency.p50 << ", p90 " << report.latency.p90 << ", p99 " << report.latency.p99 << ", max " << report.latency.max << endl;
+        cout << "lateness [us]: p50 " << report.lateness.p50 << ", p90 " << report.lateness.p90 << ", p99 " << report.lateness.p99 << ", max " << report.lateness.max << endl;
+        if(report.hops > 0)
+        {
+            cout << "achieved hop rate: " << report.hops / report.hop_times.back() << " hops/s" << endl;
+        }
+
+        return 0;
+    }
+
+    int cmd_stress(FreeSRP::FreeSRP &srp, vector<string> &params)
+    {
+        unsigned int num_threads = 4, count = 1000;
+
+        try
+        {
+            if(params.size() > 0)
+            {
+                num_threads = boost::lexical_cast<unsigned int>(params[0]);
+            }
+            if(params.size() > 1)
+            {
+                count = boost::lexical_cast<unsigned int>(params[1]);
+            }
+        }
+        catch(boost::bad_lexical_cast)
+        {
+            cout << "Usage: stress [threads] [count]" << endl;
+            cout << "[threads]: Number of threads sending commands (default 4)" << endl;
+            cout << "[count]: Number of commands each thread sends (default 1000)" << endl;
+            return 0;
+        }
+
+        // Receive at the configured sample rate for the duration of the test
+        atomic<unsigned long> rx_samples{0};
+        FreeSRP::response res = srp.send_cmd({FreeSRP::SET_DATAPATH_EN, 1});
+        if(res.error != FreeSRP::CMD_OK)
+        {
+            cerr << "Could not enable the datapath, error: " << res.error << endl;
+            return 0;
+        }
+        srp.start_rx([&rx_samples](const vector<FreeSRP::sample> &samples) {
+            rx_samples.fetch_add(samples.size(), memory_order_relaxed);
+        });
+
+        // Each thread retunes one of these settings to values no other thread uses, so a response
+        // routed to the wrong caller shows up as a value that caller never sent
+        const FreeSRP::command_id set_ids[] = {FreeSRP::SET_RX_LO_FREQ, FreeSRP::SET_TX_LO_FREQ, FreeSRP::SET_RX_RF_GAIN, FreeSRP::SET_TX_ATTENUATION};
+        const unsigned int num_settings = sizeof(set_ids) / sizeof(set_ids[0]);
+        // Read-backs are only meaningful while no other thread can change the same setting in between
+        const bool read_back = num_threads <= num_settings;
+        atomic<unsigned long> mismatched{0}, wrong_values{0}, failed{0};
+
+        auto start = chrono::steady_clock::now();
+
+        vector<thread> threads;
+        for(unsigned int t = 0; t < num_threads; t++)
+        {
+            threads.emplace_back([&, t]() {
+                FreeSRP::command_id set_id = set_ids[t % num_settings];
+                FreeSRP::command_id get_id = static_cast<FreeSRP::command_id>(set_id - 1);
+                for(unsigned int i = 0; i < count; i++)
+                {
+                    // Unique per thread; LOs are 1 MHz apart, gains 1 dB, attenuations 0.25 dB
+                    unsigned int v = t + num_threads * (i % 4);
+                    uint64_t value, tolerance = 0;
+                    switch(set_id)
+                    {
+                    case FreeSRP::SET_RX_LO_FREQ:
+                    case FreeSRP::SET_TX_LO_FREQ:
+                        value = 100000000ULL + v * 1000000ULL;
+                        tolerance = 1000; // The device reports the LO it actually synthesized
+                        break;
+                    case FreeSRP::SET_RX_RF_GAIN:
+                        value = v % 72;
+                        break;
+                    default:
+                        value = (v * 250) % 89750;
+                        break;
+                    }
+
+                    try
+                    {
+                        FreeSRP::response r = srp.send_cmd({set_id, value});
+                        if(r.cmd != set_id)
+                        {
+                            mismatched++;
+                        }
+                        else if(r.error != FreeSRP::CMD_OK || (r.param > value ? r.param - value : value - r.param) > tolerance)
+                        {
+                            wrong_values++;
+                        }
+                        else if(read_back)
+                        {
+                            FreeSRP::response g = srp.send_cmd({get_id, 0}, true);
+                            if(g.cmd != get_id)
+                            {
+                                mismatched++;
+                            }
+                            else if(g.param != r.param)
+                            {
+                                wrong_values++;
+                            }
+                        }
+                    }
+                    catch(const FreeSRP::ConnectionError &e)
+                    {
+                        failed++;
+                    }
+                }
+            });
+        }
+
+        for(thread &t : threads)
+        {
+            t.join();
+        }
+
+        double elapsed_s = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        srp.stop_rx();
+        srp.send_cmd({FreeSRP::SET_DATAPATH_EN, 0});
+
+        cout << fixed << setprecision(1);
+        unsigned long total = (unsigned long) num_threads * count * (read_back ? 2 : 1);
+        cout << total << " commands from " << num_threads << " threads: " << total / elapsed_s << " commands/s" << endl;
+        cout << "received " << rx_samples.load() / elapsed_s / 1e6 << " MSps meanwhile" << endl;
+        cout << mismatched.load() << " mismatched responses, " << wrong_values.load() << " wrong values, " << failed.load() << " failed commands" << endl;
+
+        return 0;
+    }
 }
@@ -34,19 +34,25 @@ namespace cmds
     {
         string cmd;
         string descr;
-        function<int(const FreeSRP::FreeSRP &, vector<string> &)> func;
+        function<int(FreeSRP::FreeSRP &, vector<string> &)> func;
         bool exit;
     };
 
-    int cmd_help(const FreeSRP::FreeSRP &srp, vector<string> &params);
-    int cmd_set(const FreeSRP::FreeSRP &srp, vector<string> &params);
-    int cmd_get(const FreeSRP::FreeSRP &srp, vector<string> &params);
+    int cmd_help(FreeSRP::FreeSRP &srp, vector<string> &params);
+    int cmd_set(FreeSRP::FreeSRP &srp, vector<string> &params);
+    int cmd_get(FreeSRP::FreeSRP &srp, vector<string> &params);
+    int cmd_bench(FreeSRP::FreeSRP &srp, vector<string> &params);
+    int cmd_hop(FreeSRP::FreeSRP &srp, vector<string> &params);
+    int cmd_stress(FreeSRP::FreeSRP &srp, vector<string> &params);
 
     const vector<cmd_def> cmds = {
             {"help", "display this help message", cmds::cmd_help, false},
             {"exit", "exit this program", nullptr, true},
             {"set", "set a parameter", cmd_set, false},
-            {"get", "get a parameter", cmd_get, false}
+            {"get", "get a parameter", cmd_get, false},
+            {"bench", "compare command throughput of blocking and pipelined commands", cmd_bench, false},
+            {"hop", "hop the LO across a list of frequencies and report hop timing", cmd_hop, false},
+            {"stress", "send commands from several threads while receiving and check every response", cmd_stress, false}
     };
 }
 
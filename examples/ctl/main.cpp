@@ -29,7 +29,7 @@
 using namespace std;
 using namespace FreeSRP;
 
-bool process_command(const FreeSRP::FreeSRP &srp)
+bool process_command(FreeSRP::FreeSRP &srp)
 {
     bool exit = false;
 
@@ -0,0 +1,149 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FREESRP_IO_BLOCK_RING_HPP
+#define FREESRP_IO_BLOCK_RING_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+
+// Single-producer single-consumer ring of fixed-size blocks in one preallocated, page-aligned buffer.
+// Consecutive blocks are adjacent in memory, so the consumer can hand a run of full blocks to a single write().
+// The consumer may release blocks to the producer later than it consumes them, for as long as it still needs
+// their memory after handing it on.
+class block_ring
+{
+public:
+    block_ring(size_t block_size, size_t num_blocks) : _block_size(block_size), _num_blocks(num_blocks), _lengths(num_blocks, 0)
+    {
+        if(posix_memalign((void **) &_buf, 4096, block_size * num_blocks) != 0)
+        {
+            throw std::bad_alloc();
+        }
+
+        // Touch every page now so the producer never takes a page fault
+        memset(_buf, 0, block_size * num_blocks);
+    }
+
+    ~block_ring()
+    {
+        free(_buf);
+    }
+
+    block_ring(const block_ring &) = delete;
+    block_ring &operator=(const block_ring &) = delete;
+
+    size_t block_size() const { return _block_size; }
+    size_t capacity() const { return _num_blocks; }
+    size_t fill() const { return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire); }
+
+    // Producer: the next free block, or nullptr if the ring is full
+    unsigned char *write_block()
+    {
+        size_t head = _head.load(std::memory_order_relaxed);
+        if(head - _tail.load(std::memory_order_acquire) == _num_blocks)
+        {
+            return nullptr;
+        }
+        return _buf + (head % _num_blocks) * _block_size;
+    }
+
+    // Producer: publish the block returned by write_block, holding length bytes
+    void commit_write(size_t length)
+    {
+        size_t head = _head.load(std::memory_order_relaxed);
+        _lengths[head % _num_blocks] = length;
+        _head.store(head + 1, std::memory_order_release);
+    }
+
+    // Consumer: the oldest unconsumed block, or nullptr if there is none
+    unsigned char *read_block(size_t &length)
+    {
+        size_t tail = _read;
+        if(_head.load(std::memory_order_acquire) == tail)
+        {
+            return nullptr;
+        }
+        length = _lengths[tail % _num_blocks];
+        return _buf + (tail % _num_blocks) * _block_size;
+    }
+
+    // Consumer: the oldest unconsumed blocks that are contiguous in memory, up to max_blocks of them. The run ends
+    // after the first block that is not full, so its bytes are contiguous as well.
+    unsigned char *read_run(size_t max_blocks, size_t &blocks, size_t &length)
+    {
+        size_t tail = _read;
+        size_t available = _head.load(std::memory_order_acquire) - tail;
+
+        size_t first = tail % _num_blocks;
+        blocks = 0;
+        length = 0;
+        while(blocks < available && blocks < max_blocks && first + blocks < _num_blocks)
+        {
+            size_t block_length = _lengths[first + blocks];
+            blocks++;
+            length += block_length;
+            if(block_length != _block_size)
+            {
+                break;
+            }
+        }
+
+        return blocks > 0 ? _buf + first * _block_size : nullptr;
+    }
+
+    // Consumer: mark blocks returned by read_block or read_run as consumed and release them to the producer
+    void commit_read(size_t blocks = 1)
+    {
+        consume(blocks);
+        release(blocks);
+    }
+
+    // Consumer: mark blocks as consumed, without releasing them yet
+    void consume(size_t blocks)
+    {
+        _read += blocks;
+    }
+
+    // Consumer: release the oldest consumed blocks to the producer
+    void release(size_t blocks)
+    {
+        _tail.store(_tail.load(std::memory_order_relaxed) + blocks, std::memory_order_release);
+    }
+
+private:
+    size_t _block_size;
+    size_t _num_blocks;
+    unsigned char *_buf;
+    std::vector<size_t> _lengths;
+
+    // Padding rather than alignas keeps the producer's and consumer's counters on separate cache lines. An
+    // over-aligned class would need the aligned operator new, which C++11 does not have.
+    char _pad0[64];
+    std::atomic<size_t> _head{0};
+    char _pad1[64];
+    std::atomic<size_t> _tail{0};
+    size_t _read = 0;
+};
+
+#endif
@@ -18,29 +18,40 @@
  */
 
 #include <iostream>
-#include <fstream>
 #include <mutex>
 #include <condition_variable>
 #include <chrono>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <deque>
 #include <boost/lexical_cast.hpp>
 
 #include <freesrp.hpp>
+#include <freesrp_capture.hpp>
+#include <freesrp_formats.hpp>
 
 #include "optionparser.hpp"
+#include "block_ring.hpp"
 
 #include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <iomanip>
 
 using namespace std;
 using namespace FreeSRP;
 
-enum optionIndex {NONE, HELP, OUTFILE, INFILE, FPGA, TX, LOOPBACK, CENTER_FREQ, BANDWIDTH, GAIN};
+enum optionIndex {NONE, HELP, OUTFILE, INFILE, FPGA, TX, LOOPBACK, CENTER_FREQ, BANDWIDTH, GAIN, FORMAT, HEADER, RECORD, SIGMF, RING, PREFETCH, LOOP, EOF_MODE, IN_FORMAT, IN_START, EVENTS, TRIGGER, PRE_TRIGGER, POST_TRIGGER, DECIMATE, PASSBAND};
 const option::Descriptor usage[] = {
         {NONE,        0, "",  "",            option::Arg::None,      "usage: freesrp-io [options] -ofilename\n"
-                                                                     "       input/output format is complex signed 16-bit\noptions:"},
+                                                                     "       input format is complex signed 16-bit\noptions:"},
         {HELP,        0, "h", "help",        option::Arg::None,      "  -h, --help                     Print usage and exit"},
         {OUTFILE,     0, "o", "out",         option::Arg::Optional,  "  -o[filename], --out=[filename] Output to specified file ('-o-' for stdout)"},
         {INFILE,      0, "i", "in",          option::Arg::Optional,  "  -i[filename], --in=[filename]  Read from specified file ('-i-' for stdin)"},
@@ -50,104 +61,362 @@ const option::Descriptor usage[] = {
         {CENTER_FREQ, 0, "f", "freq",        option::Arg::Optional,  "  -f[freq], --freq=[freq]        Center frequency in hertz (70e6 to 6e9)"},
         {BANDWIDTH,   0, "b", "bandwidth",   option::Arg::Optional,  "  -b[bw], --bandwidth=[bw]       Bandwidth in hertz (1e6 to 61.44e6)"},
         {GAIN,        0, "g", "gain",        option::Arg::Optional,  "  -g[gain], --gain=[gain]        Gain in decibels (0 to 74)"},
-        {NONE,        0, "",  "",            option::Arg::None,      "\nexample: freesrp-io -f2.42e9 -b4e6 -g30 -o-"},
+        {DECIMATE,    0, "",  "decimate",    option::Arg::Optional,  "  --decimate=[factor]            Lowpass filter and decimate received samples by this factor"},
+        {PASSBAND,    0, "",  "passband",    option::Arg::Optional,  "  --passband=[fraction]          Passband of the decimation filter, fraction of the decimated rate (default 0.4)"},
+        {FORMAT,      0, "",  "format",      option::Arg::Optional,  "  --format=[fmt]                 Output format: cs8, cs16, cf32, cs12packed or raw (default cs16)"},
+        {HEADER,      0, "",  "header",      option::Arg::None,      "  --header                       Start the output with a capture header (rate, frequency, gain), always for cs12packed"},
+        {RECORD,      0, "",  "record",      option::Arg::Optional,  "  --record=[file,file,...]       Instead of -o, record with O_DIRECT writes striped across the files"},
+        {SIGMF,       0, "",  "sigmf",       option::Arg::Optional,  "  --sigmf=[name]                 Instead of -o, record name.sigmf-data and name.sigmf-meta (cs8, cs16 or cf32)"},
+        {EVENTS,      0, "",  "events",      option::Arg::Optional,  "  --events=[prefix]              Instead of -o, record only events to prefix_000001.<format>, ..."},
+        {TRIGGER,     0, "",  "trigger",     option::Arg::Optional,  "  --trigger=[dBFS]               Power of a transfer that starts an event (default -30)"},
+        {PRE_TRIGGER, 0, "",  "pre",         option::Arg::Optional,  "  --pre=[seconds]                Samples to record before an event (default 0.1)"},
+        {POST_TRIGGER,0, "",  "post",        option::Arg::Optional,  "  --post=[seconds]               Samples to record after the start of an event (default 0.1)"},
+        {RING,        0, "",  "ring",        option::Arg::Optional,  "  --ring=[MiB]                   Size of the output buffer between receiver and writer (default 256)"},
+        {PREFETCH,    0, "",  "prefetch",    option::Arg::Optional,  "  --prefetch=[blocks]            Transfers worth of input to read ahead (default 256, 8 MiB)"},
+        {LOOP,        0, "",  "loop",        option::Arg::None,      "  --loop                         Restart from the beginning of the input file at its end"},
+        {EOF_MODE,    0, "",  "eof",         option::Arg::Optional,  "  --eof=[zeros|stop]             At the end of the input, transmit zeros or stop (default zeros)"},
+        {IN_FORMAT,   0, "",  "in-format",   option::Arg::Optional,  "  --in-format=[fmt]              Format of input without capture header (default cs16)"},
+        {IN_START,    0, "",  "in-start",    option::Arg::Optional,  "  --in-start=[sample]            Start transmitting an input file at this sample"},
+        {NONE,        0, "",  "",            option::Arg::None,      "\nexample: freesrp-io -f2.42e9 -b4e6 -g30 -o-\n"
+                                                                     "send SIGUSR1 to print the streaming latency histograms"},
         {0,0,0,0,0,0}
 };
 
-unique_ptr<ostream> _out = nullptr;
-unique_ptr<istream> _in = nullptr;
+// Received samples are converted into blocks of this ring by the RX callback and written out by the writer thread
+int _out_fd = -1;
+sample_format _out_format = FORMAT_CS16;
+size_t _pipe_size = 0; // Nonzero if output goes to a pipe through vmsplice
+unique_ptr<block_ring> _rx_ring;
+atomic<bool> _writing{false};
+atomic<unsigned long long> _rx_dropped_samples{0};
+size_t _rx_ring_peak = 0;
+size_t _rx_block_fill = 0; // Bytes in the ring block being filled. It is committed once full, or by flush_rx_block
+
+// Alternatively, received samples are passed to a disk recorder, a SigMF writer or a triggered capture
+unique_ptr<recorder> _recorder;
+unique_ptr<sigmf_writer> _sigmf;
+unique_ptr<triggered_capture> _events;
+
+// Samples to transmit are read and converted into blocks of this ring by the reader thread, ahead of the TX callback
+int _in_fd = -1;
+sample_format _in_format = FORMAT_CS16;
+unique_ptr<block_ring> _tx_ring;
+atomic<bool> _reading{false};
+atomic<bool> _in_eof{false};
+bool _in_loop = false;
+bool _stop_at_eof = false;
+size_t _tx_block_offset = 0;
+unsigned long _tx_underruns = 0;
+
+// Input files are transmitted straight from a memory map instead
+unique_ptr<tx_playback> _playback;
 
 mutex _interrupt_mut;
 condition_variable _interrupt;
 
+// Set by the signal handler and by the writer and TX threads. std::atomic<bool> is lock-free, so the handler may
+// store to it directly.
+atomic<bool> _interrupted{false};
+volatile sig_atomic_t _dump_latency = 0;
+
 void sigint_callback(int s)
 {
+    _interrupted = true;
     _interrupt.notify_all();
 }
 
+// Stop from a worker thread. Setting the flag under the mutex means the main thread cannot miss the notification
+// between checking the flag and waiting.
+void interrupt()
+{
+    {
+        lock_guard<mutex> lck(_interrupt_mut);
+        _interrupted = true;
+    }
+    _interrupt.notify_all();
+}
+
+void sigusr1_callback(int s)
+{
+    _dump_latency = 1;
+}
+
 void rx_callback(const vector<sample> &samples)
 {
-    static vector<int16_t> buf;
+    if(_recorder)
+    {
+        _recorder->write(samples.data(), samples.size());
+        return;
+    }
+    if(_sigmf)
+    {
+        _sigmf->write(samples.data(), samples.size());
+        return;
+    }
+    if(_events)
+    {
+        _events->write(samples.data(), samples.size());
+        return;
+    }
+
+    // With decimation, a callback delivers only part of a block. Blocks are filled across callbacks so that the
+    // whole ring is used and the writer gets runs of full blocks.
+    size_t sample_size = sample_format_size(_out_format);
+    size_t block_samples = _rx_ring->block_size() / sample_size;
 
-    // For rate counter
-    static long rate_probe_counter = 0; // Samples processed since last comparison period
-    static long rate_probe_counter_comp = 10000000; // Calculate rate every this many processed samples
-    static time_t current_ms = 0, previous_ms = 0;
+    for(size_t offset = 0; offset < samples.size(); )
+    {
+        // Returns the same block until it is committed
+        unsigned char *buf = _rx_ring->write_block();
+        if(buf == nullptr)
+        {
+            // The writer is not keeping up, drop the samples rather than stall the receiver
+            _rx_dropped_samples += samples.size() - offset;
+            return;
+        }
 
-    buf.resize(samples.size() * 2);
+        size_t filled = _rx_block_fill / sample_size;
+        size_t count = min(block_samples - filled, samples.size() - offset);
+        convert_samples(samples.data() + offset, count, _out_format, buf + _rx_block_fill);
+        _rx_block_fill += count * sample_size;
+        offset += count;
 
-    int buf_index = 0;
-    for(const sample &s : samples)
+        if(filled + count == block_samples)
+        {
+            _rx_ring->commit_write(_rx_block_fill);
+            _rx_block_fill = 0;
+            _rx_ring_peak = max(_rx_ring_peak, _rx_ring->fill());
+        }
+    }
+}
+
+// Hand the partly filled last block to the writer once the receiver has stopped
+void flush_rx_block()
+{
+    if(_rx_ring && _rx_block_fill > 0)
     {
-        // Convert from 12-bit to full scale 16-bit and copy to output buffer
-        buf[buf_index++] = (int16_t) (s.i * 16);
-        buf[buf_index++] = (int16_t) (s.q * 16);
+        _rx_ring->commit_write(_rx_block_fill);
+        _rx_block_fill = 0;
     }
+}
 
-    _out->write((char *) buf.data(), sizeof(int16_t) * 2 * samples.size());
+void writer()
+{
+    // Write runs of up to 4 MiB of consecutive blocks at once
+    size_t max_blocks = max((size_t) 1, ((size_t) 4 << 20) / _rx_ring->block_size());
+    bool failed = false;
 
-    // Calculate & report sample rate
-    rate_probe_counter += samples.size();
+    // vmsplice hands the pipe references to the ring's pages instead of copies. A run can only be overwritten once
+    // the reader has consumed it, which is certain once a pipe's worth of data has been spliced after it.
+    deque<pair<size_t, size_t>> spliced; // Blocks and bytes of each run spliced but not yet released
+    size_t spliced_bytes = 0;
 
-    if(rate_probe_counter >= rate_probe_counter_comp)
+    while(true)
     {
-        if(previous_ms == 0)
+        size_t blocks, length;
+        unsigned char *data = _rx_ring->read_run(max_blocks, blocks, length);
+        if(data == nullptr)
         {
-            previous_ms = chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+            if(!_writing.load())
+            {
+                break;
+            }
+            this_thread::sleep_for(chrono::milliseconds(1));
+            continue;
         }
-        else
+
+        size_t written = 0;
+        while(!failed && written < length)
         {
-            current_ms = chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();;
-            time_t elapsed_ms = current_ms - previous_ms;
-            previous_ms = current_ms;
+            ssize_t ret;
+            if(_pipe_size > 0)
+            {
+                iovec iov = {data + written, length - written};
+                ret = vmsplice(_out_fd, &iov, 1, 0);
+            }
+            else
+            {
+                ret = write(_out_fd, data + written, length - written);
+            }
 
-            cerr << "RX: " << fixed << setprecision(4) << ((double) rate_probe_counter) / ((double) elapsed_ms) / 1000.0 << "MSps" << endl;
+            if(ret < 0 && errno != EINTR)
+            {
+                // Discard everything from now on and stop
+                cerr << "Error writing output: " << strerror(errno) << endl;
+                failed = true;
+                interrupt();
+            }
+            else if(ret > 0)
+            {
+                written += ret;
+            }
         }
 
-        rate_probe_counter = 0;
+        if(_pipe_size > 0 && !failed)
+        {
+            _rx_ring->consume(blocks);
+            spliced.push_back(make_pair(blocks, length));
+            spliced_bytes += length;
+
+            while(!spliced.empty() && spliced_bytes - spliced.front().second >= _pipe_size)
+            {
+                _rx_ring->release(spliced.front().first);
+                spliced_bytes -= spliced.front().second;
+                spliced.pop_front();
+            }
+        }
+        else
+        {
+            _rx_ring->commit_read(blocks);
+        }
     }
 }
 
-void tx_callback(vector<sample> &samples)
+// Runs an I/O loop on its own thread while its flag is set, and stops it when going out of scope
+struct io_thread
 {
-    static vector<int16_t> buf;
+    atomic<bool> &running;
+    thread t;
 
-    // For rate counter
-    static long rate_probe_counter = 0; // Samples processed since last comparison period
-    static long rate_probe_counter_comp = 10000000; // Calculate rate every this many processed samples
-    static time_t current_ms = 0, previous_ms = 0;
+    io_thread(atomic<bool> &running_flag, void (*loop)()) : running(running_flag)
+    {
+        running.store(true);
+        t = thread(loop);
+    }
 
-    buf.resize(samples.size() * 2);
+    ~io_thread()
+    {
+        stop();
+    }
 
-    _in->read((char *) buf.data(), sizeof(int16_t) * 2 * samples.size());
+    void stop()
+    {
+        if(t.joinable())
+        {
+            running.store(false);
+            t.join();
+        }
+    }
+};
 
-    int buf_index = 0;
-    for(sample &s : samples)
+void tx_callback(vector<sample> &samples)
+{
+    size_t filled = 0;
+    while(filled < samples.size())
     {
-        // Convert from full scale 16-bit to 12 bit and copy to output buffer
-        s.i = (int16_t) (buf[buf_index++] / 16);
-        s.q = (int16_t) (buf[buf_index++] / 16);
+        size_t length;
+        const sample *block = (const sample *) _tx_ring->read_block(length);
+        if(block == nullptr)
+        {
+            break;
+        }
+
+        // Copy what is left of the oldest block
+        size_t available = length / sizeof(sample) - _tx_block_offset;
+        size_t count = min(available, samples.size() - filled);
+        memcpy(samples.data() + filled, block + _tx_block_offset, count * sizeof(sample));
+        filled += count;
+        _tx_block_offset += count;
+
+        if(count == available)
+        {
+            _tx_ring->commit_read();
+            _tx_block_offset = 0;
+        }
     }
 
-    // Calculate & report sample rate
-    rate_probe_counter += samples.size();
+    if(filled < samples.size())
+    {
+        // Transmit zeros while the reader is behind or the input has ended
+        memset(samples.data() + filled, 0, (samples.size() - filled) * sizeof(sample));
 
-    if(rate_probe_counter >= rate_probe_counter_comp)
+        if(!_in_eof.load())
+        {
+            _tx_underruns++;
+        }
+        else if(_stop_at_eof && !_interrupted)
+        {
+            interrupt();
+        }
+    }
+}
+
+void playback_fill(unsigned char *buffer, size_t count)
+{
+    _playback->fill(buffer, count);
+
+    if(_stop_at_eof && _playback->finished() && !_interrupted)
+    {
+        interrupt();
+    }
+}
+
+// Read until buf is full or the input ends, returns the number of bytes read
+size_t read_input(unsigned char *buf, size_t length)
+{
+    size_t got = 0;
+    while(got < length)
     {
-        if(previous_ms == 0)
+        ssize_t ret = read(_in_fd, buf + got, length - got);
+        if(ret == 0)
         {
-            previous_ms = chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+            break;
         }
-        else
+        else if(ret < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            cerr << "Error reading input: " << strerror(errno) << endl;
+            break;
+        }
+        got += ret;
+    }
+    return got;
+}
+
+void reader()
+{
+    size_t in_sample_size = sample_format_size(_in_format);
+    size_t block_samples = _tx_ring->block_size() / sizeof(sample);
+    vector<unsigned char> buf(block_samples * in_sample_size);
+
+    while(_reading.load())
+    {
+        sample *block = (sample *) _tx_ring->write_block();
+        if(block == nullptr)
         {
-            current_ms = chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();;
-            time_t elapsed_ms = current_ms - previous_ms;
-            previous_ms = current_ms;
+            // Read ahead as far as the prefetch depth allows
+            this_thread::sleep_for(chrono::milliseconds(1));
+            continue;
+        }
+
+        // Same conversion as for mapped input files, a partial sample at the end of the input is dropped
+        size_t got = read_input(buf.data(), buf.size());
+        size_t count = got / in_sample_size;
+        convert_to_samples(buf.data(), count, _in_format, block);
 
-            cerr << "TX: " << fixed << setprecision(4) << ((double) rate_probe_counter) / ((double) elapsed_ms) / 1000.0 << "MSps" << endl;
+        if(count > 0)
+        {
+            _tx_ring->commit_write(count * sizeof(sample));
         }
 
-        rate_probe_counter = 0;
+        if(got < buf.size())
+        {
+            // End of input
+            if(_in_loop && lseek(_in_fd, 0, SEEK_SET) == 0)
+            {
+                continue;
+            }
+            else if(_in_loop)
+            {
+                cerr << "Error: Cannot loop input that is not a regular file" << endl;
+            }
+
+            _in_eof.store(true);
+            return;
+        }
     }
 }
 
@@ -166,6 +435,7 @@ void start(FreeSRP::FreeSRP &srp)
 void stop(FreeSRP::FreeSRP &srp)
 {
     srp.stop_rx();
+    flush_rx_block();
 
     FreeSRP::response res = srp.send_cmd({SET_DATAPATH_EN, 0});
     if(res.error != FreeSRP::CMD_OK)
@@ -193,35 +463,57 @@ int main(int argc, char *argv[])
         return 0;
     }
 
-    streambuf *of_buf;
-    ofstream of;
+    vector<string> record_paths;
+    string sigmf_path;
+    string events_prefix;
 
-    if(options[OUTFILE] && options[OUTFILE].arg)
+    if(options[SIGMF] && options[SIGMF].arg)
+    {
+        sigmf_path = options[SIGMF].arg;
+    }
+    else if(options[EVENTS] && options[EVENTS].arg)
+    {
+        events_prefix = options[EVENTS].arg;
+    }
+    else if(options[RECORD] && options[RECORD].arg)
+    {
+        string paths = options[RECORD].arg;
+        for(size_t start = 0, end; start <= paths.size(); start = end + 1)
+        {
+            end = min(paths.find(',', start), paths.size());
+            if(end > start)
+            {
+                record_paths.push_back(paths.substr(start, end - start));
+            }
+        }
+    }
+    else if(options[OUTFILE] && options[OUTFILE].arg)
     {
         string outfile = options[OUTFILE].arg;
 
         if(outfile == "-")
         {
-            of_buf = cout.rdbuf();
+            _out_fd = STDOUT_FILENO;
         }
         else
         {
-            of.open(outfile, ios::binary | ios::out);
-            of_buf = of.rdbuf();
+            _out_fd = open(outfile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if(_out_fd < 0)
+            {
+                cerr << "Error: Could not open '" << outfile << "': " << strerror(errno) << endl;
+                return 1;
+            }
         }
-
-        _out.reset(new ostream(of_buf));
     }
     else
     {
-        cerr << "Error: You must specify an output file using the '-o' option. See 'freesrp-io --help'." << endl;
+        cerr << "Error: You must specify an output file using the '-o', '--record', '--sigmf' or '--events' option. See 'freesrp-io --help'." << endl;
         return 1;
     }
 
     bool loopback = false, transmit = false;
+    string in_path;
 
-    streambuf *if_buf;
-    ifstream ifs;
 
     if((!options[TX] != !options[LOOPBACK]) && options[INFILE] && options[INFILE].arg)
     {
@@ -236,18 +528,26 @@ int main(int argc, char *argv[])
         }
 
         string infile = options[INFILE].arg;
+        struct stat in_stat;
 
         if(infile == "-")
         {
-            if_buf = cin.rdbuf();
+            _in_fd = STDIN_FILENO;
+        }
+        else if(stat(infile.c_str(), &in_stat) == 0 && S_ISREG(in_stat.st_mode))
+        {
+            // Regular files are mapped and transmitted without the reader thread, see below
+            in_path = infile;
         }
         else
         {
-            ifs.open(infile, ios::binary | ios::in);
-            if_buf = ifs.rdbuf();
+            _in_fd = open(infile.c_str(), O_RDONLY);
+            if(_in_fd < 0)
+            {
+                cerr << "Error: Could not open '" << infile << "': " << strerror(errno) << endl;
+                return 1;
+            }
         }
-
-        _in.reset(new istream(if_buf));
     }
     else if(options[LOOPBACK] || options[TX] || options[INFILE])
     {
@@ -278,6 +578,115 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    size_t ring_mib = 256, prefetch_blocks = 256;
+    double trigger = -30, pre_trigger = 0.1, post_trigger = 0.1;
+    unsigned int decimation = 1;
+    double passband = 0.4;
+
+    try
+    {
+        if(options[RING].arg) ring_mib = boost::lexical_cast<size_t>(options[RING].arg);
+        if(options[TRIGGER].arg) trigger = boost::lexical_cast<double>(options[TRIGGER].arg);
+        if(options[PRE_TRIGGER].arg) pre_trigger = boost::lexical_cast<double>(options[PRE_TRIGGER].arg);
+        if(options[POST_TRIGGER].arg) post_trigger = boost::lexical_cast<double>(options[POST_TRIGGER].arg);
+        if(options[DECIMATE].arg) decimation = max(1u, boost::lexical_cast<unsigned int>(options[DECIMATE].arg));
+        if(options[PASSBAND].arg) passband = boost::lexical_cast<double>(options[PASSBAND].arg);
+        if(options[PREFETCH].arg) prefetch_blocks = max((size_t) 2, boost::lexical_cast<size_t>(options[PREFETCH].arg));
+    }
+    catch(boost::bad_lexical_cast)
+    {
+        cerr << "Error: Please specify valid numerical values" << endl;
+        return 1;
+    }
+
+    _in_loop = options[LOOP];
+
+    if(options[EOF_MODE])
+    {
+        string eof_mode = options[EOF_MODE].arg ? options[EOF_MODE].arg : "";
+        if(eof_mode == "stop")
+        {
+            _stop_at_eof = true;
+        }
+        else if(eof_mode != "zeros")
+        {
+            cerr << "Error: --eof expects 'zeros' or 'stop'. See 'freesrp-io --help'." << endl;
+            return 1;
+        }
+    }
+
+    if(options[IN_FORMAT] && (!options[IN_FORMAT].arg || !parse_sample_format(options[IN_FORMAT].arg, _in_format)))
+    {
+        cerr << "Error: --in-format expects cs8, cs16, cf32, cs12packed or raw. See 'freesrp-io --help'." << endl;
+        return 1;
+    }
+
+    if(options[IN_START] && _in_fd >= 0)
+    {
+        cerr << "Error: --in-start requires a regular input file. See 'freesrp-io --help'." << endl;
+        return 1;
+    }
+
+    // One TX block holds the samples of one USB transfer
+    if(!in_path.empty())
+    {
+        unsigned long long in_start = 0;
+        try
+        {
+            if(options[IN_START].arg) in_start = boost::lexical_cast<unsigned long long>(options[IN_START].arg);
+            _playback.reset(new tx_playback(in_path, _in_format, in_start, _in_loop));
+        }
+        catch(boost::bad_lexical_cast)
+        {
+            cerr << "Error: Please specify valid numerical values" << endl;
+            return 1;
+        }
+        catch(const runtime_error &e)
+        {
+            cerr << "Error: " << e.what() << endl;
+            return 1;
+        }
+    }
+    else if(_in_fd >= 0)
+    {
+        _tx_ring.reset(new block_ring(FREESRP_TX_BUF_SIZE / FREESRP_BYTES_PER_SAMPLE * sizeof(sample), prefetch_blocks));
+    }
+
+    if(options[FORMAT])
+    {
+        if(!options[FORMAT].arg || !parse_sample_format(options[FORMAT].arg, _out_format))
+        {
+            cerr << "Error: --format expects cs8, cs16, cf32, cs12packed or raw. See 'freesrp-io --help'." << endl;
+            return 1;
+        }
+    }
+
+    if(!sigmf_path.empty() && _out_format != FORMAT_CS8 && _out_format != FORMAT_CS16 && _out_format != FORMAT_CF32)
+    {
+        cerr << "Error: --sigmf expects --format=cs8, cs16 or cf32. See 'freesrp-io --help'." << endl;
+        return 1;
+    }
+
+    // One block holds the samples of one USB transfer
+    size_t block_size = FREESRP_RX_TX_BUF_SIZE / FREESRP_BYTES_PER_SAMPLE * sample_format_size(_out_format);
+    if(record_paths.empty() && sigmf_path.empty() && events_prefix.empty())
+    {
+        _rx_ring.reset(new block_ring(block_size, max((size_t) 4, (ring_mib << 20) / block_size)));
+    }
+
+    // When writing to a pipe, pass it pages of the ring rather than copying them, if the ring is large enough to
+    // keep a pipe's worth of spliced pages aside
+    struct stat out_stat;
+    if(_out_fd >= 0 && fstat(_out_fd, &out_stat) == 0 && S_ISFIFO(out_stat.st_mode))
+    {
+        fcntl(_out_fd, F_SETPIPE_SZ, 1 << 20);
+        int pipe_size = fcntl(_out_fd, F_GETPIPE_SZ);
+        if(pipe_size > 0 && (size_t) pipe_size * 4 <= block_size * _rx_ring->capacity())
+        {
+            _pipe_size = (size_t) pipe_size;
+        }
+    }
+
     string fpgaconfig_filename = "";
 
     if(options[FPGA])
@@ -328,37 +737,56 @@ int main(int argc, char *argv[])
         cerr << "Connected to FreeSRP" << endl;
         cerr << "Version: " << srp.version() << endl;
 
-        // Set center frequency
-        response r = srp.send_cmd(srp.make_command(SET_RX_LO_FREQ, center_freq));
-        if(r.error != CMD_OK)
-        {
-            std::cerr << "Could not set RX LO frequency, error: " << r.error << endl;
-            return 1;
-        }
+        // Set center frequency, bandwidth, sample rate and gain
+        radio_config config;
+        config.rx_lo_freq = center_freq;
+        config.rx_rf_bandwidth = bandwidth;
+        config.rx_samp_freq = bandwidth;
+        config.rx_rf_gain = gain;
 
-        // Set bandwidth and sample rate
-        r = srp.send_cmd(srp.make_command(SET_RX_RF_BANDWIDTH, bandwidth));
-        if(r.error != CMD_OK)
+        radio_config_result applied = srp.apply(config);
+        for(const response &r : applied.failed)
         {
-            std::cerr << "Could not set RX bandwidth, error: " << r.error << endl;
-            return 1;
+            switch(r.cmd)
+            {
+            case SET_RX_LO_FREQ:
+                std::cerr << "Could not set RX LO frequency, error: " << r.error << endl;
+                break;
+            case SET_RX_RF_BANDWIDTH:
+                std::cerr << "Could not set RX bandwidth, error: " << r.error << endl;
+                break;
+            case SET_RX_SAMP_FREQ:
+                std::cerr << "Could not set RX sample frequency, error: " << r.error << endl;
+                break;
+            case SET_RX_RF_GAIN:
+                std::cerr << "Could not set RX gain, error: " << r.error << endl;
+                break;
+            default:
+                std::cerr << "Could not configure FreeSRP, " << r << endl;
+                break;
+            }
         }
-
-        r = srp.send_cmd(srp.make_command(SET_RX_SAMP_FREQ, bandwidth));
-        if(r.error != CMD_OK)
+        if(!applied.ok())
         {
-            std::cerr << "Could not set RX sample frequency, error: " << r.error << endl;
             return 1;
         }
 
-        // Set gain
-        r = srp.send_cmd(srp.make_command(SET_RX_RF_GAIN, gain));
-        if(r.error != CMD_OK)
+        if(decimation > 1)
         {
-            std::cerr << "Could not set RX gain, error: " << r.error << endl;
-            return 1;
+            try
+            {
+                srp.set_rx_decimation(decimation, passband);
+            }
+            catch(const runtime_error &e)
+            {
+                cerr << "Error: " << e.what() << endl;
+                return 1;
+            }
+            cerr << "Decimating received samples by " << decimation << " to " << bandwidth / decimation / 1e6 << "MSps" << endl;
         }
 
+        response r;
+
         if(loopback)
         {
             // Enable loopback
@@ -374,11 +802,77 @@ int main(int argc, char *argv[])
             }
         }
 
-        // Enable signal chain and start receiving samples
+        if(!sigmf_path.empty())
+        {
+            sigmf_config sig_config;
+            sig_config.path = sigmf_path;
+            sig_config.format = _out_format;
+            sig_config.data.queue_blocks = (unsigned int) max((size_t) 2, (ring_mib << 20) / sig_config.data.block_size);
+            _sigmf.reset(new sigmf_writer(srp, sig_config));
+            cerr << "Recording to " << sigmf_path << ".sigmf-data" << endl;
+        }
+        else if(!events_prefix.empty())
+        {
+            // Keep a second more than the event window in memory to give the writer time to catch up
+            triggered_capture_config ev_config;
+            ev_config.prefix = events_prefix;
+            ev_config.header = read_capture_header(srp, _out_format);
+            ev_config.threshold = (float) trigger;
+            ev_config.pre_trigger = pre_trigger;
+            ev_config.post_trigger = post_trigger;
+            ev_config.history = pre_trigger + post_trigger + 1;
+            _events.reset(new triggered_capture(ev_config));
+            cerr << "Recording events above " << trigger << "dBFS to " << events_prefix << "_*" << endl;
+        }
+        else if(!record_paths.empty())
+        {
+            // The recorder's blocks take the place of the output buffer
+            recorder_config rec_config;
+            rec_config.paths = record_paths;
+            rec_config.header = read_capture_header(srp, _out_format);
+            rec_config.write_header = options[HEADER] || _out_format == FORMAT_CS12_PACKED;
+            rec_config.queue_blocks = (unsigned int) max((size_t) 2, (ring_mib << 20) / rec_config.block_size);
+            _recorder.reset(new recorder(rec_config));
+
+            recorder_statistics rec_stats = _recorder->stats();
+            cerr << "Recording to " << record_paths.size() << " file(s)" << (rec_stats.direct ? " with O_DIRECT" : "") << endl;
+        }
+        else if(options[HEADER] || _out_format == FORMAT_CS12_PACKED)
+        {
+            // Describe the samples so that freesrp-convert and other tools can interpret them
+            unsigned char header[FREESRP_CAPTURE_HEADER_SIZE];
+            encode_capture_header(read_capture_header(srp, _out_format), header);
+            if(write(_out_fd, header, sizeof(header)) != (ssize_t) sizeof(header))
+            {
+                cerr << "Error writing output: " << strerror(errno) << endl;
+                return 1;
+            }
+        }
+
+        // Start writing received samples, then enable signal chain and start receiving samples
+        unique_ptr<io_thread> output_writer;
+        if(!_recorder && !_sigmf && !_events)
+        {
+            output_writer.reset(new io_thread(_writing, writer));
+        }
+
         start(srp);
 
-        if(transmit || loopback)
+        unique_ptr<io_thread> input_reader;
+
+        if(_playback)
         {
+            srp.start_tx_raw(playback_fill);
+        }
+        else if(transmit || loopback)
+        {
+            // Let the reader fill the prefetch buffer before transmitting
+            input_reader.reset(new io_thread(_reading, reader));
+            for(int i = 0; i < 2000 && _tx_ring->fill() < _tx_ring->capacity() && !_in_eof.load(); i++)
+            {
+                this_thread::sleep_for(chrono::milliseconds(1));
+            }
+
             // Enable transmit signal chain
             srp.start_tx(tx_callback);
         }
@@ -392,19 +886,137 @@ int main(int argc, char *argv[])
         sigaction(SIGINT, &sigint_handler, NULL);
         sigaction(SIGPIPE, &sigint_handler, NULL);
 
+        struct sigaction sigusr1_handler;
+        sigusr1_handler.sa_handler = sigusr1_callback;
+        sigemptyset(&sigusr1_handler.sa_mask);
+        sigusr1_handler.sa_flags = 0;
+
+        sigaction(SIGUSR1, &sigusr1_handler, NULL);
+
+        // Report the sample rate once per second until interrupted
         unique_lock<mutex> lck(_interrupt_mut);
-        _interrupt.wait(lck);
+        while(!_interrupted)
+        {
+            _interrupt.wait_for(lck, chrono::seconds(1));
+            if(_interrupted)
+            {
+                break;
+            }
+
+            if(_dump_latency)
+            {
+                _dump_latency = 0;
+                srp.dump_latency_stats(cerr);
+            }
+
+            stream_statistics stats = srp.stream_stats();
+
+            cerr << "RX: " << fixed << setprecision(4) << stats.rx.rate_ewma / 1e6 << "MSps";
+            if(stats.rx.overflows > 0)
+            {
+                cerr << " (" << stats.rx.overflows << " samples dropped)";
+            }
+            if(_events)
+            {
+                triggered_capture_statistics ev_stats = _events->stats();
+                cerr << "  events: " << ev_stats.events;
+                if(ev_stats.lost > 0)
+                {
+                    cerr << " (" << ev_stats.lost << " lost)";
+                }
+            }
+            else if(_recorder || _sigmf)
+            {
+                recorder_statistics rec_stats = _recorder ? _recorder->stats() : _sigmf->stats();
+                cerr << "  disk: " << setprecision(1) << rec_stats.write_rate / 1e6 << "MB/s";
+                if(rec_stats.dropped > 0)
+                {
+                    cerr << " (" << rec_stats.dropped << " samples dropped)";
+                }
+            }
+            else
+            {
+                cerr << "  buffer: " << setprecision(1) << 100.0 * _rx_ring->fill() / _rx_ring->capacity() << "%";
+                if(_rx_dropped_samples.load() > 0)
+                {
+                    cerr << " (" << _rx_dropped_samples.load() << " samples dropped)";
+                }
+            }
+            if(transmit || loopback)
+            {
+                cerr << "  TX: " << fixed << setprecision(4) << stats.tx.rate_ewma / 1e6 << "MSps";
+                if(stats.tx.underflows > 0)
+                {
+                    cerr << " (" << stats.tx.underflows << " samples underrun)";
+                }
+            }
+            cerr << endl;
+        }
 
         if(transmit || loopback)
         {
             // Disable transmitter
             srp.stop_tx();
+
+            if(_playback)
+            {
+                cerr << "Input file: stopped at sample " << _playback->position() << " of " << _playback->capture().samples()
+                     << ", " << _playback->loops() << " loops" << endl;
+            }
+            else
+            {
+                input_reader->stop();
+                cerr << "Input buffer: " << _tx_underruns << " transfers underrun" << endl;
+            }
         }
 
         // Disable signal chain
         stop(srp);
 
-        _out->flush();
+        // Write out what is left in the buffer
+        if(_events)
+        {
+            _events->close();
+
+            triggered_capture_statistics ev_stats = _events->stats();
+            cerr << "Events: " << ev_stats.events << " written, " << ev_stats.lost << " lost, " << ev_stats.triggers
+                 << " triggering transfers" << endl;
+        }
+        else if(_recorder || _sigmf)
+        {
+            try
+            {
+                if(_recorder)
+                {
+                    _recorder->close();
+                }
+                else
+                {
+                    _sigmf->close();
+                }
+            }
+            catch(const runtime_error &e)
+            {
+                cerr << "Error: " << e.what() << endl;
+            }
+
+            recorder_statistics rec_stats = _recorder ? _recorder->stats() : _sigmf->stats();
+            cerr << "Recorder: " << rec_stats.bytes_written << " bytes written at " << fixed << setprecision(1)
+                 << rec_stats.write_rate / 1e6 << "MB/s, peak " << rec_stats.queue_peak << " blocks queued, "
+                 << rec_stats.dropped << " samples dropped" << endl;
+        }
+        else
+        {
+            output_writer->stop();
+            if(_out_fd != STDOUT_FILENO)
+            {
+                close(_out_fd);
+            }
+
+            cerr << "Output buffer: peak fill " << _rx_ring_peak << " of " << _rx_ring->capacity() << " blocks ("
+                 << fixed << setprecision(1) << 100.0 * _rx_ring_peak / _rx_ring->capacity() << "%), "
+                 << _rx_dropped_samples.load() << " samples dropped" << endl;
+        }
 
         if(loopback)
         {
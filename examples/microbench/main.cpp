@@ -0,0 +1,444 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+// Microbenchmarks for the sample codec and the data path's queue and callback primitives.
+// This uses the library's internal interface, so it must be built from the same source tree as the library.
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+#include <boost/lexical_cast.hpp>
+
+#include <freesrp_dsp.hpp>
+#include <freesrp_formats.hpp>
+
+#include "../../src/codec.hpp"
+#include "../../src/readerwriterqueue/readerwriterqueue.h"
+
+#include "optionparser.hpp"
+
+using namespace std;
+using FreeSRP::sample;
+
+// Samples in one 64 KiB RX transfer buffer
+#define MICROBENCH_SAMPLES (FREESRP_RX_TX_BUF_SIZE / FREESRP_BYTES_PER_SAMPLE)
+
+// Keeps the compiler from optimizing away results
+template<typename T> inline void do_not_optimize(T const &value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+inline void clobber_memory()
+{
+    asm volatile("" : : : "memory");
+}
+
+class benchmark_state
+{
+public:
+    explicit benchmark_state(unsigned long iterations) : _remaining(iterations), _iterations(iterations) {}
+
+    bool keep_running()
+    {
+        if(_remaining == _iterations)
+        {
+            _start = chrono::steady_clock::now();
+        }
+        if(_remaining-- == 0)
+        {
+            _elapsed = chrono::steady_clock::now() - _start;
+            return false;
+        }
+        return true;
+    }
+
+    void set_samples_per_iteration(size_t samples) { _samples_per_iteration = samples; }
+
+    unsigned long iterations() const { return _iterations; }
+    size_t samples_per_iteration() const { return _samples_per_iteration; }
+    double seconds() const { return chrono::duration<double>(_elapsed).count(); }
+
+private:
+    unsigned long _remaining;
+    unsigned long _iterations;
+    size_t _samples_per_iteration = 1;
+    chrono::steady_clock::time_point _start;
+    chrono::steady_clock::duration _elapsed{0};
+};
+
+struct benchmark
+{
+    string name;
+    function<void(benchmark_state &)> run;
+};
+
+struct codec_data
+{
+    vector<unsigned char> wire;
+    vector<sample> samples;
+
+    codec_data() : wire(FREESRP_RX_TX_BUF_SIZE), samples(MICROBENCH_SAMPLES)
+    {
+        mt19937 rng(1);
+        for(size_t i = 0; i < wire.size(); i += 2)
+        {
+            uint16_t v = (uint16_t) (rng() & 0xFFF);
+            memcpy(wire.data() + i, &v, sizeof(v));
+        }
+        for(sample &s : samples)
+        {
+            s.i = (int16_t) ((int) (rng() & 0xFFF) - 2048);
+            s.q = (int16_t) ((int) (rng() & 0xFFF) - 2048);
+        }
+    }
+};
+
+static codec_data data;
+
+void bm_decode(benchmark_state &state, void (*decode)(const unsigned char *, sample *, size_t))
+{
+    vector<sample> out(MICROBENCH_SAMPLES);
+    while(state.keep_running())
+    {
+        decode(data.wire.data(), out.data(), out.size());
+        clobber_memory();
+    }
+    state.set_samples_per_iteration(MICROBENCH_SAMPLES);
+}
+
+void bm_encode(benchmark_state &state, void (*encode)(const sample *, unsigned char *, size_t))
+{
+    vector<unsigned char> out(FREESRP_RX_TX_BUF_SIZE);
+    while(state.keep_running())
+    {
+        encode(data.samples.data(), out.data(), data.samples.size());
+        clobber_memory();
+    }
+    state.set_samples_per_iteration(MICROBENCH_SAMPLES);
+}
+
+void bm_convert(benchmark_state &state, FreeSRP::sample_format format)
+{
+    vector<unsigned char> out(MICROBENCH_SAMPLES * FreeSRP::sample_format_size(format));
+    while(state.keep_running())
+    {
+        FreeSRP::convert_samples(data.samples.data(), data.samples.size(), format, out.data());
+        clobber_memory();
+    }
+    state.set_samples_per_iteration(MICROBENCH_SAMPLES);
+}
+
+void bm_unpack(benchmark_state &state, FreeSRP::sample_format format)
+{
+    vector<unsigned char> in(MICROBENCH_SAMPLES * FreeSRP::sample_format_size(format));
+    FreeSRP::convert_samples(data.samples.data(), data.samples.size(), format, in.data());
+    vector<sample> out(MICROBENCH_SAMPLES);
+    while(state.keep_running())
+    {
+        FreeSRP::convert_to_samples(in.data(), MICROBENCH_SAMPLES, format, out.data());
+        clobber_memory();
+    }
+    state.set_samples_per_iteration(MICROBENCH_SAMPLES);
+}
+
+// Burst detection on noise with an occasional burst, as on a sparse channel
+void bm_burst_detect(benchmark_state &state)
+{
+    vector<sample> in(data.samples);
+    for(size_t n = 0; n < in.size(); n++)
+    {
+        in[n].i >>= (n % 8192) < 1024 ? 0 : 6;
+        in[n].q >>= (n % 8192) < 1024 ? 0 : 6;
+    }
+    unsigned long long bursts = 0;
+    FreeSRP::burst_detector detector(FreeSRP::burst_detector_config(),
+                                     [&](unsigned long long, const vector<sample> &) { bursts++; });
+    while(state.keep_running())
+    {
+        detector.process(in);
+        clobber_memory();
+    }
+    do_not_optimize(bursts);
+    state.set_samples_per_iteration(MICROBENCH_SAMPLES);
+}
+
+// Decimation of one transfer, as in the RX path with FreeSRP::set_rx_decimation
+void bm_decimate(benchmark_state &state, unsigned int decimation)
+{
+    FreeSRP::fir_decimator decimator(decimation);
+    vector<sample> out;
+    while(state.keep_running())
+    {
+        decimator.process(data.samples, out);
+        clobber_memory();
+    }
+    state.set_samples_per_iteration(MICROBENCH_SAMPLES);
+}
+
+// Channelizing one transfer on one worker thread, including delivery to and reading from the channel queues
+void bm_channelize(benchmark_state &state, unsigned int channels)
+{
+    FreeSRP::channelizer_config config;
+    config.channels = channels;
+    config.threads = 1;
+    FreeSRP::channelizer ch(config);
+    vector<sample> out;
+    while(state.keep_running())
+    {
+        ch.process(data.samples);
+        ch.flush();
+        for(unsigned int c = 0; c < channels; c++)
+        {
+            while(ch.pop(c, out))
+            {
+                clobber_memory();
+            }
+        }
+    }
+    state.set_samples_per_iteration(MICROBENCH_SAMPLES);
+}
+
+// Enqueue and dequeue one transfer's worth of samples one at a time, as the data path does
+void bm_queue_single(benchmark_state &state)
+{
+    moodycamel::ReaderWriterQueue<sample> queue(MICROBENCH_SAMPLES);
+    sample s;
+    while(state.keep_running())
+    {
+        for(const sample &in : data.samples)
+        {
+            queue.try_enqueue(in);
+        }
+        while(queue.try_dequeue(s))
+        {
+            do_not_optimize(s);
+        }
+    }
+    state.set_samples_per_iteration(MICROBENCH_SAMPLES);
+}
+
+// Enqueue and dequeue one transfer's worth of samples as a single block
+void bm_queue_block(benchmark_state &state)
+{
+    moodycamel::ReaderWriterQueue<vector<sample>> queue(FREESRP_RX_TX_TRANSFER_QUEUE_SIZE);
+    vector<sample> block(data.samples);
+    while(state.keep_running())
+    {
+        queue.try_enqueue(std::move(block));
+        queue.try_dequeue(block);
+        do_not_optimize(block.data());
+    }
+    state.set_samples_per_iteration(MICROBENCH_SAMPLES);
+}
+
+// Enqueue and dequeue one transfer's worth of samples as a single block, copying the samples in and out
+void bm_queue_block_copy(benchmark_state &state)
+{
+    moodycamel::ReaderWriterQueue<vector<sample>> queue(FREESRP_RX_TX_TRANSFER_QUEUE_SIZE);
+    vector<sample> block(MICROBENCH_SAMPLES);
+    vector<sample> out(MICROBENCH_SAMPLES);
+    while(state.keep_running())
+    {
+        memcpy(block.data(), data.samples.data(), block.size() * sizeof(sample));
+        queue.try_enqueue(std::move(block));
+        queue.try_dequeue(block);
+        memcpy(out.data(), block.data(), out.size() * sizeof(sample));
+        clobber_memory();
+    }
+    state.set_samples_per_iteration(MICROBENCH_SAMPLES);
+}
+
+// Cost of dispatching one transfer to the user's RX callback, the callback itself doing nothing
+void bm_callback_dispatch(benchmark_state &state)
+{
+    function<void(const vector<sample> &)> callback = [](const vector<sample> &samples) { do_not_optimize(samples.data()); };
+    do_not_optimize(callback);
+    while(state.keep_running())
+    {
+        callback(data.samples);
+    }
+    state.set_samples_per_iteration(MICROBENCH_SAMPLES);
+}
+
+// Cost of calling a std::function once per sample
+void bm_callback_per_sample(benchmark_state &state)
+{
+    int32_t acc = 0;
+    function<void(const sample &)> callback = [&acc](const sample &s) { acc += s.i; };
+    do_not_optimize(callback);
+    while(state.keep_running())
+    {
+        for(const sample &s : data.samples)
+        {
+            callback(s);
+        }
+        do_not_optimize(acc);
+    }
+    state.set_samples_per_iteration(MICROBENCH_SAMPLES);
+}
+
+// Check that the vectorized codec matches the scalar one for every possible 16-bit value
+bool codec_consistent()
+{
+#ifdef FREESRP_CODEC_SSE2
+    vector<unsigned char> wire(65536 * FREESRP_BYTES_PER_SAMPLE);
+    vector<sample> samples(65536);
+    for(uint32_t v = 0; v < 65536; v++)
+    {
+        uint16_t q = (uint16_t) v;
+        uint16_t i = (uint16_t) ~v;
+        memcpy(wire.data() + v * FREESRP_BYTES_PER_SAMPLE, &q, sizeof(q));
+        memcpy(wire.data() + v * FREESRP_BYTES_PER_SAMPLE + sizeof(q), &i, sizeof(i));
+        samples[v].i = (int16_t) v;
+        samples[v].q = (int16_t) ~v;
+    }
+
+    vector<sample> scalar_samples(samples.size()), sse2_samples(samples.size());
+    FreeSRP::decode_samples_scalar(wire.data(), scalar_samples.data(), samples.size());
+    FreeSRP::decode_samples_sse2(wire.data(), sse2_samples.data(), samples.size());
+
+    vector<unsigned char> scalar_wire(wire.size()), sse2_wire(wire.size());
+    FreeSRP::encode_samples_scalar(samples.data(), scalar_wire.data(), samples.size());
+    FreeSRP::encode_samples_sse2(samples.data(), sse2_wire.data(), samples.size());
+
+    return memcmp(scalar_samples.data(), sse2_samples.data(), samples.size() * sizeof(sample)) == 0 && scalar_wire == sse2_wire;
+#else
+    return true;
+#endif
+}
+
+enum optionIndex {NONE, HELP, FILTER, MIN_TIME};
+const option::Descriptor usage[] = {
+        {NONE,     0, "",  "",         option::Arg::None,     "usage: freesrp-microbench [options]\noptions:"},
+        {HELP,     0, "h", "help",     option::Arg::None,     "  -h, --help                      Print usage and exit"},
+        {FILTER,   0, "f", "filter",   option::Arg::Optional, "  -f[text], --filter=[text]       Only run benchmarks whose name contains text"},
+        {MIN_TIME, 0, "t", "min-time", option::Arg::Optional, "  -t[s], --min-time=[s]           Minimum time per benchmark (default 0.5)"},
+        {NONE,     0, "",  "",         option::Arg::None,     "\nexample: freesrp-microbench -fdecode"},
+        {0,0,0,0,0,0}
+};
+
+int main(int argc, char *argv[])
+{
+    // Parse options
+    argc-=(argc>0); argv+=(argc>0); // Skip program name (argv[0]), if present
+    option::Stats stats(usage, argc, argv);
+    option::Option options[stats.options_max], buffer[stats.buffer_max];
+    option::Parser parse(usage, argc, argv, options, buffer);
+
+    if(parse.error())
+    {
+        return 1;
+    }
+
+    if(options[HELP])
+    {
+        option::printUsage(cout, usage);
+        return 0;
+    }
+
+    string filter;
+    double min_time = 0.5;
+
+    try
+    {
+        if(options[FILTER].arg) filter = options[FILTER].arg;
+        if(options[MIN_TIME].arg) min_time = boost::lexical_cast<double>(options[MIN_TIME].arg);
+    }
+    catch(boost::bad_lexical_cast)
+    {
+        cerr << "Error: Please specify valid numerical values" << endl;
+        return 1;
+    }
+
+    if(!codec_consistent())
+    {
+        cerr << "Error: vectorized codec does not match the scalar codec" << endl;
+        return 1;
+    }
+
+    vector<benchmark> benchmarks = {
+        {"decode/scalar/64KiB", [](benchmark_state &s) { bm_decode(s, FreeSRP::decode_samples_scalar); }},
+#ifdef FREESRP_CODEC_SSE2
+        {"decode/sse2/64KiB", [](benchmark_state &s) { bm_decode(s, FreeSRP::decode_samples_sse2); }},
+#endif
+        {"encode/scalar/64KiB", [](benchmark_state &s) { bm_encode(s, FreeSRP::encode_samples_scalar); }},
+#ifdef FREESRP_CODEC_SSE2
+        {"encode/sse2/64KiB", [](benchmark_state &s) { bm_encode(s, FreeSRP::encode_samples_sse2); }},
+#endif
+        {"convert/cs8", [](benchmark_state &s) { bm_convert(s, FreeSRP::FORMAT_CS8); }},
+        {"convert/cs16", [](benchmark_state &s) { bm_convert(s, FreeSRP::FORMAT_CS16); }},
+        {"convert/cf32", [](benchmark_state &s) { bm_convert(s, FreeSRP::FORMAT_CF32); }},
+        {"convert/cs12packed", [](benchmark_state &s) { bm_convert(s, FreeSRP::FORMAT_CS12_PACKED); }},
+        {"unpack/cs8", [](benchmark_state &s) { bm_unpack(s, FreeSRP::FORMAT_CS8); }},
+        {"unpack/cs16", [](benchmark_state &s) { bm_unpack(s, FreeSRP::FORMAT_CS16); }},
+        {"unpack/cf32", [](benchmark_state &s) { bm_unpack(s, FreeSRP::FORMAT_CF32); }},
+        {"unpack/cs12packed", [](benchmark_state &s) { bm_unpack(s, FreeSRP::FORMAT_CS12_PACKED); }},
+        {"dsp/burst", bm_burst_detect},
+        {"dsp/decimate/2", [](benchmark_state &s) { bm_decimate(s, 2); }},
+        {"dsp/decimate/8", [](benchmark_state &s) { bm_decimate(s, 8); }},
+        {"dsp/decimate/64", [](benchmark_state &s) { bm_decimate(s, 64); }},
+        {"dsp/channelize/16", [](benchmark_state &s) { bm_channelize(s, 16); }},
+        {"dsp/channelize/64", [](benchmark_state &s) { bm_channelize(s, 64); }},
+        {"queue/single", bm_queue_single},
+        {"queue/block", bm_queue_block},
+        {"queue/block_copy", bm_queue_block_copy},
+        {"callback/per_transfer", bm_callback_dispatch},
+        {"callback/per_sample", bm_callback_per_sample}
+    };
+
+    cout << left << setw(26) << "benchmark" << right << setw(14) << "iterations" << setw(14) << "ns/sample" << setw(16) << "ns/iteration" << endl;
+    cout << string(70, '-') << endl;
+
+    for(benchmark &b : benchmarks)
+    {
+        if(!filter.empty() && b.name.find(filter) == string::npos)
+        {
+            continue;
+        }
+
+        // Grow the iteration count until a run takes at least min_time, like Google Benchmark does
+        unsigned long iterations = 1;
+        benchmark_state state(iterations);
+        while(true)
+        {
+            state = benchmark_state(iterations);
+            b.run(state);
+            if(state.seconds() >= min_time || iterations >= 1000000000UL)
+            {
+                break;
+            }
+            double scale = state.seconds() > 0 ? min_time * 1.4 / state.seconds() : 100;
+            iterations = (unsigned long) (iterations * min(max(scale, 2.0), 100.0));
+        }
+
+        double ns_per_iteration = state.seconds() * 1e9 / state.iterations();
+        cout << left << setw(26) << b.name << right << setw(14) << state.iterations() << fixed
+             << setw(14) << setprecision(4) << ns_per_iteration / state.samples_per_iteration()
+             << setw(16) << setprecision(1) << ns_per_iteration << endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,319 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Drives the library's RX and TX data path at simulated sample rates without a FreeSRP attached, by completing
+// transfers through the same callbacks libusb calls. This uses the library's internal stream_hook, so it must be built
+// from the same source tree as the library.
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <thread>
+#include <boost/lexical_cast.hpp>
+
+#include "../../src/stream_hook.hpp"
+
+#include "optionparser.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC
+#endif
+
+using namespace std;
+
+// Count every heap allocation made by the process, including the library's. The replacements are not inlined, so
+// the compiler does not pair their malloc and free with the new and delete expressions calling them.
+static atomic<unsigned long> allocations{0};
+
+__attribute__((noinline)) void *operator new(size_t size)
+{
+    allocations.fetch_add(1, memory_order_relaxed);
+    void *p = malloc(size == 0 ? 1 : size);
+    if(p == nullptr)
+    {
+        throw bad_alloc();
+    }
+    return p;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    operator delete(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    operator delete(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+    operator delete(p);
+}
+
+using FreeSRP::stream_hook;
+using FreeSRP::sample;
+
+typedef chrono::steady_clock bench_clock;
+
+enum optionIndex {NONE, HELP, RATE, DURATION, MODE};
+const option::Descriptor usage[] = {
+        {NONE,     0, "",  "",         option::Arg::None,     "usage: freesrp-stream-bench [options]\n"
+                                                              "       runs the RX/TX data path at simulated sample rates without a FreeSRP\noptions:"},
+        {HELP,     0, "h", "help",     option::Arg::None,     "  -h, --help                      Print usage and exit"},
+        {RATE,     0, "r", "rate",     option::Arg::Optional, "  -r[msps], --rate=[msps]         Simulated rate in MSps, 0 for unpaced (default: 1, 10, 20, 40, 61.44 and 0)"},
+        {DURATION, 0, "d", "duration", option::Arg::Optional, "  -d[s], --duration=[s]           Seconds per measurement (default 2)"},
+        {MODE,     0, "m", "mode",     option::Arg::Optional, "  -m[mode], --mode=[mode]         rx-callback, rx-queue, tx-callback or tx-queue (default: all)"},
+        {NONE,     0, "",  "",         option::Arg::None,     "\nexample: freesrp-stream-bench -r61.44 -mrx-queue"},
+        {0,0,0,0,0,0}
+};
+
+struct bench_result
+{
+    double achieved_msps;
+    double cycles_per_sample;
+    double ns_per_sample;
+    double busy;
+    double allocs_per_transfer;
+};
+
+// Call stage once per transfer of samples_per_transfer samples, paced to msps (unpaced if 0), as the event thread would
+bench_result run_stage(function<void()> stage, unsigned int samples_per_transfer, double msps, double seconds)
+{
+    bench_clock::duration interval = msps > 0 ? chrono::duration_cast<bench_clock::duration>(chrono::duration<double, micro>(samples_per_transfer / msps)) : bench_clock::duration(0);
+
+    unsigned long transfers = 0;
+    unsigned long long cycles = 0;
+    bench_clock::duration busy(0);
+
+    unsigned long allocs_before = allocations.load();
+    bench_clock::time_point start = bench_clock::now();
+    bench_clock::time_point next = start;
+    bench_clock::time_point end = start + chrono::duration_cast<bench_clock::duration>(chrono::duration<double>(seconds));
+
+    while(next < end)
+    {
+        if(msps > 0)
+        {
+            this_thread::sleep_until(next);
+        }
+
+        bench_clock::time_point t0 = bench_clock::now();
+#ifdef HAVE_RDTSC
+        unsigned long long c0 = __rdtsc();
+#endif
+        stage();
+#ifdef HAVE_RDTSC
+        cycles += __rdtsc() - c0;
+#endif
+        bench_clock::time_point t1 = bench_clock::now();
+
+        busy += t1 - t0;
+        transfers++;
+        next = msps > 0 ? next + interval : t1;
+    }
+
+    double elapsed = chrono::duration<double>(bench_clock::now() - start).count();
+    double samples = (double) transfers * samples_per_transfer;
+
+    bench_result r;
+    r.achieved_msps = samples / elapsed / 1e6;
+    r.cycles_per_sample = cycles / samples;
+    r.ns_per_sample = chrono::duration<double, nano>(busy).count() / samples;
+    r.busy = chrono::duration<double>(busy).count() / elapsed;
+    r.allocs_per_transfer = (double) (allocations.load() - allocs_before) / transfers;
+    return r;
+}
+
+int main(int argc, char *argv[])
+{
+    // Parse options
+    argc-=(argc>0); argv+=(argc>0); // Skip program name (argv[0]), if present
+    option::Stats stats(usage, argc, argv);
+    option::Option options[stats.options_max], buffer[stats.buffer_max];
+    option::Parser parse(usage, argc, argv, options, buffer);
+
+    if(parse.error())
+    {
+        return 1;
+    }
+
+    if(options[HELP])
+    {
+        option::printUsage(cout, usage);
+        return 0;
+    }
+
+    vector<double> rates = {1, 10, 20, 40, 61.44, 0};
+    double duration = 2;
+    string only_mode;
+
+    try
+    {
+        if(options[RATE].arg) rates = {boost::lexical_cast<double>(options[RATE].arg)};
+        if(options[DURATION].arg) duration = boost::lexical_cast<double>(options[DURATION].arg);
+        if(options[MODE].arg) only_mode = options[MODE].arg;
+    }
+    catch(boost::bad_lexical_cast)
+    {
+        cerr << "Error: Please specify valid numerical values" << endl;
+        return 1;
+    }
+
+    // RX transfer contents: random 12-bit two's complement samples in the FreeSRP's wire format
+    vector<unsigned char> rx_data(FREESRP_RX_TX_BUF_SIZE);
+    mt19937 rng(1);
+    for(size_t i = 0; i < rx_data.size(); i += 2)
+    {
+        uint16_t v = (uint16_t) (rng() & 0xFFF);
+        memcpy(rx_data.data() + i, &v, sizeof(v));
+    }
+
+    vector<unsigned char> tx_data(FREESRP_TX_BUF_SIZE);
+
+    // Transfers are completed by the benchmark instead of libusb
+    stream_hook::detach();
+    libusb_transfer *rx = stream_hook::alloc_transfer(FREESRP_RX_IN, rx_data.data(), (int) rx_data.size());
+    libusb_transfer *tx = stream_hook::alloc_transfer(FREESRP_TX_OUT, tx_data.data(), (int) tx_data.size());
+
+    // Consumers of the RX queue and producers for the TX queue, standing in for the application
+    atomic<bool> app_running{false};
+    volatile int32_t sink = 0;
+
+    struct mode_def
+    {
+        string name;
+        unsigned int samples_per_transfer;
+        function<void()> setup;
+        function<void()> stage;
+        function<void()> app;
+    };
+
+    vector<mode_def> modes = {
+        {"rx-callback", FREESRP_RX_TX_BUF_SIZE / FREESRP_BYTES_PER_SAMPLE,
+            [&]() {
+                stream_hook::set_rx_callback([&sink](const vector<sample> &samples) {
+                    int32_t acc = 0;
+                    for(const sample &s : samples) acc += s.i;
+                    sink = acc;
+                });
+            },
+            [&]() { stream_hook::complete_rx(rx); },
+            nullptr},
+        {"rx-queue", FREESRP_RX_TX_BUF_SIZE / FREESRP_BYTES_PER_SAMPLE,
+            [&]() { stream_hook::set_rx_callback(nullptr); },
+            [&]() { stream_hook::complete_rx(rx); },
+            [&]() {
+                sample s;
+                while(app_running.load())
+                {
+                    if(!stream_hook::rx_dequeue(s)) this_thread::yield();
+                }
+                while(stream_hook::rx_dequeue(s)) {}
+            }},
+        {"tx-callback", FREESRP_TX_BUF_SIZE / FREESRP_BYTES_PER_SAMPLE,
+            [&]() {
+                stream_hook::set_tx_callback([](vector<sample> &samples) {
+                    int16_t v = 0;
+                    for(sample &s : samples) { s.i = v; s.q = (int16_t) -v; v = (int16_t) ((v + 1) & 0x7FF); }
+                });
+            },
+            [&]() { stream_hook::complete_tx(tx); },
+            nullptr},
+        {"tx-queue", FREESRP_TX_BUF_SIZE / FREESRP_BYTES_PER_SAMPLE,
+            [&]() { stream_hook::set_tx_callback(nullptr); },
+            [&]() { stream_hook::complete_tx(tx); },
+            [&]() {
+                sample s{100, -100};
+                while(app_running.load())
+                {
+                    if(!stream_hook::tx_enqueue(s)) this_thread::yield();
+                }
+            }}
+    };
+
+    cout << left << setw(13) << "mode" << right << setw(10) << "target" << setw(10) << "achieved" << setw(12) << "cycles/S"
+         << setw(10) << "ns/S" << setw(8) << "busy" << setw(14) << "allocs/xfer" << endl;
+
+    for(mode_def &mode : modes)
+    {
+        if(!only_mode.empty() && mode.name != only_mode)
+        {
+            continue;
+        }
+
+        for(double rate : rates)
+        {
+            mode.setup();
+
+            thread app;
+            if(mode.app)
+            {
+                app_running.store(true);
+                app = thread(mode.app);
+            }
+
+            bench_result r = run_stage(mode.stage, mode.samples_per_transfer, rate, duration);
+
+            if(mode.app)
+            {
+                app_running.store(false);
+                app.join();
+            }
+
+            ostringstream target;
+            if(rate > 0) target << rate; else target << "max";
+
+            cout << left << setw(13) << mode.name << right << fixed << setprecision(2)
+                 << setw(10) << target.str()
+                 << setw(10) << r.achieved_msps
+#ifdef HAVE_RDTSC
+                 << setw(12) << r.cycles_per_sample
+#else
+                 << setw(12) << "n/a"
+#endif
+                 << setw(10) << r.ns_per_sample
+                 << setw(7) << r.busy * 100 << "%"
+                 << setw(14) << r.allocs_per_transfer << endl;
+        }
+    }
+
+    cout << "Rates are in MSps. cycles/S are TSC cycles per sample. busy is the share of wall time the simulated event thread spent in the data path." << endl;
+
+    stream_hook::free_transfer(rx);
+    stream_hook::free_transfer(tx);
+
+    return 0;
+}
@@ -0,0 +1,149 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <boost/lexical_cast.hpp>
+
+#include <freesrp.hpp>
+#include <freesrp_sweep.hpp>
+
+#include "optionparser.hpp"
+
+using namespace std;
+using namespace FreeSRP;
+
+enum optionIndex {NONE, HELP, OUTFILE, FPGA, START, STOP, RATE, GAIN, FFT, AVERAGES, SETTLE, THREADS};
+const option::Descriptor usage[] = {
+        {NONE,     0, "",  "",         option::Arg::None,     "usage: freesrp-sweep [options] --start=[freq] --stop=[freq]\n"
+                                                              "       output is CSV with one 'frequency,power' line per bin\noptions:"},
+        {HELP,     0, "h", "help",     option::Arg::None,     "  -h, --help                     Print usage and exit"},
+        {OUTFILE,  0, "o", "out",      option::Arg::Optional, "  -o[filename], --out=[filename] Output to specified file (default: stdout)"},
+        {FPGA,     0, "",  "fpga",     option::Arg::Optional, "  --fpga=/path/to/bitstream.bin  Load the FPGA with the specified bitstream"},
+        {START,    0, "",  "start",    option::Arg::Optional, "  --start=[freq]                 Start frequency in hertz (70e6 to 6e9)"},
+        {STOP,     0, "",  "stop",     option::Arg::Optional, "  --stop=[freq]                  Stop frequency in hertz (70e6 to 6e9)"},
+        {RATE,     0, "r", "rate",     option::Arg::Optional, "  -r[rate], --rate=[rate]        Sample rate and bandwidth per step in hertz (default 20e6)"},
+        {GAIN,     0, "g", "gain",     option::Arg::Optional, "  -g[gain], --gain=[gain]        Gain in decibels (default 30)"},
+        {FFT,      0, "",  "fft",      option::Arg::Optional, "  --fft=[size]                   FFT size, a power of two (default 1024)"},
+        {AVERAGES, 0, "",  "avg",      option::Arg::Optional, "  --avg=[count]                  FFTs averaged per step (default 16)"},
+        {SETTLE,   0, "",  "settle",   option::Arg::Optional, "  --settle=[samples]             Samples discarded after each retune (default 2 ms)"},
+        {THREADS,  0, "",  "threads",  option::Arg::Optional, "  --threads=[count]              FFT worker threads (default: one per CPU)"},
+        {NONE,     0, "",  "",         option::Arg::None,     "\nexample: freesrp-sweep --start=88e6 --stop=108e6 -g20 -ofm.csv"},
+        {0,0,0,0,0,0}
+};
+
+int main(int argc, char *argv[])
+{
+    // Parse options
+    argc-=(argc>0); argv+=(argc>0); // Skip program name (argv[0]), if present
+    option::Stats stats(usage, argc, argv);
+    option::Option options[stats.options_max], buffer[stats.buffer_max];
+    option::Parser parse(usage, argc, argv, options, buffer);
+
+    if(parse.error())
+    {
+        return 1;
+    }
+
+    if(options[HELP])
+    {
+        option::printUsage(cout, usage);
+        return 0;
+    }
+
+    if(!options[START].arg || !options[STOP].arg)
+    {
+        cerr << "Error: Please specify start and stop frequencies. See 'freesrp-sweep --help'." << endl;
+        return 1;
+    }
+
+    sweep_config config;
+
+    try
+    {
+        config.start_freq = boost::lexical_cast<double>(options[START].arg);
+        config.stop_freq = boost::lexical_cast<double>(options[STOP].arg);
+        if(options[RATE].arg) config.samp_rate = boost::lexical_cast<double>(options[RATE].arg);
+        if(options[GAIN].arg) config.gain = boost::lexical_cast<double>(options[GAIN].arg);
+        if(options[FFT].arg) config.fft_size = boost::lexical_cast<unsigned int>(options[FFT].arg);
+        if(options[AVERAGES].arg) config.averages = boost::lexical_cast<unsigned int>(options[AVERAGES].arg);
+        if(options[SETTLE].arg) config.settle_samples = boost::lexical_cast<unsigned long>(options[SETTLE].arg);
+        if(options[THREADS].arg) config.threads = boost::lexical_cast<unsigned int>(options[THREADS].arg);
+    }
+    catch(boost::bad_lexical_cast)
+    {
+        cerr << "Error: Please specify valid numerical values" << endl;
+        return 1;
+    }
+
+    ofstream of;
+    ostream *out = &cout;
+    if(options[OUTFILE] && options[OUTFILE].arg)
+    {
+        of.open(options[OUTFILE].arg, ios::out);
+        out = &of;
+    }
+
+    try
+    {
+        FreeSRP::FreeSRP srp;
+        cerr << "Found FreeSRP" << endl;
+
+        if(options[FPGA] && options[FPGA].arg)
+        {
+            cerr << "Loading FPGA with '" << options[FPGA].arg << "'" << endl;
+            if(srp.load_fpga(options[FPGA].arg) == FPGA_CONFIG_ERROR)
+            {
+                cerr << "Error configuring FPGA!" << endl;
+            }
+        }
+
+        if(!srp.fpga_loaded())
+        {
+            cerr << "FPGA not configured. Please configure the FPGA first: " << endl;
+            cerr << "Example: freesrp-sweep --fpga=/path/to/bitstream.bin" << endl;
+            return 1;
+        }
+
+        sweep_result result = sweep(srp, config);
+
+        *out << fixed << setprecision(1);
+        for(size_t i = 0; i < result.freqs.size(); i++)
+        {
+            *out << result.freqs[i] << "," << setprecision(2) << result.power[i] << setprecision(1) << "\n";
+        }
+        out->flush();
+
+        cerr << "Swept " << (config.stop_freq - config.start_freq) / 1e6 << " MHz in " << result.steps << " steps, "
+             << setprecision(3) << result.seconds << " s (" << result.rate << " GHz/s)" << endl;
+
+        return 0;
+    }
+    catch(const ConnectionError &e)
+    {
+        cerr << "Could not connect to FreeSRP: " << e.what() << endl;
+    }
+    catch(const runtime_error &e)
+    {
+        cerr << "Unexpected exception occurred! " << e.what() << endl;
+    }
+
+    return 1;
+}
@@ -29,6 +29,8 @@
 #include <atomic>
 #include <thread>
 #include <functional>
+#include <future>
+#include <chrono>
 #include <cstdint>
 
 #define FREESRP_VENDOR_ID 0xe1ec
@@ -45,6 +47,8 @@
 
 #define FREESRP_USB_CTRL_SIZE 64
 #define FREESRP_UART_BUF_SIZE 16
+#define FREESRP_CMD_MAX_IN_FLIGHT 8
+#define FREESRP_HOP_TIMES_SIZE 65536
 
 #define FREESRP_BYTES_PER_SAMPLE 4
 
@@ -136,6 +140,15 @@ namespace FreeSRP
         FPGA_CONFIG_SKIPPED
     };
 
+    enum log_level
+    {
+        LOG_LEVEL_DEBUG = 0,
+        LOG_LEVEL_INFO,
+        LOG_LEVEL_WARNING,
+        LOG_LEVEL_ERROR,
+        LOG_LEVEL_NONE          // Disables logging when used with set_log_level
+    };
+
     struct freesrp_version
     {
         std::string fx3;
@@ -163,6 +176,7 @@ namespace FreeSRP
         command_id cmd;
         uint64_t param;
         command_err error;
+        uint64_t rx_samples;    // RX samples delivered since start_rx when the response arrived, after decimation
 
         friend std::ostream &operator<<(std::ostream &o, const response res)
         {
@@ -178,6 +192,165 @@ namespace FreeSRP
         }
     };
 
+    //! A setting in a radio_config. It is only applied if a value has been assigned to it.
+    struct config_value
+    {
+        bool set = false;
+        double value = 0;
+
+        config_value &operator=(double v)
+        {
+            set = true;
+            value = v;
+            return *this;
+        }
+    };
+
+    //! A set of transceiver settings that can be applied at once with FreeSRP::apply
+    struct radio_config
+    {
+        config_value rx_lo_freq;
+        config_value rx_samp_freq;
+        config_value rx_rf_bandwidth;
+        config_value rx_gc_mode;
+        config_value rx_rf_gain;
+        config_value rx_fir_en;
+
+        config_value tx_lo_freq;
+        config_value tx_samp_freq;
+        config_value tx_rf_bandwidth;
+        config_value tx_attenuation;
+        config_value tx_fir_en;
+    };
+
+    //! What FreeSRP::apply did with one setting of a radio_config
+    enum config_status
+    {
+        CONFIG_NOT_SET = 0,     // No value was assigned to the setting
+        CONFIG_UNCHANGED,       // The FreeSRP already had this value, nothing was sent
+        CONFIG_APPLIED,         // The setting was sent and the FreeSRP accepted it
+        CONFIG_FAILED           // The setting was sent and the FreeSRP rejected it
+    };
+
+    //! Outcome of applying one setting
+    struct config_result
+    {
+        config_status status = CONFIG_NOT_SET;
+        response res{};         // The FreeSRP's response, or the cached value if unchanged
+    };
+
+    //! Outcome of FreeSRP::apply, one entry per radio_config setting
+    struct radio_config_result
+    {
+        config_result rx_lo_freq;
+        config_result rx_samp_freq;
+        config_result rx_rf_bandwidth;
+        config_result rx_gc_mode;
+        config_result rx_rf_gain;
+        config_result rx_fir_en;
+
+        config_result tx_lo_freq;
+        config_result tx_samp_freq;
+        config_result tx_rf_bandwidth;
+        config_result tx_attenuation;
+        config_result tx_fir_en;
+
+        //! The responses of the settings that failed, in the order they were sent
+        std::vector<response> failed;
+
+        //! Check whether every assigned setting is in effect
+        bool ok() const { return failed.empty(); }
+    };
+
+    //! One entry of a frequency hopping schedule
+    struct hop
+    {
+        command_id cmd; // SET_RX_LO_FREQ or SET_TX_LO_FREQ
+        double freq;    // LO frequency in hertz
+    };
+
+    //! Distribution of a hop timing measurement, in microseconds, with the 12.5% resolution of latency_histogram
+    struct hop_timing
+    {
+        double p50;
+        double p90;
+        double p99;
+        double max;
+    };
+
+    //! Results of a frequency hopping run
+    struct hop_report
+    {
+        unsigned long hops;             // Number of hops issued
+        unsigned long failed;           // Hops the FreeSRP rejected or did not answer
+        hop_timing latency;             // Time from issuing a hop to receiving the FreeSRP's response
+        hop_timing lateness;            // Time from a hop's scheduled time to receiving the FreeSRP's response
+        std::vector<double> hop_times;  // Time the last FREESRP_HOP_TIMES_SIZE hops completed, in seconds since hopping started
+    };
+
+    //! Counters for one streaming direction
+    struct stream_counters
+    {
+        unsigned long long samples;              // Samples received (RX) or sent (TX) in completed transfers
+        unsigned long long bytes;                // Bytes received or sent in completed transfers
+        unsigned long long transfers_completed;
+        unsigned long long transfers_failed;
+        unsigned long long transfers_cancelled;
+        unsigned long long transfers_short;      // Completed transfers with fewer bytes than requested
+        unsigned long long overflows;            // RX: samples dropped because the queue was full
+        unsigned long long underflows;           // TX: samples sent as zeros because the queue was empty
+        unsigned long long queue_high_water;     // Most samples seen waiting in the queue
+        double rate;                             // Sample rate over the last transfer, in samples per second
+        double rate_ewma;                        // Sample rate averaged with a one second time constant
+    };
+
+    //! Snapshot of the streaming counters, see FreeSRP::stream_stats()
+    struct stream_statistics
+    {
+        stream_counters rx;
+        stream_counters tx;
+    };
+
+    //! One bucket of a latency histogram
+    struct latency_bucket
+    {
+        double lower_us;            // Inclusive lower bound in microseconds
+        double upper_us;            // Exclusive upper bound in microseconds
+        unsigned long long count;
+    };
+
+    //! Log-bucket latency histogram with eight linear sub-buckets per power of two, for a resolution of 12.5%
+    struct latency_histogram
+    {
+        std::vector<latency_bucket> buckets;  // Non-empty buckets in ascending order
+        unsigned long long total;
+        double min_us;
+        double mean_us;
+        double max_us;
+
+        //! Upper bound of the bucket holding the given percentile (0 to 100) of the recorded values
+        double percentile(double p) const;
+    };
+
+    //! Print a summary line followed by one line per bucket
+    std::ostream &operator<<(std::ostream &o, const latency_histogram &h);
+
+    //! Latency histograms for one streaming direction
+    struct stream_latency
+    {
+        latency_histogram interval;   // Time between consecutive transfer completions
+        latency_histogram handler;    // Time the event thread spends in rx_callback/tx_callback, including the user callback
+        latency_histogram callback;   // Time spent in the user's sample callback
+        latency_histogram transfer;   // Time from submitting a transfer to its completion
+    };
+
+    //! Snapshot of the streaming latency histograms, see FreeSRP::latency_stats()
+    struct latency_statistics
+    {
+        stream_latency rx;
+        stream_latency tx;
+    };
+
     class FreeSRP
     {
 	class impl;
@@ -227,12 +400,31 @@ namespace FreeSRP
 	 */
         void stop_rx();
 
+	//! Lowpass filter and decimate received samples before they reach the callback or queue.
+	/*!
+	 * Takes effect with the next start_rx. The filter is designed by design_decimation_filter, see freesrp_dsp.hpp.
+	 * \param decimation: Decimation factor, 1 to deliver samples at the FreeSRP's sample rate
+	 * \param passband: Passband edge as a fraction of the decimated sample rate, between 0 and 0.5
+	 */
+        void set_rx_decimation(unsigned int decimation, double passband = 0.4);
+
+	//! Decimation factor set with set_rx_decimation, 1 if received samples are not decimated.
+        unsigned int rx_decimation() const;
+
 	//! Start transmitting samples.
 	/*!
 	 * \param tx_callback: Optionaly, specify a function to be called once a new sample buffer is available.
          */
         void start_tx(std::function<void(std::vector<sample> &)> tx_callback = {});
 
+	//! Start transmitting samples that are already in the FreeSRP's wire format.
+	/*!
+	 * Bypasses the sample queue and the encoder: the function writes straight into each USB transfer buffer.
+	 * \param tx_fill: Called on the event thread with a transfer buffer and the number of samples to write into it,
+	 *                 in FORMAT_RAW (see freesrp_formats.hpp)
+	 */
+        void start_tx_raw(std::function<void(unsigned char *, size_t)> tx_fill);
+
 	//! Stop transmitting samples.
         void stop_tx();
 
@@ -258,6 +450,28 @@ namespace FreeSRP
 	 */
         bool submit_tx_sample(sample &s);
 
+	//! Get a snapshot of the streaming counters.
+	/*!
+	 * The counters are updated from the USB event thread without locking and can be read at any time.
+	 * A stream's counters are reset when it is started.
+	 * \returns The counters of the RX and TX streams.
+	 */
+        stream_statistics stream_stats() const;
+
+	//! Get a snapshot of the streaming latency histograms.
+	/*!
+	 * Comparing the histograms shows whether USB, the event thread or the user callback limits streaming.
+	 * A stream's histograms are reset when it is started.
+	 * \returns The histograms of the RX and TX streams.
+	 */
+        latency_statistics latency_stats() const;
+
+	//! Print a summary and the buckets of all streaming latency histograms.
+	/*!
+	 * \param o: The stream to print to
+	 */
+        void dump_latency_stats(std::ostream &o) const;
+
 	//! Helper function to generate a FreeSRP::command
 	/*!
          * \param command_id: the ID of the desired command
@@ -269,10 +483,67 @@ namespace FreeSRP
 	//! Send a command to the FreeSRP
 	/*!
 	 * Note: this call will block until a response from the FreeSRP is received back.
+	 * It is safe to send commands from several threads at once and while streaming, but not from within an RX or TX callback.
+	 * GET_* commands for settings that are known from an earlier SET_* or GET_* response are answered
+	 * from a local cache without contacting the FreeSRP, unless read_from_device is true.
+	 * The cache is cleared when the FPGA is loaded or a command fails.
 	 * \param c: The command to send (see also make_command)
+	 * \param read_from_device: If true, always send GET_* commands to the FreeSRP
 	 * \returns The response from the FreeSRP
 	 */
-        response send_cmd(command c) const;
+        response send_cmd(command c, bool read_from_device = false) const;
+
+	//! Send a command to the FreeSRP without blocking
+	/*!
+	 * The command and its response are sent as asynchronous interrupt transfers serviced by the libusb event thread.
+	 * Cached GET_* commands are answered as in send_cmd.
+	 * \param c: The command to send (see also make_command)
+	 * \param read_from_device: If true, always send GET_* commands to the FreeSRP
+	 * \returns A future holding the response from the FreeSRP, or a ConnectionError if the transfer failed
+	 */
+        std::future<response> send_cmd_async(command c, bool read_from_device = false) const;
+
+	//! Send several commands to the FreeSRP, keeping up to FREESRP_CMD_MAX_IN_FLIGHT of them in flight at once
+	/*!
+	 * Responses are matched to their commands by command ID.
+	 * \param cmds: The commands to send, in the order they should be executed
+	 * \param read_from_device: If true, always send GET_* commands to the FreeSRP
+	 * \returns The responses from the FreeSRP, in the same order as cmds
+	 */
+        std::vector<response> send_cmds(const std::vector<command> &cmds, bool read_from_device = false) const;
+
+	//! Apply several settings to the FreeSRP with as few round trips as possible
+	/*!
+	 * Only the settings that were assigned a value are sent. They are sent in an order that respects dependencies
+	 * between them (FIR and sample rate before bandwidth and LO, gain control mode before gain) and pipelined.
+	 * A setting whose cached value already matches is skipped, unless a setting it depends on is being sent.
+	 * \param config: The settings to apply
+	 * \returns What happened to each setting
+	 */
+        radio_config_result apply(const radio_config &config) const;
+
+	//! Start hopping the LO across a list of frequencies from a dedicated thread
+	/*!
+	 * All commands are encoded before hopping starts. A hop is issued every dwell period, and the next hop is not
+	 * issued before the FreeSRP has answered the previous one. Once a finite run has finished, hopping can be started
+	 * again without calling stop_hopping, which discards that run's report.
+	 * \param hops: The frequencies to hop across, in order
+	 * \param dwell: Time between the start of consecutive hops
+	 * \param count: Number of hops to issue, cycling through hops. 0 hops until stop_hopping is called.
+	 */
+        void start_hopping(const std::vector<hop> &hops, std::chrono::microseconds dwell, unsigned long count = 0);
+
+	//! Check whether hops are still being issued
+	/*!
+	 * \returns false once the requested number of hops has completed or stop_hopping has been called
+	 */
+        bool hopping() const;
+
+	//! Stop hopping and wait for the hopping thread to finish
+	/*!
+	 * \returns Timing results of the hops issued since start_hopping was called
+	 */
+        hop_report stop_hopping();
 
 	//! Get version information about the FreeSRP
 	/*!
@@ -281,6 +552,29 @@ namespace FreeSRP
         freesrp_version version();
     };
 
+    //! Set the lowest level of library log messages passed to the log sink. The default is LOG_LEVEL_WARNING.
+    void set_log_level(log_level level);
+
+    //! Set a function to receive library log messages instead of printing them to stderr.
+    /*!
+     * Messages are queued without locking by the thread that logs them, and passed to the sink by a background
+     * thread, so the sink may block without stalling streaming. Pass an empty function to restore the default.
+     * \param sink: Function called with the level and text of each message
+     */
+    void set_log_sink(std::function<void(log_level, const std::string &)> sink);
+
+    //! Limit the number of log messages per second. Further messages are counted and reported as suppressed.
+    /*!
+     * \param messages_per_second: The limit, 0 for no limit. The default is 20.
+     */
+    void set_log_rate_limit(unsigned int messages_per_second);
+
+    //! Set the libusb debug level for FreeSRP instances created afterwards.
+    /*!
+     * \param level: 0 (no messages) to 4 (debug), see libusb_set_debug. The default is 3 (warnings and errors).
+     */
+    void set_libusb_debug_level(int level);
+
     namespace Util
     {
         //! This will look for an FX3 in bootloader mode.
@@ -0,0 +1,380 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef LIBFREESRP_FREESRP_CAPTURE_HPP
+#define LIBFREESRP_FREESRP_CAPTURE_HPP
+
+#include <freesrp.hpp>
+#include <freesrp_formats.hpp>
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Capture files start with a header of FREESRP_CAPTURE_HEADER_SIZE bytes, followed by the samples
+#define FREESRP_CAPTURE_MAGIC "FSRPCAP1"
+#define FREESRP_CAPTURE_HEADER_SIZE 64
+#define FREESRP_CAPTURE_VERSION 1
+
+namespace FreeSRP
+{
+    //! Describes the samples stored in a capture file
+    struct capture_header
+    {
+        sample_format format = FORMAT_CS12_PACKED;
+        double samp_rate = 0;   // [Hz]
+        double center_freq = 0; // [Hz]
+        double gain = 0;        // [dB]
+        double start_time = 0;  // Time of the first sample [s since the UNIX epoch], 0 if unknown
+    };
+
+    //! Serialize a capture header
+    /*!
+     * The header is stored little-endian: the magic "FSRPCAP1", the version and the format as 32-bit integers,
+     * then samp_rate, center_freq, gain and start_time as 64-bit doubles. The rest is reserved and zeroed.
+     *
+     * \param header: The header to serialize
+     * \param dst: Output buffer of FREESRP_CAPTURE_HEADER_SIZE bytes
+     */
+    void encode_capture_header(const capture_header &header, unsigned char *dst);
+
+    //! Parse a capture header
+    /*!
+     * \param src: The start of a capture file
+     * \param length: Number of bytes available at src
+     * \param header: Set to the parsed header on success
+     * \returns false if src does not start with a capture header of a supported version
+     */
+    bool decode_capture_header(const unsigned char *src, size_t length, capture_header &header);
+
+    //! Describe the samples the FreeSRP is currently receiving
+    /*!
+     * Reads the receiver's sample rate, frequency and gain, from the settings cache where possible. The sample rate
+     * is that of the delivered samples, after FreeSRP::set_rx_decimation. The start time is set to the current time.
+     *
+     * \param srp: The FreeSRP to read the settings from
+     * \param format: The format the samples will be stored in
+     * \returns The header describing the receiver's current settings
+     */
+    capture_header read_capture_header(const FreeSRP &srp, sample_format format);
+
+    //! Parameters of a recorder
+    struct recorder_config
+    {
+        std::vector<std::string> paths;     // Files to stripe the recording across, ideally one per disk
+        capture_header header;              // Describes the recording. header.format is the format samples are stored in
+        bool write_header = true;           // Start the recording with the capture header
+        size_t block_size = 4 << 20;        // Bytes written at a time, and stripe size. A multiple of 4096
+        unsigned int queue_blocks = 64;     // Blocks buffered for writing. Samples are dropped when all are in use
+        unsigned long long preallocate = 0; // Bytes to reserve in each file up front, 0 to let the files grow
+        bool direct = true;                 // Bypass the page cache (O_DIRECT) on file systems that support it
+    };
+
+    //! Counters of a recorder
+    struct recorder_statistics
+    {
+        unsigned long long samples;         // Samples accepted by write()
+        unsigned long long dropped;         // Samples dropped because all blocks were waiting to be written
+        unsigned long long bytes_written;   // Bytes that reached the files
+        unsigned int queue_peak;            // Highest number of blocks waiting to be written at once
+        double seconds;                     // Time since the first sample was written
+        double write_rate;                  // Average write rate since the first sample [bytes/s]
+        bool direct;                        // True if all files are written with O_DIRECT
+        bool failed;                        // True if a write failed. All later samples are dropped
+    };
+
+    //! Records samples to disk at the FreeSRP's full data rate
+    /*!
+     * Samples are converted into aligned blocks that are written with pwrite by one background thread per file.
+     * Consecutive blocks go to consecutive files, so block n of the recording is block n / paths.size() of file
+     * n % paths.size(). With a single path the file is a regular capture file.
+     *
+     * write() never waits for the disks, so it can be called from the callback passed to FreeSRP::start_rx.
+     * Samples it has to drop are only counted in stats(), the files do not mark where they are missing.
+     */
+    class recorder
+    {
+    public:
+        //! Create the files and start the writer. Throws std::runtime_error if a file cannot be created
+        explicit recorder(const recorder_config &config);
+        ~recorder();
+
+        //! Add samples to the recording. Must not be called from more than one thread at a time
+        void write(const sample *samples, size_t count);
+
+        //! Write out all buffered samples and close the files. Throws std::runtime_error if a write failed
+        void close();
+
+        recorder_statistics stats() const;
+
+    private:
+        class impl;
+        std::unique_ptr<impl> _impl;
+    };
+
+    //! Parameters of a SigMF recording
+    struct sigmf_config
+    {
+        std::string path;                   // The recording is written to path.sigmf-data and path.sigmf-meta
+        sample_format format = FORMAT_CS16; // FORMAT_CS8, FORMAT_CS16 or FORMAT_CF32, the formats SigMF describes
+        std::string description;            // core:description, omitted if empty
+        std::string author;                 // core:author, omitted if empty
+        recorder_config data;               // How the data file is written. paths and header are set by sigmf_writer
+    };
+
+    //! Records samples as a SigMF recording (https://sigmf.org)
+    /*!
+     * The receiver's settings are stored in the metadata file when the writer is created, so that a recording
+     * that is never closed is still described. The data file is written by a recorder as the samples arrive.
+     *
+     * Samples lost to overflows are annotated at the index of the first sample after the gap. Settings changed
+     * through sigmf_writer::send_cmd are annotated at the first sample delivered after the FreeSRP acknowledged the
+     * change. Samples still buffered in the FreeSRP and in USB transfers at that point were received with the old
+     * setting, so the change takes effect somewhat later than its annotation, by that pipeline depth plus the
+     * settling time of the LO or gain. Retunes also start a new capture segment. The metadata file is rewritten
+     * with all annotations when the recording is closed.
+     */
+    class sigmf_writer
+    {
+    public:
+        //! Snapshot the receiver's settings and create the recording. Throws std::runtime_error on failure
+        /*!
+         * Sample indices are counted from start_rx, so the writer should receive every sample since then.
+         *
+         * \param srp: The FreeSRP the samples are received from
+         * \param config: Parameters of the recording
+         */
+        sigmf_writer(const FreeSRP &srp, const sigmf_config &config);
+        ~sigmf_writer();
+
+        //! Add samples to the recording, see recorder::write
+        void write(const sample *samples, size_t count);
+
+        //! Send a command to the FreeSRP and annotate the recording if it changes the receiver's settings
+        response send_cmd(command c);
+
+        //! Annotate samples the caller lost before the next call to write()
+        void note_gap(unsigned long long samples);
+
+        //! Finish the data file and write the metadata file. Throws std::runtime_error if a write failed
+        void close();
+
+        //! Samples in the data file so far
+        unsigned long long samples_written() const;
+
+        //! Counters of the data file's recorder
+        recorder_statistics stats() const;
+
+    private:
+        class impl;
+        std::unique_ptr<impl> _impl;
+    };
+
+    //! How a range of a capture will be accessed, passed to the kernel with madvise
+    enum capture_access
+    {
+        ACCESS_NORMAL = 0,      // No particular pattern
+        ACCESS_SEQUENTIAL,      // Read once from start to end, read ahead aggressively
+        ACCESS_WILLNEED,        // Read soon, start reading it in now
+        ACCESS_RANDOM           // Scattered small reads, do not read ahead
+    };
+
+    //! Samples of a capture, pointing into its memory map
+    struct capture_view
+    {
+        const void *data;           // The samples in the capture's format
+        size_t count;               // Number of samples
+        sample_format format;
+        unsigned long long start;   // Index of the first sample in the capture
+    };
+
+    //! One block of a capture index
+    struct capture_index_entry
+    {
+        unsigned long long sample;  // Index of the block's first sample
+        double time;                // Wall-clock time of the first sample, assuming no gaps [s since the UNIX epoch]
+        float power;                // Mean power of the block [dBFS]
+    };
+
+    //! Random access to large captures through a memory map
+    /*!
+     * The capture is mapped read-only, so views of any range are available without copying. The index, with one
+     * entry per index_block samples, is built on first use and stored next to the capture as path.fsidx, so it is
+     * only built once unless the capture changes.
+     *
+     * Capture files do not record where samples were lost, so times are derived from the header's start time and
+     * sample rate as if the capture had no gaps. Samples dropped by the library or the recorder shift every later
+     * time by the duration of the lost samples; check stream_stats() and recorder::stats() when recording, or
+     * record with sigmf_writer, which annotates each gap.
+     */
+    class capture_reader
+    {
+    public:
+        //! Map a capture. Throws std::runtime_error if it cannot be opened
+        /*!
+         * \param path: The capture file
+         * \param format: The format of captures without a capture header. Otherwise the header's format is used
+         * \param index_block: Samples per index entry
+         */
+        explicit capture_reader(const std::string &path, sample_format format = FORMAT_CS16, unsigned int index_block = 1 << 20);
+        ~capture_reader();
+
+        //! The capture's header. Without one, only the format is set
+        const capture_header &header() const;
+
+        //! Number of samples in the capture
+        unsigned long long samples() const;
+
+        //! A view of samples, without copying
+        /*!
+         * \param start: Index of the first sample
+         * \param count: Number of samples. Fewer are returned if the capture ends before
+         * \param access: How the samples will be read
+         * \returns The view, with count 0 if start is past the end of the capture
+         */
+        capture_view view(unsigned long long start, size_t count, capture_access access = ACCESS_NORMAL) const;
+
+        //! Convert samples to 12-bit samples
+        /*!
+         * \returns The number of samples read, fewer than count at the end of the capture
+         */
+        size_t read(unsigned long long start, size_t count, sample *dst) const;
+
+        //! The capture's index, loaded from path.fsidx or built and stored there
+        const std::vector<capture_index_entry> &index();
+
+        //! Index of the sample received at the given wall-clock time, clamped to the capture. Assumes no gaps
+        unsigned long long sample_at(double time);
+
+        //! Wall-clock time of a sample, or its offset from the start [s] if the start time is unknown. Assumes no gaps
+        double time_at(unsigned long long sample) const;
+
+    private:
+        class impl;
+        std::unique_ptr<impl> _impl;
+    };
+
+    //! Transmits a capture file straight from its memory map
+    /*!
+     * Pass fill() to FreeSRP::start_tx_raw:
+     *
+     *     tx_playback playback("capture.cs16", FORMAT_CS16, 0, true);
+     *     srp.start_tx_raw([&](unsigned char *buf, size_t count) { playback.fill(buf, count); });
+     *
+     * Raw captures are copied into the transfer buffers as they are. Other formats are converted in small chunks
+     * that stay in cache, straight into the transfer buffers. The capture is read ahead with MADV_SEQUENTIAL.
+     */
+    class tx_playback
+    {
+    public:
+        //! Map a capture for playback. Throws std::runtime_error if it cannot be opened or start is past its end
+        /*!
+         * \param path: The capture file
+         * \param format: The format of captures without a capture header. Otherwise the header's format is used
+         * \param start: Index of the first sample to transmit, also where looping restarts
+         * \param loop: Restart at start at the end of the capture instead of transmitting zeros
+         */
+        explicit tx_playback(const std::string &path, sample_format format = FORMAT_CS16, unsigned long long start = 0, bool loop = false);
+        ~tx_playback();
+
+        //! Write the next samples in the FreeSRP's wire format. Called on the event thread by start_tx_raw
+        void fill(unsigned char *buffer, size_t count);
+
+        //! True once a capture that does not loop has been transmitted completely
+        bool finished() const;
+
+        //! Index of the next sample to transmit
+        unsigned long long position() const;
+
+        //! Number of times playback restarted at the start
+        unsigned long long loops() const;
+
+        //! The capture being played
+        const capture_reader &capture() const;
+
+    private:
+        class impl;
+        std::unique_ptr<impl> _impl;
+    };
+
+    //! How a triggered capture decides that a block of samples contains an event
+    enum trigger_mode
+    {
+        TRIGGER_POWER = 0,      // Mean power of the block exceeds threshold [dBFS]
+        TRIGGER_LEVEL,          // Any sample's magnitude exceeds threshold [dBFS]
+        TRIGGER_PREDICATE       // The predicate returns true
+    };
+
+    //! Parameters of a triggered capture
+    struct triggered_capture_config
+    {
+        std::string prefix;                 // Events are written to prefix_000001.<format>, prefix_000002.<format>, ...
+        capture_header header;              // Describes the samples, samp_rate is required. Written to every event file
+        trigger_mode mode = TRIGGER_POWER;
+        float threshold = -30;              // [dBFS]
+        std::function<bool(const sample *, size_t)> predicate; // Used with TRIGGER_PREDICATE
+        double pre_trigger = 0.1;           // Samples kept before the triggering block [s]
+        double post_trigger = 0.1;          // Samples kept after the start of the triggering block [s]
+        double history = 1;                 // Samples kept in memory [s], must be above pre_trigger + post_trigger
+        unsigned int max_pending = 8;       // Events waiting to be written before further events are lost
+    };
+
+    //! Counters of a triggered capture
+    struct triggered_capture_statistics
+    {
+        unsigned long long samples;         // Samples passed to write()
+        unsigned long long triggers;        // Blocks that met the trigger condition
+        unsigned long long events;          // Events written to files
+        unsigned long long lost;            // Events not written: the writer fell behind, or a write failed
+        unsigned long long merged;          // Triggers during an event's post-trigger window, part of that event
+    };
+
+    //! Records only the samples around events, e.g. rare bursts
+    /*!
+     * The last history seconds of samples are kept in a circular buffer. The trigger is evaluated on each block
+     * passed to write(). When it fires, the samples from pre_trigger seconds before the block to post_trigger seconds
+     * after it are handed to a writer thread once they have been received, which copies them from the buffer into a
+     * new file while write() keeps filling it. write() never waits for the writer, so it can be called from the
+     * callback passed to FreeSRP::start_rx.
+     */
+    class triggered_capture
+    {
+    public:
+        //! Start the writer thread. Throws std::runtime_error if the configuration is invalid
+        explicit triggered_capture(const triggered_capture_config &config);
+        ~triggered_capture();
+
+        //! Add a block of samples and evaluate the trigger on it. Must not be called from more than one thread at a time
+        void write(const sample *samples, size_t count);
+
+        //! Write out the event in progress, if any, and wait for all events to be written
+        void close();
+
+        triggered_capture_statistics stats() const;
+
+    private:
+        class impl;
+        std::unique_ptr<impl> _impl;
+    };
+}
+
+#endif
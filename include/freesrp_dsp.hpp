@@ -0,0 +1,216 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef LIBFREESRP_FREESRP_DSP_HPP
+#define LIBFREESRP_FREESRP_DSP_HPP
+
+#include <freesrp.hpp>
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace FreeSRP
+{
+    //! Parameters of a burst detector. Lengths are in samples
+    struct burst_detector_config
+    {
+        unsigned int window = 64;       // Samples averaged for the short-term power
+        float start_threshold = -30;    // A burst starts when the short-term power rises above this [dBFS]
+        float end_threshold = -36;      // and ends when it falls below this [dBFS], must not be above start_threshold
+        unsigned int hangover = 64;     // Samples the power must stay below end_threshold before a burst ends
+        unsigned int padding = 64;      // Samples kept before the start and after the end of a burst
+        size_t min_length = 0;          // Shorter bursts are discarded
+        size_t max_length = 1 << 20;    // Longer bursts are emitted in pieces of this length
+    };
+
+    //! Counters of a burst detector
+    struct burst_detector_statistics
+    {
+        unsigned long long samples;         // Samples passed to process()
+        unsigned long long bursts;          // Bursts emitted, counting each piece of a long burst
+        unsigned long long burst_samples;   // Samples in the emitted bursts
+        unsigned long long discarded;       // Bursts shorter than min_length
+    };
+
+    //! Cuts a stream of samples into bursts of energy, e.g. to only demodulate the busy parts of a sparse channel
+    /*!
+     * The short-term power is the mean of |sample|^2 over the last window samples, relative to a full scale complex
+     * sinusoid. A burst starts when it rises above start_threshold and ends once it has stayed below end_threshold
+     * for hangover samples. The burst is passed to the callback with padding samples on either side, together with
+     * the index of its first sample counted from the first sample passed to process().
+     */
+    class burst_detector
+    {
+    public:
+        //! Throws std::runtime_error if the configuration is invalid
+        /*!
+         * \param config: Detection parameters
+         * \param callback: Called from process() or flush() with the index of each burst's first sample and its samples
+         */
+        burst_detector(const burst_detector_config &config,
+                       std::function<void(unsigned long long, const std::vector<sample> &)> callback);
+        ~burst_detector();
+
+        //! Add a block of samples, e.g. from the callback passed to FreeSRP::start_rx
+        void process(const sample *samples, size_t count);
+        void process(const std::vector<sample> &samples) { process(samples.data(), samples.size()); }
+
+        //! Emit the burst in progress, if any, e.g. when the stream stops. Sample indices continue from where they were
+        void flush();
+
+        burst_detector_statistics stats() const;
+
+    private:
+        class impl;
+        std::unique_ptr<impl> _impl;
+    };
+
+    //! Design a lowpass filter for decimation with a Kaiser window
+    /*!
+     * The passband is kept, and everything that would alias into it after decimation is attenuated. The filter has
+     * unity gain at DC.
+     *
+     * \param decimation: Decimation factor, at least 2
+     * \param passband: Passband edge as a fraction of the output sample rate, between 0 and 0.5
+     * \param attenuation: Stopband attenuation [dB]
+     * \returns The filter taps
+     */
+    std::vector<float> design_decimation_filter(unsigned int decimation, double passband = 0.4, double attenuation = 60);
+
+    //! Lowpass filters and decimates a stream of samples, computing only the samples it keeps
+    /*!
+     * The taps are quantized to 16 bits and the samples are filtered in integer arithmetic, with SSE2 where available,
+     * so results are exact and the same with or without SIMD. Outputs are rounded and clipped to the 12-bit range.
+     */
+    class fir_decimator
+    {
+    public:
+        //! Throws std::runtime_error if the parameters are invalid
+        /*!
+         * \param decimation: Decimation factor, at least 1. A factor of 1 only filters
+         * \param taps: Filter taps, e.g. from design_decimation_filter. Their magnitude must be below 1
+         */
+        fir_decimator(unsigned int decimation, const std::vector<float> &taps);
+        //! Decimate with a filter from design_decimation_filter
+        fir_decimator(unsigned int decimation, double passband = 0.4, double attenuation = 60);
+        ~fir_decimator();
+
+        unsigned int decimation() const;
+        size_t num_taps() const;
+
+        //! Filter and decimate a block of samples
+        /*!
+         * Blocks of any length may be passed, the filter state and the decimation phase carry over between them.
+         *
+         * \param src: Input samples
+         * \param count: Number of input samples
+         * \param dst: Output buffer of at least count / decimation + 1 samples
+         * \returns Number of output samples
+         */
+        size_t process(const sample *src, size_t count, sample *dst);
+        //! Filter and decimate a block of samples into dst, which is resized to the number of output samples
+        void process(const std::vector<sample> &src, std::vector<sample> &dst);
+
+        //! Clear the filter state, as if no samples had been processed
+        void reset();
+
+    private:
+        class impl;
+        std::unique_ptr<impl> _impl;
+    };
+
+    //! Parameters of a channelizer
+    struct channelizer_config
+    {
+        unsigned int channels = 16;     // Number of channels, a power of two from 2 to 1024
+        double passband = 0.4;          // Passband edge of each channel as a fraction of the channel spacing, below 0.5
+        double attenuation = 60;        // Stopband attenuation of the prototype filter [dB]
+        unsigned int threads = 0;       // Worker threads, 0 for one per hardware thread
+        unsigned int max_pending = 0;   // Blocks being channelized before process() waits for them, 0 for 4 per thread
+        size_t queue_blocks = 256;      // Blocks each channel's queue holds before further blocks are dropped
+    };
+
+    //! Counters of a channelizer
+    struct channelizer_statistics
+    {
+        unsigned long long samples;     // Samples passed to process()
+        unsigned long long blocks;      // Blocks channelized and delivered to the channel queues
+        unsigned long long stalls;      // Times process() had to wait for the workers to catch up
+        unsigned long long dropped;     // Channel blocks dropped because the channel's queue was full
+    };
+
+    //! Splits a stream into uniformly spaced narrowband channels with a polyphase filter bank and an FFT
+    /*!
+     * The channels are critically sampled: each one is delivered at the input sample rate divided by the number of
+     * channels. Channel c is centered c * samp_rate / channels above the LO, channels from channels / 2 on wrap around
+     * to below the LO like FFT bins. The prototype filter comes from design_decimation_filter.
+     *
+     * Each block passed to process() is channelized on a worker thread, so consecutive blocks are channelized in
+     * parallel. The results are delivered in order to one queue per channel, from which each channel's consumer can
+     * read at its own pace.
+     */
+    class channelizer
+    {
+    public:
+        //! Start the worker threads. Throws std::runtime_error if the configuration is invalid
+        explicit channelizer(const channelizer_config &config);
+        //! Channelize and deliver the blocks already passed to process()
+        ~channelizer();
+
+        unsigned int channels() const;
+
+        //! Center frequency of a channel relative to the LO, as a fraction of the input sample rate
+        double channel_offset(unsigned int channel) const;
+
+        //! Add a block of samples, e.g. from the callback passed to FreeSRP::start_rx
+        /*!
+         * Delivers the blocks that have been channelized in the meantime. Waits only if more than max_pending blocks
+         * are being channelized. Must not be called from more than one thread at a time.
+         */
+        void process(const sample *samples, size_t count);
+        void process(const std::vector<sample> &samples) { process(samples.data(), samples.size()); }
+
+        //! Wait until all blocks passed to process() have been channelized and delivered
+        void flush();
+
+        //! Take the oldest block of a channel's samples
+        /*!
+         * Each channel may be read by a different thread, but each channel only by one thread at a time.
+         *
+         * \param channel: The channel to read
+         * \param block: Set to the samples
+         * \returns false if the channel's queue is empty
+         */
+        bool pop(unsigned int channel, std::vector<sample> &block);
+
+        //! Number of blocks waiting in a channel's queue
+        size_t available(unsigned int channel) const;
+
+        channelizer_statistics stats() const;
+
+    private:
+        class impl;
+        std::unique_ptr<impl> _impl;
+    };
+}
+
+#endif
@@ -0,0 +1,75 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBFREESRP_FREESRP_FORMATS_HPP
+#define LIBFREESRP_FREESRP_FORMATS_HPP
+
+#include <freesrp.hpp>
+
+#include <cstddef>
+#include <string>
+
+namespace FreeSRP
+{
+    //! Sample formats for storing and exchanging received samples
+    enum sample_format
+    {
+        FORMAT_CS8 = 0,         // Interleaved signed 8-bit I/Q, the 8 most significant of the 12 bits
+        FORMAT_CS16,            // Interleaved signed 16-bit I/Q, scaled to full 16-bit range
+        FORMAT_CF32,            // Interleaved 32-bit float I/Q, scaled to -1.0 to 1.0
+        FORMAT_CS12_PACKED,     // 3 bytes per sample: the little-endian 24-bit word I | Q << 12, each 12-bit two's complement
+        FORMAT_RAW              // The FreeSRP's USB wire format: Q then I in the low 12 bits of little-endian 16-bit words
+    };
+
+    //! Size of one complex sample in the given format, in bytes
+    size_t sample_format_size(sample_format format);
+
+    //! Name of a format as accepted by parse_sample_format: "cs8", "cs16", "cf32", "cs12packed" or "raw"
+    std::string sample_format_name(sample_format format);
+
+    //! Look up a sample format by name
+    /*!
+     * \param name: "cs8", "cs16", "cf32", "cs12packed" or "raw"
+     * \param format: Set to the format if the name is known
+     * \returns false if the name is not known
+     */
+    bool parse_sample_format(const std::string &name, sample_format &format);
+
+    //! Convert samples to the given format, using SIMD instructions where available
+    /*!
+     * \param src: Samples to convert
+     * \param count: Number of samples
+     * \param format: Output format
+     * \param dst: Output buffer of at least count * sample_format_size(format) bytes
+     */
+    void convert_samples(const sample *src, size_t count, sample_format format, void *dst);
+
+    //! Convert samples from the given format back to 12-bit samples, using SIMD instructions where available
+    /*!
+     * cs16 values keep their 12 most significant bits, cf32 values are rounded and clipped to the 12-bit range.
+     *
+     * \param src: Samples to convert, count * sample_format_size(format) bytes
+     * \param count: Number of samples
+     * \param format: Input format
+     * \param dst: Output buffer of at least count samples
+     */
+    void convert_to_samples(const void *src, size_t count, sample_format format, sample *dst);
+}
+
+#endif
@@ -0,0 +1,67 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBFREESRP_FREESRP_SWEEP_HPP
+#define LIBFREESRP_FREESRP_SWEEP_HPP
+
+#include <freesrp.hpp>
+
+#include <vector>
+
+namespace FreeSRP
+{
+    //! Parameters of a spectrum sweep
+    struct sweep_config
+    {
+        double start_freq = 70e6;       // Lowest frequency to cover [Hz]
+        double stop_freq = 6e9;         // Highest frequency to cover [Hz]
+        double samp_rate = 20e6;        // Sample rate and RF bandwidth used at each step [Hz]
+        double gain = 30;               // RX gain [dB]
+        double usable_fraction = 0.75;  // Fraction of each step's spectrum around the LO kept in the result
+        unsigned int fft_size = 1024;   // FFT length, must be a power of two
+        unsigned int averages = 16;     // Number of FFTs averaged per step
+        unsigned long settle_samples = 0; // Samples discarded after each retune. 0 discards 2 ms worth of samples
+        unsigned int threads = 0;       // FFT worker threads. 0 uses one per hardware thread
+    };
+
+    //! A stitched power spectrum covering a whole sweep
+    struct sweep_result
+    {
+        std::vector<double> freqs;      // Frequency of each bin [Hz]
+        std::vector<float> power;       // Average power of each bin [dBFS]
+        unsigned long steps;            // Number of LO steps
+        double seconds;                 // Wall time of the sweep
+        double rate;                    // Sweep rate [GHz/s]
+    };
+
+    //! Sweep the RX LO across a frequency range and measure the power spectrum
+    /*!
+     * Configures the receiver, enables the datapath and receives samples for the duration of the sweep.
+     * At each step, the samples received while the LO settles are discarded, and the averaged, windowed
+     * FFT of the following samples is computed on a worker pool while the LO is retuned to the next step.
+     * If RX decimation is enabled, each step covers samp_rate / rx_decimation() and the sweep takes that many
+     * times as many steps.
+     * \param srp: The FreeSRP to sweep with. It must not be receiving when the sweep is started.
+     * \param config: Sweep parameters
+     * \returns The stitched spectrum
+     */
+    sweep_result sweep(FreeSRP &srp, const sweep_config &config);
+}
+
+#endif
@@ -0,0 +1,292 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <freesrp_dsp.hpp>
+
+#include "codec.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#ifdef FREESRP_CODEC_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace FreeSRP;
+
+// |sample|^2 of each sample
+static void sample_power(const sample *src, size_t count, int32_t *dst)
+{
+    size_t n = 0;
+#ifdef FREESRP_CODEC_SSE2
+    // Each sample is an adjacent pair of 16-bit values, so multiply-add with itself yields i * i + q * q
+    for(; n + 4 <= count; n += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *) (src + n));
+        _mm_storeu_si128((__m128i *) (dst + n), _mm_madd_epi16(v, v));
+    }
+#endif
+    for(; n < count; n++)
+    {
+        dst[n] = src[n].i * src[n].i + src[n].q * src[n].q;
+    }
+}
+
+class burst_detector::impl
+{
+public:
+    impl(const burst_detector_config &config, std::function<void(unsigned long long, const std::vector<sample> &)> callback);
+
+    void process(const sample *samples, size_t count);
+    void flush();
+    burst_detector_statistics stats() const { return _stats; }
+
+private:
+    enum state
+    {
+        IDLE,
+        ACTIVE,     // Above end_threshold, or below it for less than hangover samples
+        TRAILING    // Ended, collecting the padding after the end
+    };
+
+    void begin(unsigned long long position, const sample *samples, unsigned long long block_start);
+    void emit();
+
+    burst_detector_config _config;
+    std::function<void(unsigned long long, const std::vector<sample> &)> _callback;
+    long long _start_sum;   // Thresholds as sums of window powers
+    long long _end_sum;
+
+    // Powers of the last window samples, followed by those of the current block
+    std::vector<int32_t> _power;
+    long long _sum = 0;
+    unsigned long long _position = 0;   // Index of the next sample
+
+    // The samples before the current block that a burst starting in it may include
+    std::vector<sample> _tail;
+
+    state _state = IDLE;
+    std::vector<sample> _burst;
+    unsigned long long _burst_start = 0;
+    unsigned long long _burst_end = 0;  // Once TRAILING
+    unsigned long long _last_end = 0;   // One past the last sample of the previous burst
+    unsigned long long _below_start = 0;
+    unsigned int _below = 0;
+
+    burst_detector_statistics _stats;
+};
+
+burst_detector::impl::impl(const burst_detector_config &config,
+                           std::function<void(unsigned long long, const std::vector<sample> &)> callback) :
+    _config(config), _callback(callback)
+{
+    if(config.window == 0 || config.max_length == 0 || config.end_threshold > config.start_threshold)
+    {
+        throw std::runtime_error("burst detector error: invalid configuration");
+    }
+    if(!callback)
+    {
+        throw std::runtime_error("burst detector error: no callback given");
+    }
+
+    double full_scale = 2048.0 * 2048.0 * config.window;
+    _start_sum = std::llround(full_scale * std::pow(10.0, config.start_threshold / 10.0));
+    _end_sum = std::llround(full_scale * std::pow(10.0, config.end_threshold / 10.0));
+
+    _power.assign(config.window, 0);
+    _stats = burst_detector_statistics();
+}
+
+void burst_detector::impl::begin(unsigned long long position, const sample *samples, unsigned long long block_start)
+{
+    // The window ending at position is the first above the threshold, so the burst started within it
+    unsigned long long lead = (unsigned long long) _config.window - 1 + _config.padding;
+    unsigned long long earliest = block_start - std::min(block_start, (unsigned long long) _tail.size());
+    // Do not repeat the end of the previous burst
+    _burst_start = std::max(std::max(position - std::min(position, lead), earliest), _last_end);
+
+    _burst.clear();
+    if(_burst_start < block_start)
+    {
+        _burst.insert(_burst.end(), _tail.end() - (block_start - _burst_start), _tail.end());
+    }
+    _burst.insert(_burst.end(), samples + (std::max(_burst_start, block_start) - block_start),
+                  samples + (position + 1 - block_start));
+
+    _state = ACTIVE;
+    _below = 0;
+}
+
+void burst_detector::impl::emit()
+{
+    if(_state == TRAILING)
+    {
+        size_t length = _burst_end > _burst_start ? (size_t) (_burst_end - _burst_start) : 0;
+        if(_burst.size() > length)
+        {
+            _burst.resize(length);
+        }
+    }
+    _last_end = _burst_start + _burst.size();
+
+    if(_burst.empty())
+    {
+        return;
+    }
+
+    if(_burst.size() < _config.min_length)
+    {
+        _stats.discarded++;
+    }
+    else
+    {
+        _stats.bursts++;
+        _stats.burst_samples += _burst.size();
+        _callback(_burst_start, _burst);
+    }
+    _burst.clear();
+}
+
+void burst_detector::impl::process(const sample *samples, size_t count)
+{
+    size_t window = _config.window;
+    unsigned long long block_start = _position;
+
+    _power.resize(window + count);
+    sample_power(samples, count, _power.data() + window);
+
+    // Samples of the block up to this one are already part of the burst
+    size_t copied = 0;
+
+    for(size_t n = 0; n < count; n++)
+    {
+        _sum += _power[window + n] - _power[n];
+        unsigned long long position = block_start + n;
+
+        switch(_state)
+        {
+        case IDLE:
+            if(_sum > _start_sum)
+            {
+                begin(position, samples, block_start);
+                copied = n + 1;
+            }
+            continue;
+
+        case ACTIVE:
+            if(_sum < _end_sum)
+            {
+                if(_below++ == 0)
+                {
+                    _below_start = position;
+                }
+                if(_below >= _config.hangover)
+                {
+                    _state = TRAILING;
+                    _burst_end = _below_start + 1 + _config.padding;
+                }
+            }
+            else
+            {
+                _below = 0;
+            }
+            break;
+
+        case TRAILING:
+            break;
+        }
+
+        if(_state == TRAILING && position + 1 >= _burst_end)
+        {
+            _burst.insert(_burst.end(), samples + copied, samples + n + 1);
+            copied = n + 1;
+            emit();
+            _state = IDLE;
+        }
+        else if(position + 1 - _burst_start >= _config.max_length)
+        {
+            // Hand over what we have and continue the burst in a new piece
+            _burst.insert(_burst.end(), samples + copied, samples + n + 1);
+            copied = n + 1;
+            state s = _state;
+            _state = ACTIVE;
+            emit();
+            _state = s;
+            _burst_start = position + 1;
+        }
+    }
+
+    if(_state != IDLE)
+    {
+        _burst.insert(_burst.end(), samples + copied, samples + count);
+    }
+
+    // Keep what the next block needs: the last window powers and enough samples for a burst's lead-in
+    std::copy(_power.end() - window, _power.end(), _power.begin());
+    _power.resize(window);
+
+    size_t keep = window - 1 + _config.padding;
+    if(count >= keep)
+    {
+        _tail.assign(samples + count - keep, samples + count);
+    }
+    else
+    {
+        _tail.insert(_tail.end(), samples, samples + count);
+        if(_tail.size() > keep)
+        {
+            _tail.erase(_tail.begin(), _tail.end() - keep);
+        }
+    }
+
+    _position += count;
+    _stats.samples += count;
+}
+
+void burst_detector::impl::flush()
+{
+    if(_state != IDLE)
+    {
+        emit();
+        _state = IDLE;
+    }
+}
+
+burst_detector::burst_detector(const burst_detector_config &config,
+                               std::function<void(unsigned long long, const std::vector<sample> &)> callback) :
+    _impl(new impl(config, callback)) {}
+
+burst_detector::~burst_detector() {}
+
+void burst_detector::process(const sample *samples, size_t count)
+{
+    _impl->process(samples, count);
+}
+
+void burst_detector::flush()
+{
+    _impl->flush();
+}
+
+burst_detector_statistics burst_detector::stats() const
+{
+    return _impl->stats();
+}
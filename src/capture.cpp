@@ -0,0 +1,124 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <freesrp_capture.hpp>
+
+#include <chrono>
+#include <cstring>
+
+using namespace FreeSRP;
+
+static void put_u32(unsigned char *dst, uint32_t value)
+{
+    for(int b = 0; b < 4; b++)
+    {
+        dst[b] = (unsigned char) (value >> (8 * b));
+    }
+}
+
+static void put_double(unsigned char *dst, double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    for(int b = 0; b < 8; b++)
+    {
+        dst[b] = (unsigned char) (bits >> (8 * b));
+    }
+}
+
+static uint32_t get_u32(const unsigned char *src)
+{
+    uint32_t value = 0;
+    for(int b = 0; b < 4; b++)
+    {
+        value |= (uint32_t) src[b] << (8 * b);
+    }
+    return value;
+}
+
+static double get_double(const unsigned char *src)
+{
+    uint64_t bits = 0;
+    for(int b = 0; b < 8; b++)
+    {
+        bits |= (uint64_t) src[b] << (8 * b);
+    }
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+void FreeSRP::encode_capture_header(const capture_header &header, unsigned char *dst)
+{
+    memset(dst, 0, FREESRP_CAPTURE_HEADER_SIZE);
+    memcpy(dst, FREESRP_CAPTURE_MAGIC, 8);
+    put_u32(dst + 8, FREESRP_CAPTURE_VERSION);
+    put_u32(dst + 12, (uint32_t) header.format);
+    put_double(dst + 16, header.samp_rate);
+    put_double(dst + 24, header.center_freq);
+    put_double(dst + 32, header.gain);
+    put_double(dst + 40, header.start_time);
+}
+
+bool FreeSRP::decode_capture_header(const unsigned char *src, size_t length, capture_header &header)
+{
+    if(length < FREESRP_CAPTURE_HEADER_SIZE || memcmp(src, FREESRP_CAPTURE_MAGIC, 8) != 0)
+    {
+        return false;
+    }
+
+    uint32_t format = get_u32(src + 12);
+    if(get_u32(src + 8) != FREESRP_CAPTURE_VERSION || format > FORMAT_RAW)
+    {
+        return false;
+    }
+
+    header.format = (sample_format) format;
+    header.samp_rate = get_double(src + 16);
+    header.center_freq = get_double(src + 24);
+    header.gain = get_double(src + 32);
+    header.start_time = get_double(src + 40);
+    return true;
+}
+
+capture_header FreeSRP::read_capture_header(const FreeSRP &srp, sample_format format)
+{
+    capture_header header;
+    header.format = format;
+    header.start_time = std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+    response res = srp.send_cmd({GET_RX_SAMP_FREQ, 0});
+    if(res.error == CMD_OK)
+    {
+        header.samp_rate = (double) (uint32_t) res.param / srp.rx_decimation();
+    }
+    res = srp.send_cmd({GET_RX_LO_FREQ, 0});
+    if(res.error == CMD_OK)
+    {
+        header.center_freq = (double) res.param;
+    }
+    res = srp.send_cmd({GET_RX_RF_GAIN, 0});
+    if(res.error == CMD_OK)
+    {
+        header.gain = (double) (int32_t) (uint32_t) res.param;
+    }
+
+    return header;
+}
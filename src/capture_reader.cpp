@@ -0,0 +1,367 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <freesrp_capture.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// The index is a cache in native byte order, rebuilt whenever it does not match the capture
+#define CAPTURE_INDEX_MAGIC "FSRPIDX1"
+#define CAPTURE_INDEX_VERSION 1
+
+// Samples converted at a time while building the index
+#define CAPTURE_INDEX_CHUNK 65536
+
+using namespace FreeSRP;
+
+class capture_reader::impl
+{
+public:
+    impl(const std::string &path, sample_format format, unsigned int index_block);
+    ~impl();
+
+    capture_view view(unsigned long long start, size_t count, capture_access access) const;
+    size_t read(unsigned long long start, size_t count, sample *dst) const;
+    const std::vector<capture_index_entry> &index();
+    unsigned long long sample_at(double time);
+    double time_at(unsigned long long sample) const;
+
+    capture_header header;
+    unsigned long long samples = 0;
+
+private:
+    bool load_index();
+    void build_index();
+    void store_index() const;
+    void advise(const unsigned char *data, size_t length, int advice) const;
+
+    std::string _path;
+    unsigned int _index_block;
+    size_t _sample_size;
+    const unsigned char *_map = nullptr;
+    size_t _map_size = 0;
+    const unsigned char *_data = nullptr;
+    long long _mtime_ns = 0;
+    std::vector<capture_index_entry> _index;
+    bool _indexed = false;
+};
+
+capture_reader::impl::impl(const std::string &path, sample_format format, unsigned int index_block) : _path(path), _index_block(index_block)
+{
+    if(index_block == 0)
+    {
+        throw std::runtime_error("capture reader error: index block must not be empty");
+    }
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        throw std::runtime_error("capture reader error: could not open '" + path + "': " + strerror(errno));
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0)
+    {
+        std::string error = strerror(errno);
+        ::close(fd);
+        throw std::runtime_error("capture reader error: could not stat '" + path + "': " + error);
+    }
+    _map_size = (size_t) st.st_size;
+    _mtime_ns = (long long) st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+
+    if(_map_size > 0)
+    {
+        void *map = mmap(nullptr, _map_size, PROT_READ, MAP_SHARED, fd, 0);
+        if(map == MAP_FAILED)
+        {
+            std::string error = strerror(errno);
+            ::close(fd);
+            throw std::runtime_error("capture reader error: could not map '" + path + "': " + error);
+        }
+        _map = (const unsigned char *) map;
+    }
+    // The mapping stays valid without the file descriptor
+    ::close(fd);
+
+    _data = _map;
+    size_t data_size = _map_size;
+    if(decode_capture_header(_map, _map_size, header))
+    {
+        _data += FREESRP_CAPTURE_HEADER_SIZE;
+        data_size -= FREESRP_CAPTURE_HEADER_SIZE;
+    }
+    else
+    {
+        header = capture_header();
+        header.format = format;
+    }
+
+    _sample_size = sample_format_size(header.format);
+    samples = data_size / _sample_size;
+}
+
+capture_reader::impl::~impl()
+{
+    if(_map != nullptr)
+    {
+        munmap((void *) _map, _map_size);
+    }
+}
+
+void capture_reader::impl::advise(const unsigned char *data, size_t length, int advice) const
+{
+    // madvise needs a page aligned address
+    static const uintptr_t page = (uintptr_t) sysconf(_SC_PAGESIZE);
+    uintptr_t begin = (uintptr_t) data & ~(page - 1);
+    madvise((void *) begin, (uintptr_t) data + length - begin, advice);
+}
+
+capture_view capture_reader::impl::view(unsigned long long start, size_t count, capture_access access) const
+{
+    capture_view v = {nullptr, 0, header.format, start};
+    if(start >= samples)
+    {
+        return v;
+    }
+
+    v.count = (size_t) std::min((unsigned long long) count, samples - start);
+    v.data = _data + start * _sample_size;
+
+    switch(access)
+    {
+    case ACCESS_NORMAL:
+        break;
+    case ACCESS_SEQUENTIAL:
+        advise((const unsigned char *) v.data, v.count * _sample_size, MADV_SEQUENTIAL);
+        break;
+    case ACCESS_WILLNEED:
+        advise((const unsigned char *) v.data, v.count * _sample_size, MADV_WILLNEED);
+        break;
+    case ACCESS_RANDOM:
+        advise((const unsigned char *) v.data, v.count * _sample_size, MADV_RANDOM);
+        break;
+    }
+
+    return v;
+}
+
+size_t capture_reader::impl::read(unsigned long long start, size_t count, sample *dst) const
+{
+    capture_view v = view(start, count, ACCESS_NORMAL);
+    convert_to_samples(v.data, v.count, v.format, dst);
+    return v.count;
+}
+
+double capture_reader::impl::time_at(unsigned long long sample) const
+{
+    // Capture files do not mark dropped samples, so this is only exact for captures without gaps
+    if(header.samp_rate <= 0)
+    {
+        return header.start_time;
+    }
+    return header.start_time + sample / header.samp_rate;
+}
+
+const std::vector<capture_index_entry> &capture_reader::impl::index()
+{
+    if(!_indexed)
+    {
+        if(!load_index())
+        {
+            build_index();
+            store_index();
+        }
+        _indexed = true;
+    }
+    return _index;
+}
+
+unsigned long long capture_reader::impl::sample_at(double time)
+{
+    const std::vector<capture_index_entry> &entries = index();
+    if(entries.empty() || header.samp_rate <= 0 || time <= entries.front().time)
+    {
+        return 0;
+    }
+
+    // Interpolate within the last block starting at or before the time
+    auto it = std::upper_bound(entries.begin(), entries.end(), time, [](double t, const capture_index_entry &e) { return t < e.time; }) - 1;
+    unsigned long long end = (it + 1 == entries.end()) ? samples : (it + 1)->sample;
+    // Allow for rounding of the entry's time, so that the time of a sample maps back to it
+    unsigned long long sample = it->sample + (unsigned long long) ((time - it->time) * header.samp_rate + 1e-6);
+    return std::min(sample, end > 0 ? end - 1 : 0);
+}
+
+void capture_reader::impl::build_index()
+{
+    _index.clear();
+    advise(_data, samples * _sample_size, MADV_SEQUENTIAL);
+
+    std::vector<sample> chunk(CAPTURE_INDEX_CHUNK);
+    for(unsigned long long block = 0; block < samples; block += _index_block)
+    {
+        unsigned long long block_end = std::min(samples, block + _index_block);
+
+        double sum = 0;
+        for(unsigned long long pos = block; pos < block_end; pos += CAPTURE_INDEX_CHUNK)
+        {
+            size_t count = read(pos, (size_t) std::min((unsigned long long) CAPTURE_INDEX_CHUNK, block_end - pos), chunk.data());
+            long long chunk_sum = 0;
+            for(size_t n = 0; n < count; n++)
+            {
+                chunk_sum += chunk[n].i * chunk[n].i + chunk[n].q * chunk[n].q;
+            }
+            sum += (double) chunk_sum;
+        }
+
+        // Relative to a full scale complex sinusoid
+        double mean = sum / (block_end - block) / (2048.0 * 2048.0);
+        capture_index_entry entry = {block, time_at(block), (float) (10.0 * std::log10(std::max(mean, 1e-20)))};
+        _index.push_back(entry);
+    }
+
+    advise(_data, samples * _sample_size, MADV_NORMAL);
+}
+
+bool capture_reader::impl::load_index()
+{
+    std::ifstream f(_path + ".fsidx", std::ios::in | std::ios::binary);
+    if(!f)
+    {
+        return false;
+    }
+
+    char magic[8];
+    uint32_t version, block;
+    uint64_t size, count;
+    int64_t mtime;
+    f.read(magic, sizeof(magic));
+    f.read((char *) &version, sizeof(version));
+    f.read((char *) &block, sizeof(block));
+    f.read((char *) &size, sizeof(size));
+    f.read((char *) &mtime, sizeof(mtime));
+    f.read((char *) &count, sizeof(count));
+    if(!f || memcmp(magic, CAPTURE_INDEX_MAGIC, 8) != 0 || version != CAPTURE_INDEX_VERSION || block != _index_block ||
+       size != _map_size || mtime != _mtime_ns || count != (samples + _index_block - 1) / _index_block)
+    {
+        return false;
+    }
+
+    _index.resize(count);
+    for(capture_index_entry &entry : _index)
+    {
+        f.read((char *) &entry.sample, sizeof(entry.sample));
+        f.read((char *) &entry.time, sizeof(entry.time));
+        f.read((char *) &entry.power, sizeof(entry.power));
+    }
+    if(!f)
+    {
+        _index.clear();
+        return false;
+    }
+
+    return true;
+}
+
+void capture_reader::impl::store_index() const
+{
+    // Without write access to the capture's directory the index is only kept in memory
+    std::string path = _path + ".fsidx";
+    {
+        std::ofstream f(path + ".tmp", std::ios::out | std::ios::binary | std::ios::trunc);
+        if(!f)
+        {
+            return;
+        }
+
+        uint32_t version = CAPTURE_INDEX_VERSION, block = _index_block;
+        uint64_t size = _map_size, count = _index.size();
+        int64_t mtime = _mtime_ns;
+        f.write(CAPTURE_INDEX_MAGIC, 8);
+        f.write((const char *) &version, sizeof(version));
+        f.write((const char *) &block, sizeof(block));
+        f.write((const char *) &size, sizeof(size));
+        f.write((const char *) &mtime, sizeof(mtime));
+        f.write((const char *) &count, sizeof(count));
+        for(const capture_index_entry &entry : _index)
+        {
+            f.write((const char *) &entry.sample, sizeof(entry.sample));
+            f.write((const char *) &entry.time, sizeof(entry.time));
+            f.write((const char *) &entry.power, sizeof(entry.power));
+        }
+        if(!f)
+        {
+            f.close();
+            std::remove((path + ".tmp").c_str());
+            return;
+        }
+    }
+    std::rename((path + ".tmp").c_str(), path.c_str());
+}
+
+capture_reader::capture_reader(const std::string &path, sample_format format, unsigned int index_block) : _impl(new impl(path, format, index_block)) {}
+
+capture_reader::~capture_reader() {}
+
+const capture_header &capture_reader::header() const
+{
+    return _impl->header;
+}
+
+unsigned long long capture_reader::samples() const
+{
+    return _impl->samples;
+}
+
+capture_view capture_reader::view(unsigned long long start, size_t count, capture_access access) const
+{
+    return _impl->view(start, count, access);
+}
+
+size_t capture_reader::read(unsigned long long start, size_t count, sample *dst) const
+{
+    return _impl->read(start, count, dst);
+}
+
+const std::vector<capture_index_entry> &capture_reader::index()
+{
+    return _impl->index();
+}
+
+unsigned long long capture_reader::sample_at(double time)
+{
+    return _impl->sample_at(time);
+}
+
+double capture_reader::time_at(unsigned long long sample) const
+{
+    return _impl->time_at(sample);
+}
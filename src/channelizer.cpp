@@ -0,0 +1,346 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <freesrp_dsp.hpp>
+
+#include "codec.hpp"
+#include "fft.hpp"
+#include "worker_pool.hpp"
+#include "readerwriterqueue/readerwriterqueue.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <complex>
+#include <deque>
+#include <stdexcept>
+
+#ifdef FREESRP_CODEC_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace FreeSRP;
+
+static bool valid_channels(unsigned int channels)
+{
+    return channels >= 2 && channels <= 1024 && (channels & (channels - 1)) == 0;
+}
+
+class channelizer::impl
+{
+public:
+    explicit impl(const channelizer_config &config);
+    ~impl();
+
+    unsigned int channels() const { return _channels; }
+    double channel_offset(unsigned int channel) const;
+
+    void process(const sample *samples, size_t count);
+    void flush();
+    bool pop(unsigned int channel, std::vector<sample> &block);
+    size_t available(unsigned int channel) const;
+    channelizer_statistics stats() const;
+
+private:
+    // One block being channelized: its input preceded by the history the filter needs, and per channel output
+    struct job
+    {
+        std::vector<sample> input;
+        size_t first;   // Offset into input of the first frame's window
+        size_t frames;
+        std::vector<std::vector<sample>> output;
+    };
+
+    void channelize(job &j) const;
+    void deliver(job &j);
+    void deliver_ready(bool wait_all);
+
+    unsigned int _channels;
+    size_t _length;     // Prototype filter length, a multiple of the number of channels
+
+    // Reversed prototype filter with each tap twice, to multiply interleaved i and q values
+    std::vector<float> _taps;
+    fft _fft;
+
+    // The last _length - 1 input samples, and the index of the next one
+    std::vector<sample> _tail;
+    unsigned long long _position = 0;
+
+    size_t _max_pending;
+    std::deque<std::pair<std::shared_ptr<job>, std::future<void>>> _pending;
+    std::vector<std::unique_ptr<moodycamel::ReaderWriterQueue<std::vector<sample>>>> _queues;
+
+    std::atomic<unsigned long long> _samples{0};
+    std::atomic<unsigned long long> _blocks{0};
+    std::atomic<unsigned long long> _stalls{0};
+    std::atomic<unsigned long long> _dropped{0};
+
+    // Declared last, so the workers are finished before the state they use is destroyed
+    worker_pool _workers;
+};
+
+channelizer::impl::impl(const channelizer_config &config) :
+    _channels(config.channels),
+    _fft(valid_channels(config.channels) ? config.channels : 2),
+    _workers(config.threads)
+{
+    if(!valid_channels(config.channels))
+    {
+        throw std::runtime_error("channelizer error: the number of channels must be a power of two from 2 to 1024");
+    }
+    if(config.queue_blocks == 0)
+    {
+        throw std::runtime_error("channelizer error: invalid queue size");
+    }
+
+    std::vector<float> prototype = design_decimation_filter(config.channels, config.passband, config.attenuation);
+    _length = (prototype.size() + _channels - 1) / _channels * _channels;
+
+    // Pad at the oldest end, so the newest sample of a window lines up with the first tap
+    _taps.assign(2 * _length, 0.0f);
+    for(size_t n = 0; n < prototype.size(); n++)
+    {
+        _taps[2 * (_length - 1 - n)] = prototype[n];
+        _taps[2 * (_length - 1 - n) + 1] = prototype[n];
+    }
+
+    sample zero = {0, 0};
+    _tail.assign(_length - 1, zero);
+
+    _max_pending = config.max_pending > 0 ? config.max_pending : 4 * _workers.size();
+
+    for(unsigned int c = 0; c < _channels; c++)
+    {
+        _queues.emplace_back(new moodycamel::ReaderWriterQueue<std::vector<sample>>(config.queue_blocks));
+    }
+}
+
+channelizer::impl::~impl()
+{
+    flush();
+}
+
+double channelizer::impl::channel_offset(unsigned int channel) const
+{
+    double offset = (double) channel / _channels;
+    return channel < _channels / 2 ? offset : offset - 1;
+}
+
+void channelizer::impl::channelize(job &j) const
+{
+    size_t m = _channels;
+    size_t rows = _length / m;
+
+    // Interleaved float i and q of the whole input, converted once
+    std::vector<float> input(2 * j.input.size());
+    for(size_t n = 0; n < j.input.size(); n++)
+    {
+        input[2 * n] = j.input[n].i;
+        input[2 * n + 1] = j.input[n].q;
+    }
+
+    std::vector<float> acc(2 * m);
+    std::vector<std::complex<float>> bins(m);
+    for(size_t c = 0; c < m; c++)
+    {
+        j.output[c].resize(j.frames);
+    }
+
+    for(size_t f = 0; f < j.frames; f++)
+    {
+        const float *window = input.data() + 2 * (j.first + f * m);
+
+        // Polyphase filter: row r of the window holds one sample of each branch, so summing the rows' products
+        // elementwise yields all branch outputs at once
+        std::fill(acc.begin(), acc.end(), 0.0f);
+        for(size_t r = 0; r < rows; r++)
+        {
+            const float *x = window + 2 * r * m;
+            const float *h = _taps.data() + 2 * r * m;
+            size_t n = 0;
+#ifdef FREESRP_CODEC_SSE2
+            for(; n + 4 <= 2 * m; n += 4)
+            {
+                __m128 a = _mm_loadu_ps(acc.data() + n);
+                a = _mm_add_ps(a, _mm_mul_ps(_mm_loadu_ps(x + n), _mm_loadu_ps(h + n)));
+                _mm_storeu_ps(acc.data() + n, a);
+            }
+#endif
+            for(; n < 2 * m; n++)
+            {
+                acc[n] += x[n] * h[n];
+            }
+        }
+
+        // The newest sample of the window belongs to branch 0, so branch k is at position m - 1 - k of a row
+        for(size_t k = 0; k < m; k++)
+        {
+            bins[k] = std::complex<float>(acc[2 * (m - 1 - k)], acc[2 * (m - 1 - k) + 1]);
+        }
+
+        _fft.transform(bins.data());
+
+        // Mixing channel c down takes the inverse transform, whose bin c is the forward transform's bin -c
+        for(size_t c = 0; c < m; c++)
+        {
+            const std::complex<float> &v = bins[(m - c) % m];
+            sample &s = j.output[c][f];
+            s.i = (int16_t) std::min(2047L, std::max(-2048L, std::lrint(v.real())));
+            s.q = (int16_t) std::min(2047L, std::max(-2048L, std::lrint(v.imag())));
+        }
+    }
+}
+
+void channelizer::impl::deliver(job &j)
+{
+    if(j.frames > 0)
+    {
+        for(unsigned int c = 0; c < _channels; c++)
+        {
+            if(!_queues[c]->try_enqueue(std::move(j.output[c])))
+            {
+                _dropped.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+    _blocks.fetch_add(1, std::memory_order_relaxed);
+}
+
+void channelizer::impl::deliver_ready(bool wait_all)
+{
+    while(!_pending.empty())
+    {
+        std::future<void> &done = _pending.front().second;
+        if(!wait_all && done.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            break;
+        }
+
+        done.get();
+        deliver(*_pending.front().first);
+        _pending.pop_front();
+    }
+}
+
+void channelizer::impl::process(const sample *samples, size_t count)
+{
+    size_t m = _channels;
+
+    // Frames end on samples whose index is a multiple of the number of channels
+    unsigned long long newest = (_position + m - 1) / m * m;
+
+    std::shared_ptr<job> j = std::make_shared<job>();
+    j->input.reserve(_tail.size() + count);
+    j->input.insert(j->input.end(), _tail.begin(), _tail.end());
+    j->input.insert(j->input.end(), samples, samples + count);
+    j->first = (size_t) (newest - _position);
+    j->frames = newest < _position + count ? (size_t) ((_position + count - newest - 1) / m + 1) : 0;
+    j->output.resize(m);
+
+    _tail.assign(j->input.end() - (_length - 1), j->input.end());
+    _position += count;
+    _samples.fetch_add(count, std::memory_order_relaxed);
+
+    if(_pending.size() >= _max_pending)
+    {
+        // The workers are not keeping up
+        _stalls.fetch_add(1, std::memory_order_relaxed);
+        _pending.front().second.wait();
+    }
+
+    job *raw = j.get();
+    _pending.emplace_back(j, _workers.submit([this, raw]() {
+        channelize(*raw);
+    }));
+
+    deliver_ready(false);
+}
+
+void channelizer::impl::flush()
+{
+    deliver_ready(true);
+}
+
+bool channelizer::impl::pop(unsigned int channel, std::vector<sample> &block)
+{
+    if(channel >= _channels)
+    {
+        throw std::runtime_error("channelizer error: no such channel");
+    }
+    return _queues[channel]->try_dequeue(block);
+}
+
+size_t channelizer::impl::available(unsigned int channel) const
+{
+    if(channel >= _channels)
+    {
+        throw std::runtime_error("channelizer error: no such channel");
+    }
+    return _queues[channel]->size_approx();
+}
+
+channelizer_statistics channelizer::impl::stats() const
+{
+    channelizer_statistics s;
+    s.samples = _samples.load(std::memory_order_relaxed);
+    s.blocks = _blocks.load(std::memory_order_relaxed);
+    s.stalls = _stalls.load(std::memory_order_relaxed);
+    s.dropped = _dropped.load(std::memory_order_relaxed);
+    return s;
+}
+
+channelizer::channelizer(const channelizer_config &config) : _impl(new impl(config)) {}
+
+channelizer::~channelizer() {}
+
+unsigned int channelizer::channels() const
+{
+    return _impl->channels();
+}
+
+double channelizer::channel_offset(unsigned int channel) const
+{
+    return _impl->channel_offset(channel);
+}
+
+void channelizer::process(const sample *samples, size_t count)
+{
+    _impl->process(samples, count);
+}
+
+void channelizer::flush()
+{
+    _impl->flush();
+}
+
+bool channelizer::pop(unsigned int channel, std::vector<sample> &block)
+{
+    return _impl->pop(channel, block);
+}
+
+size_t channelizer::available(unsigned int channel) const
+{
+    return _impl->available(channel);
+}
+
+channelizer_statistics channelizer::stats() const
+{
+    return _impl->stats();
+}
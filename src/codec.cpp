@@ -0,0 +1,170 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "codec.hpp"
+
+#include <cstring>
+
+#ifdef FREESRP_CODEC_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace FreeSRP;
+
+void FreeSRP::decode_samples_scalar(const unsigned char *src, sample *dst, size_t count)
+{
+    for(size_t n = 0; n < count; n++)
+    {
+        uint16_t raw_i;
+        uint16_t raw_q;
+        memcpy(&raw_q, src + n * FREESRP_BYTES_PER_SAMPLE, sizeof(raw_q));
+        memcpy(&raw_i, src + n * FREESRP_BYTES_PER_SAMPLE + sizeof(raw_q), sizeof(raw_i));
+
+        // Convert the raw I/Q values from 12-bit (two's complement) to 16-bit signed integers
+        int16_t signed_i;
+        int16_t signed_q;
+        // Do sign extension
+        bool i_negative = (raw_i & (1 << 11))!=0;
+        bool q_negative = (raw_q & (1 << 11))!=0;
+        if (i_negative)
+        {
+            signed_i = (int16_t) (raw_i | ~((1 << 11)-1));
+        }
+        else
+        {
+            signed_i = raw_i;
+        }
+        if (q_negative)
+        {
+            signed_q = (int16_t) (raw_q | ~((1 << 11)-1));
+        }
+        else
+        {
+            signed_q = raw_q;
+        }
+
+        dst[n].i = signed_i;
+        dst[n].q = signed_q;
+    }
+}
+
+void FreeSRP::encode_samples_scalar(const sample *src, unsigned char *dst, size_t count)
+{
+    for(size_t n = 0; n < count; n++)
+    {
+        int16_t signed_i = src[n].i;
+        int16_t signed_q = src[n].q;
+
+        // Unsigned 16-bit ints holding the two's-complement 12-bit sample values
+        uint16_t raw_i;
+        uint16_t raw_q;
+
+        if(signed_i >= 0)
+        {
+            raw_i = (uint16_t) signed_i;
+        }
+        else
+        {
+            raw_i = (((uint16_t) (-signed_i)) ^ ((uint16_t) 0xFFF)) + (uint16_t) 1;
+        }
+
+        if(signed_q >= 0)
+        {
+            raw_q = (uint16_t) signed_q;
+        }
+        else
+        {
+            raw_q = (((uint16_t) (-signed_q)) ^ ((uint16_t) 0xFFF)) + (uint16_t) 1;
+        }
+
+        // Copy raw i/q data into the buffer
+        memcpy(dst + n * FREESRP_BYTES_PER_SAMPLE, &raw_q, sizeof(raw_q));
+        memcpy(dst + n * FREESRP_BYTES_PER_SAMPLE + sizeof(raw_q), &raw_i, sizeof(raw_i));
+    }
+}
+
+#ifdef FREESRP_CODEC_SSE2
+void FreeSRP::decode_samples_sse2(const unsigned char *src, sample *dst, size_t count)
+{
+    const __m128i sign_bit = _mm_set1_epi16(1 << 11);
+    const __m128i sign_fill = _mm_set1_epi16((int16_t) 0xF800);
+
+    size_t n = 0;
+    for(; n + 4 <= count; n += 4)
+    {
+        __m128i raw = _mm_loadu_si128((const __m128i *) (src + n * FREESRP_BYTES_PER_SAMPLE));
+
+        // Swap each Q/I word pair into I/Q order
+        raw = _mm_shufflelo_epi16(raw, _MM_SHUFFLE(2, 3, 0, 1));
+        raw = _mm_shufflehi_epi16(raw, _MM_SHUFFLE(2, 3, 0, 1));
+
+        // Sign extend from bit 11
+        __m128i negative = _mm_cmpeq_epi16(_mm_and_si128(raw, sign_bit), sign_bit);
+        raw = _mm_or_si128(raw, _mm_and_si128(negative, sign_fill));
+
+        _mm_storeu_si128((__m128i *) (dst + n), raw);
+    }
+
+    decode_samples_scalar(src + n * FREESRP_BYTES_PER_SAMPLE, dst + n, count - n);
+}
+
+void FreeSRP::encode_samples_sse2(const sample *src, unsigned char *dst, size_t count)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i low_bits = _mm_set1_epi16(0xFFF);
+    const __m128i one = _mm_set1_epi16(1);
+
+    size_t n = 0;
+    for(; n + 4 <= count; n += 4)
+    {
+        __m128i s = _mm_loadu_si128((const __m128i *) (src + n));
+
+        // Negative values become ((-s) ^ 0xFFF) + 1, like the scalar encoder
+        __m128i negative = _mm_cmpgt_epi16(zero, s);
+        __m128i encoded = _mm_add_epi16(_mm_xor_si128(_mm_sub_epi16(zero, s), low_bits), one);
+        __m128i raw = _mm_or_si128(_mm_and_si128(negative, encoded), _mm_andnot_si128(negative, s));
+
+        // Swap each I/Q word pair into Q/I order
+        raw = _mm_shufflelo_epi16(raw, _MM_SHUFFLE(2, 3, 0, 1));
+        raw = _mm_shufflehi_epi16(raw, _MM_SHUFFLE(2, 3, 0, 1));
+
+        _mm_storeu_si128((__m128i *) (dst + n * FREESRP_BYTES_PER_SAMPLE), raw);
+    }
+
+    encode_samples_scalar(src + n, dst + n * FREESRP_BYTES_PER_SAMPLE, count - n);
+}
+#endif
+
+void FreeSRP::decode_samples(const unsigned char *src, sample *dst, size_t count)
+{
+#ifdef FREESRP_CODEC_SSE2
+    decode_samples_sse2(src, dst, count);
+#else
+    decode_samples_scalar(src, dst, count);
+#endif
+}
+
+void FreeSRP::encode_samples(const sample *src, unsigned char *dst, size_t count)
+{
+#ifdef FREESRP_CODEC_SSE2
+    encode_samples_sse2(src, dst, count);
+#else
+    encode_samples_scalar(src, dst, count);
+#endif
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBFREESRP_CODEC_HPP
+#define LIBFREESRP_CODEC_HPP
+
+#include <cstddef>
+
+#include "freesrp.hpp"
+
+#if defined(__SSE2__)
+#define FREESRP_CODEC_SSE2
+#endif
+
+namespace FreeSRP
+{
+    // Conversion between samples and the FreeSRP's wire format: per sample, Q then I as 12-bit two's complement
+    // values in the low bits of little-endian 16-bit words. The vectorized versions are bit-exact with the scalar ones.
+
+    void decode_samples_scalar(const unsigned char *src, sample *dst, size_t count);
+    void encode_samples_scalar(const sample *src, unsigned char *dst, size_t count);
+
+#ifdef FREESRP_CODEC_SSE2
+    void decode_samples_sse2(const unsigned char *src, sample *dst, size_t count);
+    void encode_samples_sse2(const sample *src, unsigned char *dst, size_t count);
+#endif
+
+    // Best available implementation
+    void decode_samples(const unsigned char *src, sample *dst, size_t count);
+    void encode_samples(const sample *src, unsigned char *dst, size_t count);
+}
+
+#endif
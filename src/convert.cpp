@@ -0,0 +1,375 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <freesrp_formats.hpp>
+
+#include "codec.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef FREESRP_CODEC_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(FREESRP_CODEC_SSE2) && defined(__GNUC__)
+#include <tmmintrin.h>
+#define FREESRP_CONVERT_SSSE3
+#endif
+
+using namespace FreeSRP;
+
+size_t FreeSRP::sample_format_size(sample_format format)
+{
+    switch(format)
+    {
+    case FORMAT_CS8: return 2;
+    case FORMAT_CS16: return 4;
+    case FORMAT_CF32: return 8;
+    case FORMAT_CS12_PACKED: return 3;
+    case FORMAT_RAW: return FREESRP_BYTES_PER_SAMPLE;
+    }
+    throw std::runtime_error("sample format error: unknown format " + std::to_string((int) format));
+}
+
+std::string FreeSRP::sample_format_name(sample_format format)
+{
+    switch(format)
+    {
+    case FORMAT_CS8: return "cs8";
+    case FORMAT_CS16: return "cs16";
+    case FORMAT_CF32: return "cf32";
+    case FORMAT_CS12_PACKED: return "cs12packed";
+    case FORMAT_RAW: return "raw";
+    }
+    throw std::runtime_error("sample format error: unknown format " + std::to_string((int) format));
+}
+
+bool FreeSRP::parse_sample_format(const std::string &name, sample_format &format)
+{
+    const sample_format formats[] = {FORMAT_CS8, FORMAT_CS16, FORMAT_CF32, FORMAT_CS12_PACKED, FORMAT_RAW};
+    for(sample_format f : formats)
+    {
+        if(sample_format_name(f) == name)
+        {
+            format = f;
+            return true;
+        }
+    }
+    return false;
+}
+
+// The vectorized loops below handle whole groups of samples and leave the remainder to these scalar loops.
+
+static void to_cs8(const sample *src, size_t count, int8_t *dst)
+{
+    for(size_t n = 0; n < count; n++)
+    {
+        dst[2 * n] = (int8_t) (src[n].i >> 4);
+        dst[2 * n + 1] = (int8_t) (src[n].q >> 4);
+    }
+}
+
+static void to_cs16(const sample *src, size_t count, int16_t *dst)
+{
+    for(size_t n = 0; n < count; n++)
+    {
+        dst[2 * n] = (int16_t) (src[n].i * 16);
+        dst[2 * n + 1] = (int16_t) (src[n].q * 16);
+    }
+}
+
+static void to_cf32(const sample *src, size_t count, float *dst)
+{
+    for(size_t n = 0; n < count; n++)
+    {
+        dst[2 * n] = src[n].i * (1.0f / 2048.0f);
+        dst[2 * n + 1] = src[n].q * (1.0f / 2048.0f);
+    }
+}
+
+static void to_cs12_packed(const sample *src, size_t count, unsigned char *dst)
+{
+    for(size_t n = 0; n < count; n++)
+    {
+        uint32_t word = ((uint32_t) src[n].i & 0xFFF) | (((uint32_t) src[n].q & 0xFFF) << 12);
+        dst[3 * n] = (unsigned char) word;
+        dst[3 * n + 1] = (unsigned char) (word >> 8);
+        dst[3 * n + 2] = (unsigned char) (word >> 16);
+    }
+}
+
+static void from_cs8(const int8_t *src, size_t count, sample *dst)
+{
+    for(size_t n = 0; n < count; n++)
+    {
+        dst[n].i = (int16_t) (src[2 * n] * 16);
+        dst[n].q = (int16_t) (src[2 * n + 1] * 16);
+    }
+}
+
+static void from_cs16(const int16_t *src, size_t count, sample *dst)
+{
+    for(size_t n = 0; n < count; n++)
+    {
+        dst[n].i = (int16_t) (src[2 * n] >> 4);
+        dst[n].q = (int16_t) (src[2 * n + 1] >> 4);
+    }
+}
+
+static int16_t from_float(float value)
+{
+    // Same rounding (to nearest even) and clipping as the SSE2 version
+    value = std::min(std::max(value * 2048.0f, -2048.0f), 2047.0f);
+    return (int16_t) std::lrint(value);
+}
+
+static void from_cf32(const float *src, size_t count, sample *dst)
+{
+    for(size_t n = 0; n < count; n++)
+    {
+        dst[n].i = from_float(src[2 * n]);
+        dst[n].q = from_float(src[2 * n + 1]);
+    }
+}
+
+static void from_cs12_packed(const unsigned char *src, size_t count, sample *dst)
+{
+    for(size_t n = 0; n < count; n++)
+    {
+        uint32_t word = src[3 * n] | (src[3 * n + 1] << 8) | (src[3 * n + 2] << 16);
+        // Sign extend from 12 bits by moving each value to the top of a 16-bit word and shifting back down
+        dst[n].i = (int16_t) ((int16_t) (word << 4) >> 4);
+        dst[n].q = (int16_t) ((int16_t) ((word >> 12) << 4) >> 4);
+    }
+}
+
+#ifdef FREESRP_CODEC_SSE2
+static size_t to_cs8_sse2(const sample *src, size_t count, int8_t *dst)
+{
+    size_t n = 0;
+    for(; n + 8 <= count; n += 8)
+    {
+        __m128i a = _mm_srai_epi16(_mm_loadu_si128((const __m128i *) (src + n)), 4);
+        __m128i b = _mm_srai_epi16(_mm_loadu_si128((const __m128i *) (src + n + 4)), 4);
+        _mm_storeu_si128((__m128i *) (dst + 2 * n), _mm_packs_epi16(a, b));
+    }
+    return n;
+}
+
+static size_t to_cs16_sse2(const sample *src, size_t count, int16_t *dst)
+{
+    size_t n = 0;
+    for(; n + 4 <= count; n += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *) (src + n));
+        _mm_storeu_si128((__m128i *) (dst + 2 * n), _mm_slli_epi16(v, 4));
+    }
+    return n;
+}
+
+static size_t to_cf32_sse2(const sample *src, size_t count, float *dst)
+{
+    const __m128 scale = _mm_set1_ps(1.0f / 2048.0f);
+
+    size_t n = 0;
+    for(; n + 4 <= count; n += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *) (src + n));
+
+        // Sign extend to 32 bits by moving each value to the upper half and shifting back down
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+
+        _mm_storeu_ps(dst + 2 * n, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(dst + 2 * n + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+    return n;
+}
+
+static size_t from_cs8_sse2(const int8_t *src, size_t count, sample *dst)
+{
+    size_t n = 0;
+    for(; n + 8 <= count; n += 8)
+    {
+        // Move each byte to the top of a 16-bit word, then shift it back down to 12 bits
+        __m128i v = _mm_loadu_si128((const __m128i *) (src + 2 * n));
+        __m128i zero = _mm_setzero_si128();
+        _mm_storeu_si128((__m128i *) (dst + n), _mm_srai_epi16(_mm_unpacklo_epi8(zero, v), 4));
+        _mm_storeu_si128((__m128i *) (dst + n + 4), _mm_srai_epi16(_mm_unpackhi_epi8(zero, v), 4));
+    }
+    return n;
+}
+
+static size_t from_cs16_sse2(const int16_t *src, size_t count, sample *dst)
+{
+    size_t n = 0;
+    for(; n + 4 <= count; n += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *) (src + 2 * n));
+        _mm_storeu_si128((__m128i *) (dst + n), _mm_srai_epi16(v, 4));
+    }
+    return n;
+}
+
+static size_t from_cf32_sse2(const float *src, size_t count, sample *dst)
+{
+    const __m128 scale = _mm_set1_ps(2048.0f);
+    const __m128 min = _mm_set1_ps(-2048.0f);
+    const __m128 max = _mm_set1_ps(2047.0f);
+
+    size_t n = 0;
+    for(; n + 4 <= count; n += 4)
+    {
+        __m128 a = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + 2 * n), scale), min), max);
+        __m128 b = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + 2 * n + 4), scale), min), max);
+        __m128i v = _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b));
+        _mm_storeu_si128((__m128i *) (dst + n), v);
+    }
+    return n;
+}
+#endif
+
+#ifdef FREESRP_CONVERT_SSSE3
+__attribute__((target("ssse3")))
+static size_t to_cs12_packed_ssse3(const sample *src, size_t count, unsigned char *dst)
+{
+    const __m128i low_mask = _mm_set1_epi32(0xFFF);
+    const __m128i high_mask = _mm_set1_epi32(0xFFF000);
+    // Keep the low three bytes of each 32-bit word
+    const __m128i compact = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+    size_t n = 0;
+    // Each step stores 16 bytes of which the next step overwrites the last 4
+    for(; n + 6 <= count; n += 4)
+    {
+        // Each 32-bit word holds I in its low and Q in its high 16 bits
+        __m128i v = _mm_loadu_si128((const __m128i *) (src + n));
+        __m128i word = _mm_or_si128(_mm_and_si128(v, low_mask), _mm_and_si128(_mm_srli_epi32(v, 4), high_mask));
+        _mm_storeu_si128((__m128i *) (dst + 3 * n), _mm_shuffle_epi8(word, compact));
+    }
+    return n;
+}
+
+__attribute__((target("ssse3")))
+static size_t from_cs12_packed_ssse3(const unsigned char *src, size_t count, sample *dst)
+{
+    // Spread each three-byte sample into its own 32-bit word
+    const __m128i expand = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i low_mask = _mm_set1_epi32(0xFFFF);
+
+    size_t n = 0;
+    // Each step loads 16 bytes of which only the first 12 are used
+    for(; n + 6 <= count; n += 4)
+    {
+        __m128i word = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (src + 3 * n)), expand);
+        // Move I and Q to the top of the word and shift them back down, sign extending them
+        __m128i i = _mm_srai_epi32(_mm_slli_epi32(word, 20), 20);
+        __m128i q = _mm_srai_epi32(_mm_slli_epi32(word, 8), 20);
+        _mm_storeu_si128((__m128i *) (dst + n), _mm_or_si128(_mm_and_si128(i, low_mask), _mm_slli_epi32(q, 16)));
+    }
+    return n;
+}
+
+static bool have_ssse3()
+{
+    static const bool supported = __builtin_cpu_supports("ssse3");
+    return supported;
+}
+#endif
+
+void FreeSRP::convert_samples(const sample *src, size_t count, sample_format format, void *dst)
+{
+    size_t done = 0;
+
+    switch(format)
+    {
+    case FORMAT_CS8:
+#ifdef FREESRP_CODEC_SSE2
+        done = to_cs8_sse2(src, count, (int8_t *) dst);
+#endif
+        to_cs8(src + done, count - done, (int8_t *) dst + 2 * done);
+        break;
+    case FORMAT_CS16:
+#ifdef FREESRP_CODEC_SSE2
+        done = to_cs16_sse2(src, count, (int16_t *) dst);
+#endif
+        to_cs16(src + done, count - done, (int16_t *) dst + 2 * done);
+        break;
+    case FORMAT_CF32:
+#ifdef FREESRP_CODEC_SSE2
+        done = to_cf32_sse2(src, count, (float *) dst);
+#endif
+        to_cf32(src + done, count - done, (float *) dst + 2 * done);
+        break;
+    case FORMAT_CS12_PACKED:
+#ifdef FREESRP_CONVERT_SSSE3
+        if(have_ssse3())
+        {
+            done = to_cs12_packed_ssse3(src, count, (unsigned char *) dst);
+        }
+#endif
+        to_cs12_packed(src + done, count - done, (unsigned char *) dst + 3 * done);
+        break;
+    case FORMAT_RAW:
+        encode_samples(src, (unsigned char *) dst, count);
+        break;
+    }
+}
+
+void FreeSRP::convert_to_samples(const void *src, size_t count, sample_format format, sample *dst)
+{
+    size_t done = 0;
+
+    switch(format)
+    {
+    case FORMAT_CS8:
+#ifdef FREESRP_CODEC_SSE2
+        done = from_cs8_sse2((const int8_t *) src, count, dst);
+#endif
+        from_cs8((const int8_t *) src + 2 * done, count - done, dst + done);
+        break;
+    case FORMAT_CS16:
+#ifdef FREESRP_CODEC_SSE2
+        done = from_cs16_sse2((const int16_t *) src, count, dst);
+#endif
+        from_cs16((const int16_t *) src + 2 * done, count - done, dst + done);
+        break;
+    case FORMAT_CF32:
+#ifdef FREESRP_CODEC_SSE2
+        done = from_cf32_sse2((const float *) src, count, dst);
+#endif
+        from_cf32((const float *) src + 2 * done, count - done, dst + done);
+        break;
+    case FORMAT_CS12_PACKED:
+#ifdef FREESRP_CONVERT_SSSE3
+        if(have_ssse3())
+        {
+            done = from_cs12_packed_ssse3((const unsigned char *) src, count, dst);
+        }
+#endif
+        from_cs12_packed((const unsigned char *) src + 3 * done, count - done, dst + done);
+        break;
+    case FORMAT_RAW:
+        decode_samples((const unsigned char *) src, dst, count);
+        break;
+    }
+}
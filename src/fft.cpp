@@ -0,0 +1,84 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fft.hpp"
+
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+
+using namespace FreeSRP;
+
+fft::fft(unsigned int size) : _size(size)
+{
+    if(size < 2 || (size & (size - 1)) != 0)
+    {
+        throw std::runtime_error("fft error: size must be a power of two");
+    }
+
+    unsigned int bits = 0;
+    while((1u << bits) < size)
+    {
+        bits++;
+    }
+
+    _bit_reversed.resize(size);
+    for(unsigned int i = 0; i < size; i++)
+    {
+        unsigned int r = 0;
+        for(unsigned int b = 0; b < bits; b++)
+        {
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        }
+        _bit_reversed[i] = r;
+    }
+
+    _twiddles.resize(size / 2);
+    for(unsigned int i = 0; i < size / 2; i++)
+    {
+        double phase = -2.0 * M_PI * i / size;
+        _twiddles[i] = std::complex<float>((float) std::cos(phase), (float) std::sin(phase));
+    }
+}
+
+void fft::transform(std::complex<float> *data) const
+{
+    for(unsigned int i = 0; i < _size; i++)
+    {
+        if(i < _bit_reversed[i])
+        {
+            std::swap(data[i], data[_bit_reversed[i]]);
+        }
+    }
+
+    for(unsigned int len = 2; len <= _size; len <<= 1)
+    {
+        unsigned int half = len / 2;
+        unsigned int stride = _size / len;
+        for(unsigned int start = 0; start < _size; start += len)
+        {
+            for(unsigned int k = 0; k < half; k++)
+            {
+                std::complex<float> t = _twiddles[k * stride] * data[start + k + half];
+                data[start + k + half] = data[start + k] - t;
+                data[start + k] += t;
+            }
+        }
+    }
+}
@@ -0,0 +1,45 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBFREESRP_FFT_HPP
+#define LIBFREESRP_FFT_HPP
+
+#include <complex>
+#include <vector>
+
+namespace FreeSRP
+{
+    // In-place radix-2 FFT with precomputed twiddle factors. One instance may be shared by several threads.
+    class fft
+    {
+    public:
+        explicit fft(unsigned int size);
+
+        unsigned int size() const { return _size; }
+
+        void transform(std::complex<float> *data) const;
+
+    private:
+        unsigned int _size;
+        std::vector<std::complex<float>> _twiddles;
+        std::vector<unsigned int> _bit_reversed;
+    };
+}
+
+#endif
@@ -0,0 +1,282 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <freesrp_dsp.hpp>
+
+#include "codec.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#ifdef FREESRP_CODEC_SSE2
+#include <emmintrin.h>
+#endif
+
+// Fractional bits of the quantized taps
+#define FIR_TAP_BITS 15
+
+using namespace FreeSRP;
+
+// Zeroth order modified Bessel function of the first kind, for the Kaiser window
+static double bessel_i0(double x)
+{
+    double sum = 1, term = 1;
+    for(int k = 1; k < 50 && term > sum * 1e-12; k++)
+    {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+std::vector<float> FreeSRP::design_decimation_filter(unsigned int decimation, double passband, double attenuation)
+{
+    if(decimation < 2 || passband <= 0 || passband >= 0.5 || attenuation <= 0)
+    {
+        throw std::runtime_error("filter design error: invalid parameters");
+    }
+
+    // Frequencies are relative to the input sample rate. Everything from the output sample rate minus the passband
+    // up aliases outside of the passband, so the transition band may extend to there.
+    double pass = passband / decimation;
+    double stop = (1 - passband) / decimation;
+    double cutoff = (pass + stop) / 2;
+    double width = 2 * M_PI * (stop - pass);
+
+    double beta;
+    if(attenuation > 50)
+    {
+        beta = 0.1102 * (attenuation - 8.7);
+    }
+    else if(attenuation > 21)
+    {
+        beta = 0.5842 * std::pow(attenuation - 21, 0.4) + 0.07886 * (attenuation - 21);
+    }
+    else
+    {
+        beta = 0;
+    }
+
+    unsigned int length = (unsigned int) std::ceil((attenuation - 8) / (2.285 * width)) + 1;
+    length |= 1;
+
+    std::vector<double> taps(length);
+    double sum = 0;
+    double center = (length - 1) / 2.0;
+    for(unsigned int n = 0; n < length; n++)
+    {
+        double t = n - center;
+        double sinc = t == 0 ? 2 * cutoff : std::sin(2 * M_PI * cutoff * t) / (M_PI * t);
+        double r = t / center;
+        taps[n] = sinc * bessel_i0(beta * std::sqrt(std::max(0.0, 1 - r * r))) / bessel_i0(beta);
+        sum += taps[n];
+    }
+
+    std::vector<float> result(length);
+    for(unsigned int n = 0; n < length; n++)
+    {
+        result[n] = (float) (taps[n] / sum);
+    }
+    return result;
+}
+
+class fir_decimator::impl
+{
+public:
+    impl(unsigned int decimation, const std::vector<float> &taps);
+
+    unsigned int decimation() const { return _decimation; }
+    size_t num_taps() const { return _num_taps; }
+
+    size_t process(const sample *src, size_t count, sample *dst);
+    void reset();
+
+private:
+    sample filter(const sample *window) const;
+
+    unsigned int _decimation;
+    size_t _num_taps;
+
+    // Quantized taps in reverse order, so they line up with the oldest to newest samples of a window. Padded with
+    // zeros at the front to a multiple of four.
+    std::vector<int16_t> _taps;
+#ifdef FREESRP_CODEC_SSE2
+    // The same taps in pairs as the vectorized filter uses them: h0 h1 h0 h1 h2 h3 h2 h3 ...
+    std::vector<int16_t> _tap_pairs;
+#endif
+
+    // The samples before the next block that the next windows need
+    std::vector<sample> _tail;
+    // The next window starts this many samples into _tail followed by the next block
+    size_t _next = 0;
+    // _tail joined with the start of a block
+    std::vector<sample> _join;
+};
+
+fir_decimator::impl::impl(unsigned int decimation, const std::vector<float> &taps) :
+    _decimation(decimation), _num_taps(taps.size())
+{
+    if(decimation == 0 || taps.empty())
+    {
+        throw std::runtime_error("decimator error: invalid parameters");
+    }
+
+    size_t length = (taps.size() + 3) & ~(size_t) 3;
+    _taps.assign(length, 0);
+    for(size_t n = 0; n < taps.size(); n++)
+    {
+        long q = std::lround(taps[n] * (1 << FIR_TAP_BITS));
+        if(q > INT16_MAX || q < INT16_MIN)
+        {
+            throw std::runtime_error("decimator error: filter taps must be below 1");
+        }
+        _taps[length - 1 - n] = (int16_t) q;
+    }
+
+#ifdef FREESRP_CODEC_SSE2
+    _tap_pairs.resize(2 * length);
+    for(size_t n = 0; n < length; n += 2)
+    {
+        _tap_pairs[2 * n] = _taps[n];
+        _tap_pairs[2 * n + 1] = _taps[n + 1];
+        _tap_pairs[2 * n + 2] = _taps[n];
+        _tap_pairs[2 * n + 3] = _taps[n + 1];
+    }
+#endif
+
+    reset();
+}
+
+void fir_decimator::impl::reset()
+{
+    // Start with a window of zeros ending at the first sample
+    sample zero = {0, 0};
+    _tail.assign(_taps.size() - 1, zero);
+    _next = 0;
+}
+
+sample fir_decimator::impl::filter(const sample *window) const
+{
+    size_t length = _taps.size();
+    int32_t acc_i = 0, acc_q = 0;
+
+#ifdef FREESRP_CODEC_SSE2
+    // Reorder each pair of samples to i0 i1 q0 q1, so multiply-add with h0 h1 h0 h1 yields the i and q sums
+    __m128i acc = _mm_setzero_si128();
+    for(size_t n = 0; n < length; n += 4)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *) (window + n));
+        x = _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, _MM_SHUFFLE(3, 1, 2, 0)), _MM_SHUFFLE(3, 1, 2, 0));
+        __m128i h = _mm_loadu_si128((const __m128i *) (_tap_pairs.data() + 2 * n));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(x, h));
+    }
+    int32_t lanes[4];
+    _mm_storeu_si128((__m128i *) lanes, acc);
+    acc_i = lanes[0] + lanes[2];
+    acc_q = lanes[1] + lanes[3];
+#else
+    for(size_t n = 0; n < length; n++)
+    {
+        acc_i += _taps[n] * window[n].i;
+        acc_q += _taps[n] * window[n].q;
+    }
+#endif
+
+    // Round to 12 bits
+    const int32_t half = 1 << (FIR_TAP_BITS - 1);
+    sample out;
+    out.i = (int16_t) std::min(2047, std::max(-2048, (acc_i + half) >> FIR_TAP_BITS));
+    out.q = (int16_t) std::min(2047, std::max(-2048, (acc_q + half) >> FIR_TAP_BITS));
+    return out;
+}
+
+size_t fir_decimator::impl::process(const sample *src, size_t count, sample *dst)
+{
+    size_t length = _taps.size();
+    size_t tail = _tail.size();
+    size_t total = tail + count;
+    size_t produced = 0;
+
+    // Windows that start in the tail read from a copy of the tail followed by the start of the block
+    if(_next < tail)
+    {
+        _join.assign(_tail.begin(), _tail.end());
+        _join.insert(_join.end(), src, src + std::min(count, length - 1));
+        for(; _next < tail && _next + length <= total; _next += _decimation)
+        {
+            dst[produced++] = filter(&_join[_next]);
+        }
+    }
+
+    // The rest straight from the block
+    for(; _next + length <= total; _next += _decimation)
+    {
+        dst[produced++] = filter(src + (_next - tail));
+    }
+
+    // Keep the samples from the start of the next window on
+    if(_next >= tail)
+    {
+        size_t start = std::min(_next - tail, count);
+        _tail.assign(src + start, src + count);
+    }
+    else
+    {
+        _tail.assign(_join.begin() + _next, _join.end());
+    }
+    _next -= std::min(_next, total - _tail.size());
+
+    return produced;
+}
+
+fir_decimator::fir_decimator(unsigned int decimation, const std::vector<float> &taps) :
+    _impl(new impl(decimation, taps)) {}
+
+fir_decimator::fir_decimator(unsigned int decimation, double passband, double attenuation) :
+    _impl(new impl(decimation, design_decimation_filter(decimation, passband, attenuation))) {}
+
+fir_decimator::~fir_decimator() {}
+
+unsigned int fir_decimator::decimation() const
+{
+    return _impl->decimation();
+}
+
+size_t fir_decimator::num_taps() const
+{
+    return _impl->num_taps();
+}
+
+size_t fir_decimator::process(const sample *src, size_t count, sample *dst)
+{
+    return _impl->process(src, count, dst);
+}
+
+void fir_decimator::process(const std::vector<sample> &src, std::vector<sample> &dst)
+{
+    dst.resize(src.size() / _impl->decimation() + 1);
+    dst.resize(_impl->process(src.data(), src.size(), dst.data()));
+}
+
+void fir_decimator::reset()
+{
+    _impl->reset();
+}
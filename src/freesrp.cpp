@@ -37,16 +37,30 @@ namespace FreeSRP {
     void FreeSRP::start_rx(std::function<void(const std::vector<sample> &)> rx_callback) { _impl->start_rx(rx_callback); }
     void FreeSRP::stop_rx() { _impl->stop_rx(); }
     
+    void FreeSRP::set_rx_decimation(unsigned int decimation, double passband) { _impl->set_rx_decimation(decimation, passband); }
+    unsigned int FreeSRP::rx_decimation() const { return _impl->rx_decimation(); }
+    
     void FreeSRP::start_tx(std::function<void(std::vector<sample> &)> tx_callback) { _impl->start_tx(tx_callback); }
+    void FreeSRP::start_tx_raw(std::function<void(unsigned char *, size_t)> tx_fill) { _impl->start_tx_raw(tx_fill); }
     void FreeSRP::stop_tx() { _impl->stop_tx(); }
     
     unsigned long FreeSRP::available_rx_samples() {return _impl->available_rx_samples(); }
     bool FreeSRP::get_rx_sample(sample &s) { return _impl->get_rx_sample(s); }
     
     bool FreeSRP::submit_tx_sample(sample &s) { return _impl->submit_tx_sample(s); }
+    stream_statistics FreeSRP::stream_stats() const { return _impl->stream_stats(); }
+    latency_statistics FreeSRP::latency_stats() const { return _impl->latency_stats(); }
+    void FreeSRP::dump_latency_stats(std::ostream &o) const { _impl->dump_latency_stats(o); }
     
     command FreeSRP::make_command(command_id id, double param) const { return _impl->make_command(id, param); }
-    response FreeSRP::send_cmd(command c) const { return _impl->send_cmd(c); }
+    response FreeSRP::send_cmd(command c, bool read_from_device) const { return _impl->send_cmd(c, read_from_device); }
+    std::future<response> FreeSRP::send_cmd_async(command c, bool read_from_device) const { return _impl->send_cmd_async(c, read_from_device); }
+    std::vector<response> FreeSRP::send_cmds(const std::vector<command> &cmds, bool read_from_device) const { return _impl->send_cmds(cmds, read_from_device); }
+    radio_config_result FreeSRP::apply(const radio_config &config) const { return _impl->apply(config); }
+
+    void FreeSRP::start_hopping(const std::vector<hop> &hops, std::chrono::microseconds dwell, unsigned long count) { _impl->start_hopping(hops, dwell, count); }
+    bool FreeSRP::hopping() const { return _impl->hopping(); }
+    hop_report FreeSRP::stop_hopping() { return _impl->stop_hopping(); }
     
     freesrp_version FreeSRP::version() { return _impl->version(); }
     
@@ -18,22 +18,39 @@
  */
 
 #include "freesrp_impl.hpp"
+#include "codec.hpp"
+#include "trace.hpp"
+#include "logger.hpp"
 #include <freesrp.hpp>
 
 #include <cstring>
+#include <cmath>
+#include <cstdlib>
 #include <fstream>
+#include <deque>
+#include <algorithm>
+#include <iomanip>
 
 #define FREESRP_SERIAL_DSCR_INDEX 3
 #define MAX_SERIAL_LENGTH 256
 
 using namespace FreeSRP;
 
-moodycamel::ReaderWriterQueue<sample> FreeSRP::FreeSRP::impl::_rx_buf(FREESRP_RX_TX_QUEUE_SIZE);
-moodycamel::ReaderWriterQueue<sample> FreeSRP::FreeSRP::impl::_tx_buf(FREESRP_RX_TX_QUEUE_SIZE);
-std::vector<sample> FreeSRP::FreeSRP::impl::_rx_decoder_buf(FREESRP_RX_TX_BUF_SIZE / FREESRP_BYTES_PER_SAMPLE);
-std::function<void(const std::vector<sample> &)> FreeSRP::FreeSRP::impl::_rx_custom_callback;
-std::vector<sample> FreeSRP::FreeSRP::impl::_tx_encoder_buf(FREESRP_RX_TX_BUF_SIZE / FREESRP_BYTES_PER_SAMPLE);
-std::function<void(std::vector<sample> &)> FreeSRP::FreeSRP::impl::_tx_custom_callback;
+moodycamel::ReaderWriterQueue<sample> FreeSRP::data_path::_rx_buf(FREESRP_RX_TX_QUEUE_SIZE);
+moodycamel::ReaderWriterQueue<sample> FreeSRP::data_path::_tx_buf(FREESRP_RX_TX_QUEUE_SIZE);
+std::vector<sample> FreeSRP::data_path::_rx_decoder_buf(FREESRP_RX_TX_BUF_SIZE / FREESRP_BYTES_PER_SAMPLE);
+std::unique_ptr<FreeSRP::fir_decimator> FreeSRP::data_path::_rx_decimator;
+std::vector<sample> FreeSRP::data_path::_rx_decimator_buf;
+std::atomic<unsigned long long> FreeSRP::data_path::_rx_delivered{0};
+std::function<void(const std::vector<sample> &)> FreeSRP::data_path::_rx_custom_callback;
+std::vector<sample> FreeSRP::data_path::_tx_encoder_buf(FREESRP_RX_TX_BUF_SIZE / FREESRP_BYTES_PER_SAMPLE);
+std::function<void(std::vector<sample> &)> FreeSRP::data_path::_tx_custom_callback;
+std::function<void(unsigned char *, size_t)> FreeSRP::data_path::_tx_raw_callback;
+FreeSRP::live_stream_counters FreeSRP::data_path::_rx_stats;
+FreeSRP::live_stream_counters FreeSRP::data_path::_tx_stats;
+FreeSRP::live_stream_latency FreeSRP::data_path::_rx_latency;
+FreeSRP::live_stream_latency FreeSRP::data_path::_tx_latency;
+int (*FreeSRP::data_path::_submit_transfer)(libusb_transfer *) = libusb_submit_transfer;
 
 FreeSRP::FreeSRP::impl::impl(std::string serial_number)
 {
@@ -46,7 +63,7 @@ FreeSRP::FreeSRP::impl::impl(std::string serial_number)
     }
 
     // Set verbosity level
-    libusb_set_debug(_ctx, 3);
+    libusb_set_debug(_ctx, logger::get().libusb_debug_level());
 
     // Retrieve device list
     int num_devs = (int) libusb_get_device_list(_ctx, &devs);
@@ -153,10 +170,24 @@ FreeSRP::FreeSRP::impl::impl(std::string serial_number)
 
 FreeSRP::FreeSRP::impl::~impl()
 {
+    if(_hop_worker != nullptr)
+    {
+        stop_hopping();
+    }
+
     // TODO: Properly stop all active transfers
     stop_rx();
     stop_tx();
 
+    {
+        // Give up on commands still waiting for a response
+        std::lock_guard<std::mutex> lock(_cmd_mutex);
+        for(libusb_transfer *transfer : _cmd_in_transfers)
+        {
+            libusb_cancel_transfer(transfer);
+        }
+    }
+
     if(_freesrp_handle != nullptr)
     {
         libusb_release_interface(_freesrp_handle, 0);
@@ -175,11 +206,13 @@ FreeSRP::FreeSRP::impl::~impl()
 
     for(libusb_transfer *transfer : _rx_transfers)
     {
+        delete (data_transfer_info *) transfer->user_data;
         libusb_free_transfer(transfer);
     }
 
     for(libusb_transfer *transfer : _tx_transfers)
     {
+        delete (data_transfer_info *) transfer->user_data;
         libusb_free_transfer(transfer);
     }
 
@@ -203,7 +236,7 @@ std::vector<std::string> FreeSRP::FreeSRP::impl::list_connected()
     }
 
     // Set verbosity level
-    libusb_set_debug(list_ctx, 3);
+    libusb_set_debug(list_ctx, logger::get().libusb_debug_level());
 
     // Retrieve device list
     int num_devs = (int) libusb_get_device_list(list_ctx, &devs);
@@ -272,6 +305,9 @@ fpga_status FreeSRP::FreeSRP::impl::load_fpga(std::string filename)
         return FPGA_CONFIG_SKIPPED;
     }
 
+    // The FreeSRP's settings are reset along with the FPGA
+    invalidate_settings_cache();
+
     // Open ifstream for FPGA config file
     std::ifstream stream;
     stream.exceptions(std::ios::failbit | std::ios::badbit);
@@ -364,7 +400,7 @@ libusb_transfer *FreeSRP::FreeSRP::impl::create_rx_transfer(libusb_transfer_cb_f
 {
     libusb_transfer *transfer = libusb_alloc_transfer(0);
     unsigned char *buf = new unsigned char[FREESRP_RX_TX_BUF_SIZE];
-    libusb_fill_bulk_transfer(transfer, _freesrp_handle, FREESRP_RX_IN, buf, FREESRP_RX_TX_BUF_SIZE, callback, nullptr, FREESRP_USB_TIMEOUT);
+    libusb_fill_bulk_transfer(transfer, _freesrp_handle, FREESRP_RX_IN, buf, FREESRP_RX_TX_BUF_SIZE, callback, new data_transfer_info{0}, FREESRP_USB_TIMEOUT);
 
     return transfer;
 }
@@ -373,63 +409,113 @@ libusb_transfer *FreeSRP::FreeSRP::impl::create_tx_transfer(libusb_transfer_cb_f
 {
     libusb_transfer *transfer = libusb_alloc_transfer(0);
     unsigned char *buf = new unsigned char[FREESRP_TX_BUF_SIZE];
-    libusb_fill_bulk_transfer(transfer, _freesrp_handle, FREESRP_TX_OUT, buf, FREESRP_TX_BUF_SIZE, callback, nullptr, FREESRP_USB_TIMEOUT);
+    libusb_fill_bulk_transfer(transfer, _freesrp_handle, FREESRP_TX_OUT, buf, FREESRP_TX_BUF_SIZE, callback, new data_transfer_info{0}, FREESRP_USB_TIMEOUT);
     //TODO: transfer size
     return transfer;
 }
 
-void FreeSRP::FreeSRP::impl::rx_callback(libusb_transfer *transfer)
+void FreeSRP::data_path::rx_callback(libusb_transfer *transfer)
 {
+    long long start_ns = monotonic_ns();
+    FREESRP_TRACE3(transfer_complete, transfer->endpoint, transfer->status, transfer->actual_length);
+
+    long long interval_ns = _rx_stats.record_transfer(transfer, start_ns);
+    if(interval_ns > 0)
+    {
+        _rx_latency.interval.record(interval_ns);
+    }
+
     if(transfer->status == LIBUSB_TRANSFER_COMPLETED)
     {
         // Transfer succeeded
-
-        // Decode samples from transfer buffer into _rx_decoder_buf
-        decode_rx_transfer(transfer->buffer, transfer->actual_length, _rx_decoder_buf);
-
-        if(_rx_custom_callback)
-        {
-            // Run the callback function
-            _rx_custom_callback(_rx_decoder_buf);
-        }
-        else
-        {
-            // No callback function specified, add samples to queue
-            for(sample s : _rx_decoder_buf)
-            {
-                bool success = _rx_buf.try_enqueue(s);
-                if(!success)
-                {
-                    // TODO: overflow! handle this
-                }
-            }
-        }
+        _rx_latency.transfer.record(start_ns - ((data_transfer_info *) transfer->user_data)->submitted_ns);
+        handle_rx_data(transfer->buffer, transfer->actual_length);
     }
-    else
+    else if(transfer->status != LIBUSB_TRANSFER_CANCELLED)
     {
         // TODO: Handle error
+        logger::get().log(LOG_LEVEL_WARNING, "RX transfer error with status %d", (int) transfer->status);
     }
 
     // Resubmit the transfer
     if(transfer->status != LIBUSB_TRANSFER_CANCELLED)
     {
-        int ret = libusb_submit_transfer(transfer);
+        int ret = submit_data_transfer(transfer);
 
         if(ret < 0)
         {
             // TODO: Handle error
+            logger::get().log(LOG_LEVEL_ERROR, "RX transfer submission error %d", ret);
         }
     }
+
+    _rx_latency.handler.record(monotonic_ns() - start_ns);
 }
 
-void FreeSRP::FreeSRP::impl::tx_callback(libusb_transfer* transfer)
+void FreeSRP::data_path::handle_rx_data(unsigned char *buffer, int actual_length)
 {
+    // Decode samples from transfer buffer into _rx_decoder_buf
+    decode_rx_transfer(buffer, actual_length, _rx_decoder_buf);
+
+    // Decimate before delivery, so the callback or queue only handles the samples the application asked for
+    const std::vector<sample> *samples = &_rx_decoder_buf;
+    if(_rx_decimator)
+    {
+        _rx_decimator->process(_rx_decoder_buf, _rx_decimator_buf);
+        samples = &_rx_decimator_buf;
+    }
+    _rx_delivered.fetch_add(samples->size(), std::memory_order_relaxed);
+
+    if(_rx_custom_callback)
+    {
+        // Run the callback function
+        long long callback_start_ns = monotonic_ns();
+        FREESRP_TRACE1(rx_callback_begin, samples->size());
+        _rx_custom_callback(*samples);
+        FREESRP_TRACE1(rx_callback_end, samples->size());
+        _rx_latency.callback.record(monotonic_ns() - callback_start_ns);
+    }
+    else
+    {
+        // No callback function specified, add samples to queue
+        unsigned long long dropped = 0;
+        for(sample s : *samples)
+        {
+            bool success = _rx_buf.try_enqueue(s);
+            if(!success)
+            {
+                // Overflow, the application is not reading samples fast enough
+                dropped++;
+            }
+        }
+
+        if(dropped > 0)
+        {
+            FREESRP_TRACE1(rx_queue_full, dropped);
+            _rx_stats.overflows.fetch_add(dropped, std::memory_order_relaxed);
+        }
+        _rx_stats.record_queue_level(_rx_buf.size_approx());
+    }
+}
+
+void FreeSRP::data_path::tx_callback(libusb_transfer* transfer)
+{
+    long long start_ns = monotonic_ns();
+    FREESRP_TRACE3(transfer_complete, transfer->endpoint, transfer->status, transfer->actual_length);
+
+    long long interval_ns = _tx_stats.record_transfer(transfer, start_ns);
+    if(interval_ns > 0)
+    {
+        _tx_latency.interval.record(interval_ns);
+    }
+
     if(transfer->status == LIBUSB_TRANSFER_COMPLETED)
     {
         // Success
+        _tx_latency.transfer.record(start_ns - ((data_transfer_info *) transfer->user_data)->submitted_ns);
         if(transfer->actual_length != transfer->length)
         {
-            std::cout << "actual length != length: " << transfer->actual_length << "; " << transfer->length << std::endl;
+            logger::get().log(LOG_LEVEL_WARNING, "TX transfer incomplete, sent %d of %d bytes", transfer->actual_length, transfer->length);
         }
     }
     else
@@ -437,7 +523,7 @@ void FreeSRP::FreeSRP::impl::tx_callback(libusb_transfer* transfer)
         // TODO: Handle error
         if(transfer->status != LIBUSB_TRANSFER_CANCELLED)
         {
-            std::cerr << "transfer error with status " << transfer->status << std::endl;
+            logger::get().log(LOG_LEVEL_WARNING, "TX transfer error with status %d", (int) transfer->status);
         }
     }
 
@@ -445,23 +531,45 @@ void FreeSRP::FreeSRP::impl::tx_callback(libusb_transfer* transfer)
     if(transfer->status != LIBUSB_TRANSFER_CANCELLED)
     {
         fill_tx_transfer(transfer);
-        int ret = libusb_submit_transfer(transfer);
+        int ret = submit_data_transfer(transfer);
 
         if(ret < 0)
         {
             // TODO: Handle error
-            std::cerr << "transfer submission error with status " << transfer->status << std::endl;
+            logger::get().log(LOG_LEVEL_ERROR, "TX transfer submission error %d", ret);
         }
     }
+
+    _tx_latency.handler.record(monotonic_ns() - start_ns);
+}
+
+int FreeSRP::data_path::submit_data_transfer(libusb_transfer *transfer)
+{
+    ((data_transfer_info *) transfer->user_data)->submitted_ns = monotonic_ns();
+    FREESRP_TRACE2(transfer_submit, transfer->endpoint, transfer->length);
+    return _submit_transfer(transfer);
 }
 
 void FreeSRP::FreeSRP::impl::start_rx(std::function<void(const std::vector<sample> &)> rx_callback)
 {
     _rx_custom_callback = rx_callback;
+    _rx_stats.reset();
+    _rx_latency.reset();
+    _rx_delivered.store(0, std::memory_order_relaxed);
+
+    if(_rx_decimation > 1)
+    {
+        _rx_decimator.reset(new fir_decimator(_rx_decimation, _rx_passband));
+        _rx_decimator_buf.reserve(_rx_decoder_buf.capacity() / _rx_decimation + 1);
+    }
+    else
+    {
+        _rx_decimator.reset();
+    }
 
     for(libusb_transfer *transfer: _rx_transfers)
     {
-        int ret = libusb_submit_transfer(transfer);
+        int ret = submit_data_transfer(transfer);
 
         if(ret < 0)
         {
@@ -487,9 +595,45 @@ void FreeSRP::FreeSRP::impl::stop_rx()
     }
 }
 
+void FreeSRP::FreeSRP::impl::set_rx_decimation(unsigned int decimation, double passband)
+{
+    if(decimation == 0)
+    {
+        throw std::runtime_error("set_rx_decimation error: decimation must be at least 1");
+    }
+    if(decimation > 1)
+    {
+        // Fail now rather than in start_rx if the filter cannot be designed
+        design_decimation_filter(decimation, passband);
+    }
+
+    _rx_decimation = decimation;
+    _rx_passband = passband;
+}
+
+void FreeSRP::FreeSRP::impl::start_tx_raw(std::function<void(unsigned char *, size_t)> tx_fill)
+{
+    if(!tx_fill)
+    {
+        throw std::runtime_error("start_tx_raw error: no fill function specified");
+    }
+
+    _tx_custom_callback = {};
+    _tx_raw_callback = tx_fill;
+    submit_tx_transfers();
+}
+
 void FreeSRP::FreeSRP::impl::start_tx(std::function<void(std::vector<sample> &)> tx_callback)
 {
     _tx_custom_callback = tx_callback;
+    _tx_raw_callback = {};
+    submit_tx_transfers();
+}
+
+void FreeSRP::FreeSRP::impl::submit_tx_transfers()
+{
+    _tx_stats.reset();
+    _tx_latency.reset();
 
     // Fill the tx buffer with empty samples
     sample empty_sample{0, 0};
@@ -498,7 +642,7 @@ void FreeSRP::FreeSRP::impl::start_tx(std::function<void(std::vector<sample> &)>
     for(libusb_transfer *transfer: _tx_transfers)
     {
         fill_tx_transfer(transfer);
-        int ret = libusb_submit_transfer(transfer);
+        int ret = submit_data_transfer(transfer);
 
         if(ret < 0)
         {
@@ -524,105 +668,70 @@ void FreeSRP::FreeSRP::impl::stop_tx()
     }
 }
 
-int FreeSRP::FreeSRP::impl::fill_tx_transfer(libusb_transfer* transfer)
+int FreeSRP::data_path::fill_tx_transfer(libusb_transfer* transfer)
 {
     // Fill the transfer buffer with available samples
     transfer->length = FREESRP_TX_BUF_SIZE;
 
+    if(_tx_raw_callback)
+    {
+        // The samples are already in the wire format, written straight into the transfer
+        long long callback_start_ns = monotonic_ns();
+        FREESRP_TRACE1(tx_callback_begin, transfer->length / FREESRP_BYTES_PER_SAMPLE);
+        _tx_raw_callback(transfer->buffer, transfer->length / FREESRP_BYTES_PER_SAMPLE);
+        FREESRP_TRACE1(tx_callback_end, transfer->length / FREESRP_BYTES_PER_SAMPLE);
+        _tx_latency.callback.record(monotonic_ns() - callback_start_ns);
+        return transfer->length;
+    }
+
     _tx_encoder_buf.resize(transfer->length/FREESRP_BYTES_PER_SAMPLE);
 
     if(_tx_custom_callback)
     {
+        long long callback_start_ns = monotonic_ns();
+        FREESRP_TRACE1(tx_callback_begin, _tx_encoder_buf.size());
         _tx_custom_callback(_tx_encoder_buf);
+        FREESRP_TRACE1(tx_callback_end, _tx_encoder_buf.size());
+        _tx_latency.callback.record(monotonic_ns() - callback_start_ns);
     }
     else
     {
+        _tx_stats.record_queue_level(_tx_buf.size_approx());
+
+        unsigned long long missing = 0;
         for(sample &s : _tx_encoder_buf)
         {
             int success = _tx_buf.try_dequeue(s);
             if(!success)
             {
-                // TODO: Notify of this? Do something else?
                 // No data available, fill with zeros
                 s.i = 0;
                 s.q = 0;
+                missing++;
             }
         }
-    }
-
-    for(int i = 0; i < transfer->length; i+=FREESRP_BYTES_PER_SAMPLE)
-    {
-        // SKIP THIS: Convert -1.0 to 1.0 float sample value to signed 16-bit int with range -2048 to 2048
-        int16_t signed_i = _tx_encoder_buf[i/FREESRP_BYTES_PER_SAMPLE].i;
-        int16_t signed_q = _tx_encoder_buf[i/FREESRP_BYTES_PER_SAMPLE].q;
-
-        // Unsigned 16-bit ints holding the two's-complement 12-bit sample values
-        uint16_t raw_i;
-        uint16_t raw_q;
 
-        if(signed_i >= 0)
-        {
-            raw_i = (uint16_t) signed_i;
-        }
-        else
+        if(missing > 0)
         {
-            raw_i = (((uint16_t) (-signed_i)) ^ ((uint16_t) 0xFFF)) + (uint16_t) 1;
+            FREESRP_TRACE1(tx_queue_empty, missing);
+            _tx_stats.underflows.fetch_add(missing, std::memory_order_relaxed);
         }
-
-        if(signed_q >= 0)
-        {
-            raw_q = (uint16_t) signed_q;
-        }
-        else
-        {
-            raw_q = (((uint16_t) (-signed_q)) ^ ((uint16_t) 0xFFF)) + (uint16_t) 1;
-        }
-
-        // Copy raw i/q data into the buffer
-        memcpy(transfer->buffer + i, &raw_q, sizeof(raw_q));
-        memcpy(transfer->buffer + i + sizeof(raw_q), &raw_i, sizeof(raw_i));
     }
 
+    FREESRP_TRACE1(encode_begin, _tx_encoder_buf.size());
+    encode_samples(_tx_encoder_buf.data(), transfer->buffer, _tx_encoder_buf.size());
+    FREESRP_TRACE1(encode_end, transfer->length);
+
     return transfer->length;
 }
 
-void FreeSRP::FreeSRP::impl::decode_rx_transfer(unsigned char *buffer, int actual_length, std::vector<sample> &destination)
+void FreeSRP::data_path::decode_rx_transfer(unsigned char *buffer, int actual_length, std::vector<sample> &destination)
 {
     destination.resize(actual_length/FREESRP_BYTES_PER_SAMPLE);
 
-    for(int i = 0; i < actual_length; i+=FREESRP_BYTES_PER_SAMPLE)
-    {
-        uint16_t raw_i;
-        uint16_t raw_q;
-        memcpy(&raw_q, buffer+i, sizeof(raw_q));
-        memcpy(&raw_i, buffer+i+sizeof(raw_q), sizeof(raw_i));
-
-        // Convert the raw I/Q values from 12-bit (two's complement) to 16-bit signed integers
-        int16_t signed_i;
-        int16_t signed_q;
-        // Do sign extension
-        bool i_negative = (raw_i & (1 << 11))!=0;
-        bool q_negative = (raw_q & (1 << 11))!=0;
-        if (i_negative)
-        {
-            signed_i = (int16_t) (raw_i | ~((1 << 11)-1));
-        }
-        else
-        {
-            signed_i = raw_i;
-        }
-        if (q_negative)
-        {
-            signed_q = (int16_t) (raw_q | ~((1 << 11)-1));
-        }
-        else
-        {
-            signed_q = raw_q;
-        }
-
-        destination[i/FREESRP_BYTES_PER_SAMPLE].i = signed_i;
-        destination[i/FREESRP_BYTES_PER_SAMPLE].q = signed_q;
-    }
+    FREESRP_TRACE1(decode_begin, actual_length);
+    decode_samples(buffer, destination.data(), destination.size());
+    FREESRP_TRACE1(decode_end, destination.size());
 }
 
 void FreeSRP::FreeSRP::impl::run_rx_tx()
@@ -648,6 +757,255 @@ bool FreeSRP::FreeSRP::impl::submit_tx_sample(sample &s)
     return _tx_buf.try_enqueue(s);
 }
 
+FreeSRP::latency_statistics FreeSRP::FreeSRP::impl::latency_stats() const
+{
+    latency_statistics stats;
+    stats.rx = _rx_latency.snapshot();
+    stats.tx = _tx_latency.snapshot();
+    return stats;
+}
+
+void FreeSRP::FreeSRP::impl::dump_latency_stats(std::ostream &o) const
+{
+    latency_statistics stats = latency_stats();
+
+    const std::pair<const char *, const stream_latency *> streams[] = {{"RX", &stats.rx}, {"TX", &stats.tx}};
+    for(const std::pair<const char *, const stream_latency *> &stream : streams)
+    {
+        o << stream.first << " completion interval: " << stream.second->interval;
+        o << stream.first << " event thread handler: " << stream.second->handler;
+        o << stream.first << " user callback: " << stream.second->callback;
+        o << stream.first << " submit to complete: " << stream.second->transfer;
+    }
+}
+
+FreeSRP::stream_statistics FreeSRP::FreeSRP::impl::stream_stats() const
+{
+    stream_statistics stats;
+    stats.rx = _rx_stats.snapshot();
+    stats.tx = _tx_stats.snapshot();
+    return stats;
+}
+
+void FreeSRP::live_stream_counters::reset()
+{
+    samples.store(0, std::memory_order_relaxed);
+    bytes.store(0, std::memory_order_relaxed);
+    transfers_completed.store(0, std::memory_order_relaxed);
+    transfers_failed.store(0, std::memory_order_relaxed);
+    transfers_cancelled.store(0, std::memory_order_relaxed);
+    transfers_short.store(0, std::memory_order_relaxed);
+    overflows.store(0, std::memory_order_relaxed);
+    underflows.store(0, std::memory_order_relaxed);
+    queue_high_water.store(0, std::memory_order_relaxed);
+    rate.store(0, std::memory_order_relaxed);
+    rate_ewma.store(0, std::memory_order_relaxed);
+    last_completion_ns.store(0, std::memory_order_relaxed);
+}
+
+long long FreeSRP::live_stream_counters::record_transfer(const libusb_transfer *transfer, long long now_ns)
+{
+    if(transfer->status == LIBUSB_TRANSFER_CANCELLED)
+    {
+        transfers_cancelled.fetch_add(1, std::memory_order_relaxed);
+        return 0;
+    }
+    else if(transfer->status != LIBUSB_TRANSFER_COMPLETED)
+    {
+        transfers_failed.fetch_add(1, std::memory_order_relaxed);
+        return 0;
+    }
+
+    unsigned long long transfer_samples = (unsigned long long) transfer->actual_length / FREESRP_BYTES_PER_SAMPLE;
+
+    transfers_completed.fetch_add(1, std::memory_order_relaxed);
+    samples.fetch_add(transfer_samples, std::memory_order_relaxed);
+    bytes.fetch_add((unsigned long long) transfer->actual_length, std::memory_order_relaxed);
+    if(transfer->actual_length != transfer->length)
+    {
+        transfers_short.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Rate from the time since the previous completion, and its average with a one second time constant
+    long long previous = last_completion_ns.exchange(now_ns, std::memory_order_relaxed);
+    if(previous == 0 || now_ns <= previous)
+    {
+        return 0;
+    }
+
+    double dt = (now_ns - previous) * 1e-9;
+    double instantaneous = transfer_samples / dt;
+    double alpha = 1.0 - std::exp(-dt);
+    double average = rate_ewma.load(std::memory_order_relaxed);
+
+    rate.store(instantaneous, std::memory_order_relaxed);
+    rate_ewma.store(average == 0 ? instantaneous : average + alpha * (instantaneous - average), std::memory_order_relaxed);
+
+    return now_ns - previous;
+}
+
+void FreeSRP::live_stream_counters::record_queue_level(size_t level)
+{
+    if(level > queue_high_water.load(std::memory_order_relaxed))
+    {
+        queue_high_water.store(level, std::memory_order_relaxed);
+    }
+}
+
+FreeSRP::stream_counters FreeSRP::live_stream_counters::snapshot() const
+{
+    stream_counters c;
+    c.samples = samples.load(std::memory_order_relaxed);
+    c.bytes = bytes.load(std::memory_order_relaxed);
+    c.transfers_completed = transfers_completed.load(std::memory_order_relaxed);
+    c.transfers_failed = transfers_failed.load(std::memory_order_relaxed);
+    c.transfers_cancelled = transfers_cancelled.load(std::memory_order_relaxed);
+    c.transfers_short = transfers_short.load(std::memory_order_relaxed);
+    c.overflows = overflows.load(std::memory_order_relaxed);
+    c.underflows = underflows.load(std::memory_order_relaxed);
+    c.queue_high_water = queue_high_water.load(std::memory_order_relaxed);
+    c.rate = rate.load(std::memory_order_relaxed);
+    c.rate_ewma = rate_ewma.load(std::memory_order_relaxed);
+    return c;
+}
+
+unsigned int FreeSRP::live_histogram::bucket_index(unsigned long long ns)
+{
+    if(ns < sub_buckets)
+    {
+        return (unsigned int) ns;
+    }
+
+    // Position of the most significant bit selects the power of two, the following bits the sub-bucket
+    unsigned int msb = 0;
+    for(unsigned long long v = ns; v > 1; v >>= 1)
+    {
+        msb++;
+    }
+    if(msb >= max_value_bits)
+    {
+        return num_buckets - 1;
+    }
+
+    unsigned int exponent = msb - sub_bucket_bits + 1;
+    return exponent * sub_buckets + (unsigned int) ((ns >> (msb - sub_bucket_bits)) - sub_buckets);
+}
+
+unsigned long long FreeSRP::live_histogram::bucket_lower_bound(unsigned int index)
+{
+    if(index < sub_buckets)
+    {
+        return index;
+    }
+
+    unsigned int exponent = index / sub_buckets;
+    return (unsigned long long) (sub_buckets + index % sub_buckets) << (exponent - 1);
+}
+
+void FreeSRP::live_histogram::record(long long ns)
+{
+    unsigned long long value = ns > 0 ? (unsigned long long) ns : 0;
+
+    _counts[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+    _total.fetch_add(1, std::memory_order_relaxed);
+    _sum_ns.fetch_add(value, std::memory_order_relaxed);
+
+    if(value < _min_ns.load(std::memory_order_relaxed))
+    {
+        _min_ns.store(value, std::memory_order_relaxed);
+    }
+    if(value > _max_ns.load(std::memory_order_relaxed))
+    {
+        _max_ns.store(value, std::memory_order_relaxed);
+    }
+}
+
+void FreeSRP::live_histogram::reset()
+{
+    for(std::atomic<unsigned long long> &count : _counts)
+    {
+        count.store(0, std::memory_order_relaxed);
+    }
+    _total.store(0, std::memory_order_relaxed);
+    _sum_ns.store(0, std::memory_order_relaxed);
+    _min_ns.store(~0ULL, std::memory_order_relaxed);
+    _max_ns.store(0, std::memory_order_relaxed);
+}
+
+FreeSRP::latency_histogram FreeSRP::live_histogram::snapshot() const
+{
+    latency_histogram h;
+    h.total = 0;
+
+    for(unsigned int i = 0; i < num_buckets; i++)
+    {
+        unsigned long long count = _counts[i].load(std::memory_order_relaxed);
+        if(count > 0)
+        {
+            h.buckets.push_back({bucket_lower_bound(i) / 1e3, bucket_lower_bound(i + 1) / 1e3, count});
+            h.total += count;
+        }
+    }
+
+    unsigned long long recorded = _total.load(std::memory_order_relaxed);
+    h.min_us = h.total > 0 ? _min_ns.load(std::memory_order_relaxed) / 1e3 : 0;
+    h.max_us = h.total > 0 ? _max_ns.load(std::memory_order_relaxed) / 1e3 : 0;
+    h.mean_us = recorded > 0 ? _sum_ns.load(std::memory_order_relaxed) / 1e3 / recorded : 0;
+    return h;
+}
+
+void FreeSRP::live_stream_latency::reset()
+{
+    interval.reset();
+    handler.reset();
+    callback.reset();
+    transfer.reset();
+}
+
+FreeSRP::stream_latency FreeSRP::live_stream_latency::snapshot() const
+{
+    stream_latency l;
+    l.interval = interval.snapshot();
+    l.handler = handler.snapshot();
+    l.callback = callback.snapshot();
+    l.transfer = transfer.snapshot();
+    return l;
+}
+
+double FreeSRP::latency_histogram::percentile(double p) const
+{
+    double threshold = p / 100.0 * total;
+    unsigned long long seen = 0;
+    for(const latency_bucket &b : buckets)
+    {
+        seen += b.count;
+        if(seen >= threshold)
+        {
+            return std::min(b.upper_us, max_us);
+        }
+    }
+    return max_us;
+}
+
+std::ostream &FreeSRP::operator<<(std::ostream &o, const latency_histogram &h)
+{
+    std::ios::fmtflags flags = o.flags();
+    std::streamsize precision = o.precision();
+
+    o << std::fixed << std::setprecision(1) << h.total << " values, min " << h.min_us << " us, mean " << h.mean_us
+      << " us, p50 " << h.percentile(50) << " us, p99 " << h.percentile(99) << " us, p99.9 " << h.percentile(99.9)
+      << " us, max " << h.max_us << " us" << std::endl;
+
+    for(const latency_bucket &b : h.buckets)
+    {
+        o << "  " << std::setw(12) << b.lower_us << " - " << std::setw(12) << b.upper_us << " us: " << b.count << std::endl;
+    }
+
+    o.flags(flags);
+    o.precision(precision);
+    return o;
+}
+
 command FreeSRP::FreeSRP::impl::make_command(command_id id, double param) const
 {
     command cmd;
@@ -740,34 +1098,588 @@ command FreeSRP::FreeSRP::impl::make_command(command_id id, double param) const
     return cmd;
 }
 
-response FreeSRP::FreeSRP::impl::send_cmd(command cmd) const
+cmd_buf FreeSRP::FreeSRP::impl::encode_command(const command &cmd)
 {
-    cmd_buf tx_buf{cmd.cmd, 1};
-    memcpy(tx_buf.data() + 2, &cmd.param, sizeof(cmd.param));
+    cmd_buf buf{(unsigned char) cmd.cmd, 1};
+    memcpy(buf.data() + 2, &cmd.param, sizeof(cmd.param));
+    return buf;
+}
 
-    // Interrupt OUT transfer
-    int ret;
-    int transferred;
-    ret = libusb_interrupt_transfer(_freesrp_handle, FREESRP_FPGA_UART_OUT, (unsigned char *) tx_buf.data(), (int) tx_buf.size(), &transferred, FREESRP_USB_TIMEOUT);
+response FreeSRP::FreeSRP::impl::decode_response(const unsigned char *buffer)
+{
+    response res;
+    res.cmd = (command_id)(buffer[0]);
+    res.error = (command_err)(buffer[10]);
+    memcpy(&res.param, buffer + 2, sizeof(res.param));
+    // Responses and RX transfers complete on the event thread in the order they arrived from the FreeSRP
+    res.rx_samples = _rx_delivered.load(std::memory_order_relaxed);
+    return res;
+}
+
+response FreeSRP::FreeSRP::impl::send_cmd(command cmd, bool read_from_device) const
+{
+    if(on_event_thread())
+    {
+        // The response is received on the event thread, so waiting for it there would never return
+        throw std::runtime_error("send_cmd error: cannot wait for a response from within an RX or TX callback");
+    }
+
+    // All commands go through the asynchronous path, where responses are matched to the commands in flight
+    return send_cmd_async(cmd, read_from_device).get();
+}
+
+std::future<response> FreeSRP::FreeSRP::impl::send_cmd_async(command cmd, bool read_from_device) const
+{
+    FREESRP_TRACE3(cmd_request, cmd.cmd, cmd.param, read_from_device);
+
+    response cached;
+    if(!read_from_device && cached_setting(cmd.cmd, cached))
+    {
+        FREESRP_TRACE2(cmd_cached, cached.cmd, cached.param);
+        std::promise<response> ready;
+        ready.set_value(cached);
+        return ready.get_future();
+    }
+
+    return submit_cmd(encode_command(cmd));
+}
+
+std::vector<response> FreeSRP::FreeSRP::impl::send_cmds(const std::vector<command> &cmds, bool read_from_device) const
+{
+    if(on_event_thread())
+    {
+        // The responses are received on the event thread, so waiting for them there would never return
+        throw std::runtime_error("send_cmds error: cannot wait for responses from within an RX or TX callback");
+    }
+
+    std::vector<response> responses;
+    responses.reserve(cmds.size());
+
+    std::deque<std::future<response>> in_flight;
+    for(const command &cmd : cmds)
+    {
+        if(in_flight.size() >= FREESRP_CMD_MAX_IN_FLIGHT)
+        {
+            responses.push_back(in_flight.front().get());
+            in_flight.pop_front();
+        }
+
+        in_flight.push_back(send_cmd_async(cmd, read_from_device));
+    }
+
+    while(!in_flight.empty())
+    {
+        responses.push_back(in_flight.front().get());
+        in_flight.pop_front();
+    }
+
+    return responses;
+}
+
+radio_config_result FreeSRP::FreeSRP::impl::apply(const radio_config &config) const
+{
+    enum field_index { RX_FIR, RX_SAMP, RX_BW, RX_LO, RX_GC, RX_GAIN, TX_FIR, TX_SAMP, TX_BW, TX_LO, TX_ATTEN, NUM_FIELDS };
+
+    struct config_field
+    {
+        config_value radio_config::*value;
+        config_result radio_config_result::*result;
+        command_id id;
+        unsigned int param_bytes;   // Width of the parameter, the FreeSRP does not define the bytes above it
+        unsigned int depends_on;    // Mask of the fields that must be resent first when they change
+    };
+
+    // The FIR must be configured before the sample rate, and the gain control mode before the gain
+    const config_field fields[NUM_FIELDS] = {
+        {&radio_config::rx_fir_en, &radio_config_result::rx_fir_en, SET_RX_FIR_EN, 1, 0},
+        {&radio_config::rx_samp_freq, &radio_config_result::rx_samp_freq, SET_RX_SAMP_FREQ, 4, 1 << RX_FIR},
+        {&radio_config::rx_rf_bandwidth, &radio_config_result::rx_rf_bandwidth, SET_RX_RF_BANDWIDTH, 4, 1 << RX_FIR | 1 << RX_SAMP},
+        {&radio_config::rx_lo_freq, &radio_config_result::rx_lo_freq, SET_RX_LO_FREQ, 8, 1 << RX_FIR | 1 << RX_SAMP},
+        {&radio_config::rx_gc_mode, &radio_config_result::rx_gc_mode, SET_RX_GC_MODE, 1, 0},
+        {&radio_config::rx_rf_gain, &radio_config_result::rx_rf_gain, SET_RX_RF_GAIN, 4, 1 << RX_GC},
+        {&radio_config::tx_fir_en, &radio_config_result::tx_fir_en, SET_TX_FIR_EN, 1, 0},
+        {&radio_config::tx_samp_freq, &radio_config_result::tx_samp_freq, SET_TX_SAMP_FREQ, 4, 1 << TX_FIR},
+        {&radio_config::tx_rf_bandwidth, &radio_config_result::tx_rf_bandwidth, SET_TX_RF_BANDWIDTH, 4, 1 << TX_FIR | 1 << TX_SAMP},
+        {&radio_config::tx_lo_freq, &radio_config_result::tx_lo_freq, SET_TX_LO_FREQ, 8, 1 << TX_FIR | 1 << TX_SAMP},
+        {&radio_config::tx_attenuation, &radio_config_result::tx_attenuation, SET_TX_ATTENUATION, 4, 0}
+    };
+
+    radio_config_result result;
+    std::vector<command> cmds;
+    std::vector<const config_field *> sent;
+    unsigned int sent_mask = 0;
+
+    for(unsigned int i = 0; i < NUM_FIELDS; i++)
+    {
+        const config_field &field = fields[i];
+        const config_value &value = config.*field.value;
+        if(!value.set)
+        {
+            continue;
+        }
+
+        command cmd = make_command(field.id, value.value);
+
+        // Each SET_* command directly follows its GET_* counterpart
+        response cached;
+        uint64_t mask = field.param_bytes < 8 ? (1ULL << (8 * field.param_bytes)) - 1 : ~0ULL;
+        if(!(field.depends_on & sent_mask) && cached_setting((command_id) (field.id - 1), cached) && (cached.param & mask) == (cmd.param & mask))
+        {
+            cached.cmd = field.id;
+            (result.*field.result).status = CONFIG_UNCHANGED;
+            (result.*field.result).res = cached;
+            continue;
+        }
+
+        cmds.push_back(cmd);
+        sent.push_back(&field);
+        sent_mask |= 1 << i;
+    }
+
+    std::vector<response> responses = send_cmds(cmds);
+    for(size_t i = 0; i < responses.size(); i++)
+    {
+        config_result &r = result.*(sent[i]->result);
+        r.res = responses[i];
+        if(responses[i].error == CMD_OK)
+        {
+            r.status = CONFIG_APPLIED;
+        }
+        else
+        {
+            r.status = CONFIG_FAILED;
+            result.failed.push_back(responses[i]);
+        }
+    }
+
+    return result;
+}
+
+std::future<response> FreeSRP::FreeSRP::impl::submit_cmd(const cmd_buf &buf) const
+{
+    // Transfers and their buffers are freed by libusb once their callbacks have run
+    libusb_transfer *out_transfer = libusb_alloc_transfer(0);
+    unsigned char *out_buf = (unsigned char *) malloc(FREESRP_UART_BUF_SIZE);
+    memcpy(out_buf, buf.data(), FREESRP_UART_BUF_SIZE);
+
+    // The FreeSRP answers commands in the order it receives them. Holding the submit lock keeps the order of
+    // _pending_cmds identical to the order of the OUT transfers, and keeps each command's OUT/IN pair together.
+    // The event thread only ever takes _cmd_mutex, for as long as it takes to update _pending_cmds.
+    std::lock_guard<std::mutex> submit_lock(_cmd_submit_mutex);
+
+    uint64_t seq;
+    std::future<response> result;
+    {
+        std::lock_guard<std::mutex> lock(_cmd_mutex);
+        seq = _cmd_seq++;
+        _pending_cmds.push_back(pending_cmd{seq, (command_id) buf[0], std::promise<response>(), false});
+        result = _pending_cmds.back().promise.get_future();
+    }
+
+    libusb_fill_interrupt_transfer(out_transfer, _freesrp_handle, FREESRP_FPGA_UART_OUT, out_buf, FREESRP_UART_BUF_SIZE, &FreeSRP::impl::cmd_out_callback, new cmd_out_ctx{this, seq}, FREESRP_USB_TIMEOUT);
+    out_transfer->flags = LIBUSB_TRANSFER_FREE_BUFFER | LIBUSB_TRANSFER_FREE_TRANSFER;
+
+    int ret = libusb_submit_transfer(out_transfer);
     if(ret < 0)
     {
+        {
+            std::lock_guard<std::mutex> lock(_cmd_mutex);
+            _pending_cmds.remove_if([seq](const pending_cmd &p) { return p.seq == seq; });
+        }
+        delete (cmd_out_ctx *) out_transfer->user_data;
+        libusb_free_transfer(out_transfer);
+        invalidate_settings_cache();
         throw ConnectionError("INTERRUPT OUT transfer to UART endpoint failed! error " + std::to_string(ret));
     }
 
-    // Interrupt IN transfer
-    cmd_buf rx_buf{};
-    ret = libusb_interrupt_transfer(_freesrp_handle, FREESRP_FPGA_UART_IN, rx_buf.data(), (int) rx_buf.size(), &transferred, FREESRP_USB_TIMEOUT);
-    if(ret < 0)
+    std::lock_guard<std::mutex> lock(_cmd_mutex);
+
+    // Every response the FreeSRP sends must have an IN transfer waiting for it, otherwise each later response would
+    // be read by the IN transfer of the command after it. If one cannot be posted now, it is posted later.
+    _cmd_in_missing++;
+    post_missing_cmd_ins();
+    if(_cmd_in_missing > 0)
     {
-        throw ConnectionError("INTERRUPT IN transfer from UART endpoint failed! error " + std::to_string(ret));
+        auto it = std::find_if(_pending_cmds.begin(), _pending_cmds.end(), [seq](const pending_cmd &p) { return p.seq == seq; });
+        if(it != _pending_cmds.end())
+        {
+            abandon_cmd(it, "INTERRUPT IN transfer from UART endpoint could not be submitted");
+        }
     }
 
-    response res;
-    res.cmd = (command_id)(rx_buf.data()[0]);
-    res.error = (command_err)(rx_buf.data()[10]);
-    memcpy(&res.param, rx_buf.data() + 2, sizeof(res.param));
+    return result;
+}
 
-    return res;
+bool FreeSRP::FreeSRP::impl::post_cmd_in() const
+{
+    // Must be called with _cmd_mutex held. The transfer and its buffer are freed by libusb once its callback has run.
+    libusb_transfer *in_transfer = libusb_alloc_transfer(0);
+    unsigned char *in_buf = (unsigned char *) malloc(FREESRP_UART_BUF_SIZE);
+
+    libusb_fill_interrupt_transfer(in_transfer, _freesrp_handle, FREESRP_FPGA_UART_IN, in_buf, FREESRP_UART_BUF_SIZE, &FreeSRP::impl::cmd_in_callback, (void *) this, FREESRP_USB_TIMEOUT);
+    in_transfer->flags = LIBUSB_TRANSFER_FREE_BUFFER | LIBUSB_TRANSFER_FREE_TRANSFER;
+
+    if(libusb_submit_transfer(in_transfer) < 0)
+    {
+        libusb_free_transfer(in_transfer);
+        return false;
+    }
+
+    _cmd_in_transfers.push_back(in_transfer);
+    return true;
+}
+
+void FreeSRP::FreeSRP::impl::post_missing_cmd_ins() const
+{
+    // Must be called with _cmd_mutex held
+    while(_cmd_in_missing > 0 && post_cmd_in())
+    {
+        _cmd_in_missing--;
+    }
+}
+
+void FreeSRP::FreeSRP::impl::drop_cmd_in() const
+{
+    // Must be called with _cmd_mutex held. One response fewer is expected, so give up one of the IN transfers.
+    if(_cmd_in_missing > 0)
+    {
+        _cmd_in_missing--;
+    }
+    else if(!_cmd_in_transfers.empty())
+    {
+        libusb_cancel_transfer(_cmd_in_transfers.back());
+    }
+}
+
+bool FreeSRP::FreeSRP::impl::on_event_thread() const
+{
+    return _rx_tx_worker != nullptr && std::this_thread::get_id() == _rx_tx_worker->get_id();
+}
+
+void FreeSRP::FreeSRP::impl::fail_cmd(std::list<pending_cmd>::iterator it, const std::string &msg) const
+{
+    // Must be called with _cmd_mutex held
+    if(!it->abandoned)
+    {
+        invalidate_settings_cache();
+        it->promise.set_exception(std::make_exception_ptr(ConnectionError(msg)));
+    }
+    _pending_cmds.erase(it);
+}
+
+void FreeSRP::FreeSRP::impl::abandon_cmd(std::list<pending_cmd>::iterator it, const std::string &msg) const
+{
+    // Must be called with _cmd_mutex held. The command keeps its place so that a late response is drained by it
+    // instead of being matched to a later command with the same ID.
+    if(!it->abandoned)
+    {
+        invalidate_settings_cache();
+        it->promise.set_exception(std::make_exception_ptr(ConnectionError(msg)));
+        it->abandoned = true;
+    }
+}
+
+void FreeSRP::FreeSRP::impl::cmd_out_callback(libusb_transfer *transfer)
+{
+    cmd_out_ctx *ctx = (cmd_out_ctx *) transfer->user_data;
+    const impl *dev = ctx->dev;
+
+    if(transfer->status != LIBUSB_TRANSFER_COMPLETED)
+    {
+        std::lock_guard<std::mutex> lock(dev->_cmd_mutex);
+
+        auto it = std::find_if(dev->_pending_cmds.begin(), dev->_pending_cmds.end(), [ctx](const pending_cmd &p) { return p.seq == ctx->seq; });
+        if(it != dev->_pending_cmds.end())
+        {
+            dev->fail_cmd(it, "INTERRUPT OUT transfer to UART endpoint failed! status " + std::to_string(transfer->status));
+
+            // No response will arrive for this command
+            dev->drop_cmd_in();
+        }
+    }
+
+    delete ctx;
+}
+
+void FreeSRP::FreeSRP::impl::cmd_in_callback(libusb_transfer *transfer)
+{
+    const impl *dev = (const impl *) transfer->user_data;
+
+    std::lock_guard<std::mutex> lock(dev->_cmd_mutex);
+
+    dev->_cmd_in_transfers.remove(transfer);
+
+    if(transfer->status == LIBUSB_TRANSFER_COMPLETED)
+    {
+        response res = decode_response(transfer->buffer);
+        FREESRP_TRACE3(cmd_response, res.cmd, res.param, res.error);
+
+        // Match the response to the oldest command in flight with the same ID. A late response to an abandoned
+        // command is drained here.
+        auto it = std::find_if(dev->_pending_cmds.begin(), dev->_pending_cmds.end(), [&res](const pending_cmd &p) { return p.cmd == res.cmd; });
+        if(it != dev->_pending_cmds.end())
+        {
+            dev->update_settings_cache(res);
+            if(!it->abandoned)
+            {
+                it->promise.set_value(res);
+            }
+            dev->_pending_cmds.erase(it);
+        }
+
+        dev->post_missing_cmd_ins();
+    }
+    else if(transfer->status != LIBUSB_TRANSFER_CANCELLED && !dev->_pending_cmds.empty())
+    {
+        // The oldest command is the one the FreeSRP has not answered yet. Its response may still arrive, so fail it
+        // to the caller but keep waiting for it once more. If it is already abandoned, give up on it entirely.
+        auto oldest = dev->_pending_cmds.begin();
+        std::string msg = "INTERRUPT IN transfer from UART endpoint failed! status " + std::to_string(transfer->status);
+        if(oldest->abandoned)
+        {
+            dev->fail_cmd(oldest, msg);
+        }
+        else
+        {
+            dev->abandon_cmd(oldest, msg);
+            dev->_cmd_in_missing++;
+        }
+
+        dev->post_missing_cmd_ins();
+    }
+}
+
+void FreeSRP::FreeSRP::impl::start_hopping(const std::vector<hop> &hops, std::chrono::microseconds dwell, unsigned long count)
+{
+    if(_hop_worker != nullptr)
+    {
+        if(_hopping.load())
+        {
+            throw std::runtime_error("start_hopping error: already hopping");
+        }
+
+        // A finite run has finished on its own, reap its thread
+        _hop_worker->join();
+        _hop_worker.reset();
+    }
+
+    if(hops.empty())
+    {
+        throw std::runtime_error("start_hopping error: no hops specified");
+    }
+
+    // Encode every hop up front so that the hopping thread only has to submit transfers
+    std::vector<cmd_buf> encoded;
+    encoded.reserve(hops.size());
+    for(const hop &h : hops)
+    {
+        if(h.cmd != SET_RX_LO_FREQ && h.cmd != SET_TX_LO_FREQ)
+        {
+            throw std::runtime_error("start_hopping error: hops must be SET_RX_LO_FREQ or SET_TX_LO_FREQ commands");
+        }
+
+        encoded.push_back(encode_command(make_command(h.cmd, h.freq)));
+    }
+
+    _hopping.store(true);
+    _hop_worker.reset(new std::thread([this, encoded, dwell, count]() {
+        run_hops(encoded, dwell, count);
+    }));
+}
+
+bool FreeSRP::FreeSRP::impl::hopping() const
+{
+    return _hopping.load();
+}
+
+hop_report FreeSRP::FreeSRP::impl::stop_hopping()
+{
+    if(_hop_worker == nullptr)
+    {
+        return hop_report{};
+    }
+
+    _hopping.store(false);
+    _hop_worker->join();
+    _hop_worker.reset();
+
+    return _hop_report;
+}
+
+void FreeSRP::FreeSRP::impl::run_hops(std::vector<cmd_buf> encoded, std::chrono::microseconds dwell, unsigned long count)
+{
+    typedef std::chrono::steady_clock clock;
+
+    // Fixed-size storage so that the loop never allocates, however long it runs
+    std::unique_ptr<live_histogram> latency(new live_histogram), lateness(new live_histogram);
+    std::vector<double> hop_times(count > 0 && count < FREESRP_HOP_TIMES_SIZE ? count : FREESRP_HOP_TIMES_SIZE);
+    unsigned long hops = 0, failed = 0;
+
+    clock::time_point start = clock::now();
+    clock::time_point scheduled = start;
+
+    while(_hopping.load() && (count == 0 || hops < count))
+    {
+        std::this_thread::sleep_until(scheduled);
+
+        clock::time_point issued = clock::now();
+        try
+        {
+            response res = submit_cmd(encoded[hops % encoded.size()]).get();
+            if(res.error != CMD_OK)
+            {
+                failed++;
+            }
+        }
+        catch(const ConnectionError &e)
+        {
+            failed++;
+        }
+        clock::time_point done = clock::now();
+
+        latency->record(std::chrono::duration_cast<std::chrono::nanoseconds>(done - issued).count());
+        lateness->record(std::chrono::duration_cast<std::chrono::nanoseconds>(done - scheduled).count());
+        hop_times[hops % hop_times.size()] = std::chrono::duration<double>(done - start).count();
+        hops++;
+
+        // If a hop overran its dwell time, schedule the next one from now instead of trying to catch up
+        scheduled += dwell;
+        if(scheduled < done)
+        {
+            scheduled = done;
+        }
+    }
+
+    // Put the most recent hop times back in chronological order
+    if(hops > hop_times.size())
+    {
+        std::rotate(hop_times.begin(), hop_times.begin() + hops % hop_times.size(), hop_times.end());
+    }
+    else
+    {
+        hop_times.resize(hops);
+    }
+
+    _hop_report.hops = hops;
+    _hop_report.failed = failed;
+    _hop_report.latency = timing_percentiles(latency->snapshot());
+    _hop_report.lateness = timing_percentiles(lateness->snapshot());
+    _hop_report.hop_times = std::move(hop_times);
+
+    _hopping.store(false);
+}
+
+hop_timing FreeSRP::FreeSRP::impl::timing_percentiles(const latency_histogram &h)
+{
+    hop_timing timing{};
+    if(h.total == 0)
+    {
+        return timing;
+    }
+
+    timing.p50 = h.percentile(50);
+    timing.p90 = h.percentile(90);
+    timing.p99 = h.percentile(99);
+    timing.max = h.max_us;
+    return timing;
+}
+
+bool FreeSRP::FreeSRP::impl::cached_setting(command_id id, response &res) const
+{
+    switch(id)
+    {
+    case GET_TX_LO_FREQ:
+    case GET_TX_SAMP_FREQ:
+    case GET_TX_RF_BANDWIDTH:
+    case GET_TX_ATTENUATION:
+    case GET_TX_FIR_EN:
+    case GET_RX_LO_FREQ:
+    case GET_RX_SAMP_FREQ:
+    case GET_RX_RF_BANDWIDTH:
+    case GET_RX_GC_MODE:
+    case GET_RX_FIR_EN:
+        break;
+    case GET_RX_RF_GAIN:
+    {
+        // The gain changes on its own unless manual gain control is active
+        std::lock_guard<std::mutex> lock(_settings_mutex);
+        if(!_settings[GET_RX_GC_MODE].valid || _settings[GET_RX_GC_MODE].param != RF_GAIN_MGC)
+        {
+            return false;
+        }
+    }
+        break;
+    default:
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(_settings_mutex);
+    if(!_settings[id].valid)
+    {
+        return false;
+    }
+
+    res.cmd = id;
+    res.param = _settings[id].param;
+    res.error = CMD_OK;
+    res.rx_samples = _rx_delivered.load(std::memory_order_relaxed);
+    return true;
+}
+
+void FreeSRP::FreeSRP::impl::update_settings_cache(const response &res) const
+{
+    if(res.error != CMD_OK)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(_settings_mutex);
+
+    switch(res.cmd)
+    {
+    case SET_TX_SAMP_FREQ:
+    case SET_RX_SAMP_FREQ:
+    case SET_TX_FIR_EN:
+    case SET_RX_FIR_EN:
+        // The AD9364's RX and TX sample rates share one clock chain, and enabling a FIR filter may change it
+        _settings[GET_TX_SAMP_FREQ].valid = false;
+        _settings[GET_RX_SAMP_FREQ].valid = false;
+        // Fall through
+    case SET_TX_LO_FREQ:
+    case SET_TX_RF_BANDWIDTH:
+    case SET_TX_ATTENUATION:
+    case SET_RX_LO_FREQ:
+    case SET_RX_RF_BANDWIDTH:
+    case SET_RX_GC_MODE:
+    case SET_RX_RF_GAIN:
+        // Each SET_* command directly follows its GET_* counterpart
+        _settings[res.cmd - 1] = {true, res.param};
+        break;
+    case GET_TX_LO_FREQ:
+    case GET_TX_SAMP_FREQ:
+    case GET_TX_RF_BANDWIDTH:
+    case GET_TX_ATTENUATION:
+    case GET_TX_FIR_EN:
+    case GET_RX_LO_FREQ:
+    case GET_RX_SAMP_FREQ:
+    case GET_RX_RF_BANDWIDTH:
+    case GET_RX_GC_MODE:
+    case GET_RX_RF_GAIN:
+    case GET_RX_FIR_EN:
+        _settings[res.cmd] = {true, res.param};
+        break;
+    default:
+        break;
+    }
+}
+
+void FreeSRP::FreeSRP::impl::invalidate_settings_cache() const
+{
+    std::lock_guard<std::mutex> lock(_settings_mutex);
+    for(cached_value &setting : _settings)
+    {
+        setting.valid = false;
+    }
 }
 
 freesrp_version FreeSRP::FreeSRP::impl::version()
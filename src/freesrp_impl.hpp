@@ -21,13 +21,129 @@
 #define LIBFREESRP_FREESRP_IMPL_HPP
 
 #include <freesrp.hpp>
+#include <freesrp_dsp.hpp>
 #include "readerwriterqueue/readerwriterqueue.h"
 
 #include <libusb.h>
 
+#include <atomic>
+#include <list>
+#include <mutex>
+
 namespace FreeSRP
 {
-    class FreeSRP::impl
+    // Streaming counters for one direction. They are written by the event thread only, so relaxed atomics suffice.
+    struct live_stream_counters
+    {
+        std::atomic<unsigned long long> samples{0};
+        std::atomic<unsigned long long> bytes{0};
+        std::atomic<unsigned long long> transfers_completed{0};
+        std::atomic<unsigned long long> transfers_failed{0};
+        std::atomic<unsigned long long> transfers_cancelled{0};
+        std::atomic<unsigned long long> transfers_short{0};
+        std::atomic<unsigned long long> overflows{0};
+        std::atomic<unsigned long long> underflows{0};
+        std::atomic<unsigned long long> queue_high_water{0};
+        std::atomic<double> rate{0};
+        std::atomic<double> rate_ewma{0};
+        std::atomic<long long> last_completion_ns{0};
+
+        void reset();
+        long long record_transfer(const libusb_transfer *transfer, long long now_ns);  // Returns the time since the previous completion, or 0
+        void record_queue_level(size_t level);
+        stream_counters snapshot() const;
+    };
+
+    // Log-bucket histogram of durations in nanoseconds, written by the event thread only
+    class live_histogram
+    {
+    public:
+        // Values below 8 ns get their own bucket, above that each power of two is split into 8 buckets
+        static const unsigned int sub_bucket_bits = 3;
+        static const unsigned int sub_buckets = 1 << sub_bucket_bits;
+        static const unsigned int max_value_bits = 40;
+        static const unsigned int num_buckets = (max_value_bits - sub_bucket_bits + 1) * sub_buckets;
+
+        static unsigned int bucket_index(unsigned long long ns);
+        static unsigned long long bucket_lower_bound(unsigned int index);
+
+        void record(long long ns);
+        void reset();
+        latency_histogram snapshot() const;
+
+    private:
+        std::array<std::atomic<unsigned long long>, num_buckets> _counts{};
+        std::atomic<unsigned long long> _total{0};
+        std::atomic<unsigned long long> _sum_ns{0};
+        std::atomic<unsigned long long> _min_ns{~0ULL};
+        std::atomic<unsigned long long> _max_ns{0};
+    };
+
+    struct live_stream_latency
+    {
+        live_histogram interval;
+        live_histogram handler;
+        live_histogram callback;
+        live_histogram transfer;
+
+        void reset();
+        stream_latency snapshot() const;
+    };
+
+    // Attached to RX and TX transfers as their user_data
+    struct data_transfer_info
+    {
+        long long submitted_ns;
+    };
+
+    inline long long monotonic_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // The RX and TX data path, run by the transfer callbacks on the event thread. Its state is static because libusb
+    // calls the callbacks without an object.
+    class data_path
+    {
+        // Runs the data path without a device, see stream_hook.hpp
+        friend struct stream_hook;
+
+    protected:
+        static void rx_callback(libusb_transfer *transfer);
+        static void tx_callback(libusb_transfer *transfer);
+
+        static int submit_data_transfer(libusb_transfer *transfer);
+
+        static void handle_rx_data(unsigned char *buffer, int actual_length);
+
+        static int fill_tx_transfer(libusb_transfer *transfer);
+
+        static void decode_rx_transfer(unsigned char *buffer, int actual_length, std::vector<sample> &destination);
+
+        // libusb_submit_transfer, unless stream_hook has replaced it
+        static int (*_submit_transfer)(libusb_transfer *transfer);
+
+        static std::function<void(const std::vector<sample> &)> _rx_custom_callback;
+        static std::function<void(std::vector<sample> &)> _tx_custom_callback;
+        static std::function<void(unsigned char *, size_t)> _tx_raw_callback;
+
+        static std::vector<sample> _rx_decoder_buf;
+        static std::unique_ptr<fir_decimator> _rx_decimator;
+        static std::vector<sample> _rx_decimator_buf;
+        static std::atomic<unsigned long long> _rx_delivered;
+        static std::vector<sample> _tx_encoder_buf;
+
+        static moodycamel::ReaderWriterQueue<sample> _rx_buf;
+        static moodycamel::ReaderWriterQueue<sample> _tx_buf;
+
+        static live_stream_counters _rx_stats;
+        static live_stream_counters _tx_stats;
+
+        static live_stream_latency _rx_latency;
+        static live_stream_latency _tx_latency;
+    };
+
+    class FreeSRP::impl : private data_path
     {
     public:
         impl(std::string serial_number = "");
@@ -44,7 +160,11 @@ namespace FreeSRP
         void start_rx(std::function<void(const std::vector<sample> &)> rx_callback = {});
         void stop_rx();
 
+        void set_rx_decimation(unsigned int decimation, double passband);
+        unsigned int rx_decimation() const { return _rx_decimation; }
+
         void start_tx(std::function<void(std::vector<sample> &)> tx_callback = {});
+        void start_tx_raw(std::function<void(unsigned char *, size_t)> tx_fill);
         void stop_tx();
 
         unsigned long available_rx_samples();
@@ -52,8 +172,19 @@ namespace FreeSRP
 
         bool submit_tx_sample(sample &s);
 
+        stream_statistics stream_stats() const;
+        latency_statistics latency_stats() const;
+        void dump_latency_stats(std::ostream &o) const;
+
         command make_command(command_id id, double param) const;
-        response send_cmd(command c) const;
+        response send_cmd(command c, bool read_from_device = false) const;
+        std::future<response> send_cmd_async(command c, bool read_from_device = false) const;
+        std::vector<response> send_cmds(const std::vector<command> &cmds, bool read_from_device = false) const;
+        radio_config_result apply(const radio_config &config) const;
+
+        void start_hopping(const std::vector<hop> &hops, std::chrono::microseconds dwell, unsigned long count = 0);
+        bool hopping() const;
+        hop_report stop_hopping();
 
         freesrp_version version();
     private:
@@ -62,12 +193,42 @@ namespace FreeSRP
         libusb_transfer *create_rx_transfer(libusb_transfer_cb_fn callback);
         libusb_transfer *create_tx_transfer(libusb_transfer_cb_fn callback);
 
-        static void rx_callback(libusb_transfer *transfer);
-        static void tx_callback(libusb_transfer *transfer);
+        void submit_tx_transfers();
 
-        static int fill_tx_transfer(libusb_transfer *transfer);
+        static cmd_buf encode_command(const command &cmd);
+        static response decode_response(const unsigned char *buffer);
 
-        static void decode_rx_transfer(unsigned char *buffer, int actual_length, std::vector<sample> &destination);
+        struct pending_cmd
+        {
+            uint64_t seq;
+            command_id cmd;
+            std::promise<response> promise;
+            bool abandoned;     // Already failed to the caller, but the FreeSRP may still answer it
+        };
+
+        struct cmd_out_ctx
+        {
+            const impl *dev;
+            uint64_t seq;
+        };
+
+        std::future<response> submit_cmd(const cmd_buf &buf) const;
+        void fail_cmd(std::list<pending_cmd>::iterator it, const std::string &msg) const;
+        void abandon_cmd(std::list<pending_cmd>::iterator it, const std::string &msg) const;
+        bool post_cmd_in() const;
+        void post_missing_cmd_ins() const;
+        void drop_cmd_in() const;
+        bool on_event_thread() const;
+
+        static void cmd_out_callback(libusb_transfer *transfer);
+        static void cmd_in_callback(libusb_transfer *transfer);
+
+        void run_hops(std::vector<cmd_buf> encoded, std::chrono::microseconds dwell, unsigned long count);
+        static hop_timing timing_percentiles(const latency_histogram &h);
+
+        bool cached_setting(command_id id, response &res) const;
+        void update_settings_cache(const response &res) const;
+        void invalidate_settings_cache() const;
 
         libusb_context *_ctx = nullptr;
         libusb_device_handle *_freesrp_handle = nullptr;
@@ -80,14 +241,31 @@ namespace FreeSRP
         std::array<libusb_transfer *, FREESRP_RX_TX_TRANSFER_QUEUE_SIZE> _rx_transfers;
         std::array<libusb_transfer *, FREESRP_RX_TX_TRANSFER_QUEUE_SIZE> _tx_transfers;
 
-        static std::function<void(const std::vector<sample> &)> _rx_custom_callback;
-        static std::function<void(std::vector<sample> &)> _tx_custom_callback;
+        struct cached_value
+        {
+            bool valid;
+            uint64_t param;
+        };
 
-        static std::vector<sample> _rx_decoder_buf;
-        static std::vector<sample> _tx_encoder_buf;
+        // Shadow copy of the FreeSRP's settings, indexed by the GET_* command ID
+        mutable std::mutex _settings_mutex;
+        mutable std::array<cached_value, SET_LOOPBACK_EN + 1> _settings{};
 
-        static moodycamel::ReaderWriterQueue<sample> _rx_buf;
-        static moodycamel::ReaderWriterQueue<sample> _tx_buf;
+        // Commands in flight, in the order they were sent to the FreeSRP
+        mutable std::mutex _cmd_submit_mutex;
+        mutable std::mutex _cmd_mutex;
+        mutable std::list<pending_cmd> _pending_cmds;
+        mutable std::list<libusb_transfer *> _cmd_in_transfers;
+        mutable unsigned int _cmd_in_missing = 0;  // Responses expected without an IN transfer posted for them
+        mutable uint64_t _cmd_seq = 0;
+
+        std::atomic<bool> _hopping{false};
+        std::unique_ptr<std::thread> _hop_worker;
+        hop_report _hop_report{};
+
+        // Applied by start_rx
+        unsigned int _rx_decimation = 1;
+        double _rx_passband = 0.4;
     };
 }
 
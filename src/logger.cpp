@@ -0,0 +1,228 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "logger.hpp"
+
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <iostream>
+
+using namespace FreeSRP;
+
+static const char *level_name(log_level level)
+{
+    switch(level)
+    {
+    case LOG_LEVEL_DEBUG: return "debug";
+    case LOG_LEVEL_INFO: return "info";
+    case LOG_LEVEL_WARNING: return "warning";
+    case LOG_LEVEL_ERROR: return "error";
+    default: return "log";
+    }
+}
+
+logger &logger::get()
+{
+    static logger instance;
+    return instance;
+}
+
+logger::logger()
+{
+    for(size_t i = 0; i < ring_size; i++)
+    {
+        _ring[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    _thread = std::thread([this]() { run(); });
+}
+
+logger::~logger()
+{
+    _running.store(false);
+    _thread.join();
+}
+
+void logger::log(log_level level, const char *format, ...)
+{
+    if(level < _level.load(std::memory_order_relaxed) || level >= LOG_LEVEL_NONE)
+    {
+        return;
+    }
+
+    if(rate_limited())
+    {
+        _suppressed.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    // Claim a slot, as in Dmitry Vyukov's bounded MPMC queue
+    size_t pos = _enqueue_pos.load(std::memory_order_relaxed);
+    slot *s;
+    while(true)
+    {
+        s = &_ring[pos & (ring_size - 1)];
+        size_t sequence = s->sequence.load(std::memory_order_acquire);
+        long difference = (long) sequence - (long) pos;
+        if(difference == 0)
+        {
+            if(_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if(difference < 0)
+        {
+            // Ring full, the background thread is behind
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        else
+        {
+            pos = _enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    s->level = level;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(s->text, message_size, format, args);
+    va_end(args);
+
+    s->sequence.store(pos + 1, std::memory_order_release);
+}
+
+bool logger::rate_limited()
+{
+    unsigned int limit = _rate_limit.load(std::memory_order_relaxed);
+    if(limit == 0)
+    {
+        return false;
+    }
+
+    long long now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    long long window_start = _window_start_ns.load(std::memory_order_relaxed);
+    if(now - window_start >= 1000000000LL && _window_start_ns.compare_exchange_strong(window_start, now, std::memory_order_relaxed))
+    {
+        _window_count.store(0, std::memory_order_relaxed);
+    }
+
+    return _window_count.fetch_add(1, std::memory_order_relaxed) >= limit;
+}
+
+bool logger::pop(log_level &level, std::string &text)
+{
+    slot &s = _ring[_dequeue_pos & (ring_size - 1)];
+    if(s.sequence.load(std::memory_order_acquire) != _dequeue_pos + 1)
+    {
+        return false;
+    }
+
+    level = s.level;
+    text = s.text;
+
+    s.sequence.store(_dequeue_pos + ring_size, std::memory_order_release);
+    _dequeue_pos++;
+    return true;
+}
+
+void logger::deliver(log_level level, const std::string &text)
+{
+    std::lock_guard<std::mutex> lock(_sink_mutex);
+    if(_sink)
+    {
+        _sink(level, text);
+    }
+    else
+    {
+        std::cerr << "libfreesrp " << level_name(level) << ": " << text << std::endl;
+    }
+}
+
+void logger::run()
+{
+    log_level level;
+    std::string text;
+
+    bool running = true;
+    while(running)
+    {
+        // Drain once more after being stopped
+        running = _running.load();
+
+        while(pop(level, text))
+        {
+            deliver(level, text);
+        }
+
+        unsigned long suppressed = _suppressed.exchange(0, std::memory_order_relaxed);
+        if(suppressed > 0)
+        {
+            deliver(LOG_LEVEL_WARNING, std::to_string(suppressed) + " log messages suppressed by the rate limit");
+        }
+
+        unsigned long dropped = _dropped.exchange(0, std::memory_order_relaxed);
+        if(dropped > 0)
+        {
+            deliver(LOG_LEVEL_WARNING, std::to_string(dropped) + " log messages dropped, the log buffer was full");
+        }
+
+        if(running)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+    }
+}
+
+void logger::set_level(log_level level)
+{
+    _level.store(level);
+}
+
+void logger::set_rate_limit(unsigned int messages_per_second)
+{
+    _rate_limit.store(messages_per_second);
+}
+
+void logger::set_sink(std::function<void(log_level, const std::string &)> sink)
+{
+    std::lock_guard<std::mutex> lock(_sink_mutex);
+    _sink = sink;
+}
+
+void FreeSRP::set_log_level(log_level level)
+{
+    logger::get().set_level(level);
+}
+
+void FreeSRP::set_log_sink(std::function<void(log_level, const std::string &)> sink)
+{
+    logger::get().set_sink(sink);
+}
+
+void FreeSRP::set_log_rate_limit(unsigned int messages_per_second)
+{
+    logger::get().set_rate_limit(messages_per_second);
+}
+
+void FreeSRP::set_libusb_debug_level(int level)
+{
+    logger::get().set_libusb_debug_level(level);
+}
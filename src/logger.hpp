@@ -0,0 +1,91 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBFREESRP_LOGGER_HPP
+#define LIBFREESRP_LOGGER_HPP
+
+#include <freesrp.hpp>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace FreeSRP
+{
+    // Library log. Messages are formatted into fixed-size slots of a bounded lock-free ring, so logging never
+    // allocates, locks or does I/O and is safe from the event thread. A background thread passes them to the sink.
+    class logger
+    {
+    public:
+        static logger &get();
+
+        void log(log_level level, const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+        void set_level(log_level level);
+        void set_rate_limit(unsigned int messages_per_second);
+        void set_sink(std::function<void(log_level, const std::string &)> sink);
+
+        int libusb_debug_level() const { return _libusb_debug_level.load(); }
+        void set_libusb_debug_level(int level) { _libusb_debug_level.store(level); }
+
+    private:
+        static const size_t ring_size = 256;
+        static const size_t message_size = 192;
+
+        struct slot
+        {
+            std::atomic<size_t> sequence;
+            log_level level;
+            char text[message_size];
+        };
+
+        logger();
+        ~logger();
+
+        bool rate_limited();
+        bool pop(log_level &level, std::string &text);
+        void deliver(log_level level, const std::string &text);
+        void run();
+
+        std::array<slot, ring_size> _ring;
+        std::atomic<size_t> _enqueue_pos{0};
+        size_t _dequeue_pos = 0;
+
+        std::atomic<int> _level{LOG_LEVEL_WARNING};
+        std::atomic<unsigned int> _rate_limit{20};
+        std::atomic<long long> _window_start_ns{0};
+        std::atomic<unsigned int> _window_count{0};
+        std::atomic<unsigned long> _suppressed{0};
+        std::atomic<unsigned long> _dropped{0};
+
+        std::atomic<int> _libusb_debug_level{3};
+
+        std::mutex _sink_mutex;
+        std::function<void(log_level, const std::string &)> _sink;
+
+        std::atomic<bool> _running{true};
+        std::thread _thread;
+    };
+}
+
+#endif
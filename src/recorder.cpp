@@ -0,0 +1,478 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <freesrp_capture.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// O_DIRECT requires buffers, offsets and lengths aligned to the file system's block size. 4096 covers common ones.
+#define RECORDER_ALIGNMENT 4096
+
+using namespace FreeSRP;
+
+class recorder::impl
+{
+public:
+    explicit impl(const recorder_config &config);
+    ~impl();
+
+    void write(const sample *samples, size_t count);
+    void close();
+    recorder_statistics stats() const;
+
+private:
+    struct block
+    {
+        unsigned char *data;
+        size_t length;          // Bytes of the recording in this block
+        size_t written;         // Bytes of the block written to its file so far
+        size_t file;
+        off_t offset;
+    };
+
+    struct output_file
+    {
+        int fd;
+        bool direct;
+        unsigned long long size;    // Bytes of the recording in this file
+        std::deque<block *> pending;
+    };
+
+    bool next_block();
+    void queue_current();
+    size_t write_length(const block *b) const;
+    void finish_block(block *b, const std::string &error);
+    void pwrite_loop(size_t file);
+
+    recorder_config _config;
+    size_t _sample_size;
+
+    std::vector<block> _blocks;
+    std::vector<output_file> _files;
+
+    // Only used by write() and close()
+    block *_current = nullptr;
+    unsigned long long _next_index = 0;
+    unsigned char _carry[8];    // End of a sample split across two blocks
+    size_t _carry_length = 0;
+    bool _closed = false;
+
+    // Shared with the writer threads
+    mutable std::mutex _mutex;
+    std::condition_variable _cond;
+    std::vector<block *> _free;
+    unsigned int _queued = 0;
+    bool _stopping = false;
+    std::string _error;
+    std::vector<std::thread> _threads;
+
+    std::atomic<long long> _start_ns{0};
+    std::atomic<unsigned long long> _samples{0};
+    std::atomic<unsigned long long> _dropped{0};
+    std::atomic<unsigned long long> _bytes_written{0};
+    std::atomic<unsigned int> _queue_peak{0};
+    std::atomic<bool> _failed{false};
+};
+
+static long long now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+recorder::impl::impl(const recorder_config &config) : _config(config), _sample_size(sample_format_size(config.header.format))
+{
+    if(config.paths.empty())
+    {
+        throw std::runtime_error("recorder error: no output files");
+    }
+    if(config.block_size == 0 || config.block_size % RECORDER_ALIGNMENT != 0)
+    {
+        throw std::runtime_error("recorder error: block size must be a multiple of " + std::to_string(RECORDER_ALIGNMENT));
+    }
+    if(config.queue_blocks < 2)
+    {
+        throw std::runtime_error("recorder error: at least two blocks are needed");
+    }
+
+    for(const std::string &path : config.paths)
+    {
+        output_file f = {-1, false, 0, {}};
+        if(config.direct)
+        {
+            // Not every file system supports O_DIRECT (e.g. tmpfs), those are written through the page cache
+            f.fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+            f.direct = f.fd >= 0;
+        }
+        if(f.fd < 0)
+        {
+            f.fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        }
+        if(f.fd < 0)
+        {
+            std::string error = strerror(errno);
+            for(output_file &opened : _files)
+            {
+                ::close(opened.fd);
+            }
+            throw std::runtime_error("recorder error: could not create '" + path + "': " + error);
+        }
+        _files.push_back(f);
+
+        if(config.preallocate > 0 && fallocate(f.fd, 0, 0, (off_t) config.preallocate) != 0 && errno != EOPNOTSUPP)
+        {
+            std::string error = strerror(errno);
+            for(output_file &opened : _files)
+            {
+                ::close(opened.fd);
+            }
+            throw std::runtime_error("recorder error: could not preallocate '" + path + "': " + error);
+        }
+    }
+
+    _blocks.resize(config.queue_blocks);
+    for(block &b : _blocks)
+    {
+        void *data = nullptr;
+        if(posix_memalign(&data, RECORDER_ALIGNMENT, config.block_size) != 0)
+        {
+            for(block &allocated : _blocks)
+            {
+                free(allocated.data);
+            }
+            for(output_file &opened : _files)
+            {
+                ::close(opened.fd);
+            }
+            throw std::bad_alloc();
+        }
+        b.data = (unsigned char *) data;
+        _free.push_back(&b);
+    }
+
+    if(config.write_header)
+    {
+        next_block();
+        encode_capture_header(config.header, _current->data);
+        _current->length = FREESRP_CAPTURE_HEADER_SIZE;
+    }
+
+    // One thread per file, so that the disks are written in parallel
+    for(size_t f = 0; f < _files.size(); f++)
+    {
+        _threads.emplace_back(&recorder::impl::pwrite_loop, this, f);
+    }
+}
+
+recorder::impl::~impl()
+{
+    try
+    {
+        close();
+    }
+    catch(const std::runtime_error &)
+    {
+        // Reported by stats()
+    }
+
+    for(block &b : _blocks)
+    {
+        free(b.data);
+    }
+}
+
+bool recorder::impl::next_block()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if(_free.empty())
+    {
+        return false;
+    }
+
+    _current = _free.back();
+    _free.pop_back();
+
+    // Stripe consecutive blocks across the files
+    _current->length = 0;
+    _current->written = 0;
+    _current->file = _next_index % _files.size();
+    _current->offset = (off_t) (_next_index / _files.size() * _config.block_size);
+    _next_index++;
+    return true;
+}
+
+void recorder::impl::queue_current()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _files[_current->file].pending.push_back(_current);
+    _queued++;
+    if(_queued > _queue_peak.load(std::memory_order_relaxed))
+    {
+        _queue_peak.store(_queued, std::memory_order_relaxed);
+    }
+    _current = nullptr;
+    _cond.notify_all();
+}
+
+void recorder::impl::write(const sample *samples, size_t count)
+{
+    if(_closed)
+    {
+        throw std::runtime_error("recorder error: write after close");
+    }
+
+    if(_start_ns.load(std::memory_order_relaxed) == 0)
+    {
+        _start_ns.store(now_ns(), std::memory_order_relaxed);
+    }
+    _samples.fetch_add(count, std::memory_order_relaxed);
+
+    if(_failed.load(std::memory_order_relaxed))
+    {
+        _dropped.fetch_add(count, std::memory_order_relaxed);
+        return;
+    }
+
+    while(count > 0)
+    {
+        if(_current == nullptr)
+        {
+            if(!next_block())
+            {
+                // The disks are not keeping up
+                _dropped.fetch_add(count, std::memory_order_relaxed);
+                return;
+            }
+
+            memcpy(_current->data, _carry, _carry_length);
+            _current->length = _carry_length;
+            _carry_length = 0;
+        }
+
+        size_t space = _config.block_size - _current->length;
+        size_t n = std::min(count, space / _sample_size);
+        convert_samples(samples, n, _config.header.format, _current->data + _current->length);
+        _current->length += n * _sample_size;
+        space -= n * _sample_size;
+        samples += n;
+        count -= n;
+
+        if(count > 0 && space > 0)
+        {
+            // Split the next sample between this block and the next one
+            unsigned char split[8];
+            convert_samples(samples, 1, _config.header.format, split);
+            memcpy(_current->data + _current->length, split, space);
+            _current->length += space;
+            _carry_length = _sample_size - space;
+            memcpy(_carry, split + space, _carry_length);
+            samples++;
+            count--;
+        }
+
+        if(_current->length == _config.block_size)
+        {
+            queue_current();
+        }
+    }
+}
+
+void recorder::impl::close()
+{
+    if(_closed)
+    {
+        return;
+    }
+    _closed = true;
+
+    if(_current == nullptr && _carry_length > 0)
+    {
+        // The last sample was split across a block boundary and its end still has to be written. Wait for the
+        // writers to free a block, as nothing else will be recorded.
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cond.wait(lock, [this] { return !_free.empty(); });
+        }
+        next_block();
+        memcpy(_current->data, _carry, _carry_length);
+        _current->length = _carry_length;
+        _carry_length = 0;
+    }
+
+    if(_current != nullptr && _current->length > 0)
+    {
+        queue_current();
+    }
+    else if(_current != nullptr)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _free.push_back(_current);
+        _current = nullptr;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+        _cond.notify_all();
+    }
+    for(std::thread &t : _threads)
+    {
+        t.join();
+    }
+
+    // Remove the padding of the last blocks and any unused preallocated space
+    for(output_file &f : _files)
+    {
+        if(ftruncate(f.fd, (off_t) f.size) != 0 && _error.empty())
+        {
+            _error = strerror(errno);
+            _failed = true;
+        }
+        ::close(f.fd);
+    }
+
+    if(_failed)
+    {
+        throw std::runtime_error("recorder error: " + _error);
+    }
+}
+
+size_t recorder::impl::write_length(const block *b) const
+{
+    // A partially filled last block is padded for O_DIRECT and truncated when the recording is closed
+    if(_files[b->file].direct)
+    {
+        return (b->length + RECORDER_ALIGNMENT - 1) / RECORDER_ALIGNMENT * RECORDER_ALIGNMENT;
+    }
+    return b->length;
+}
+
+void recorder::impl::finish_block(block *b, const std::string &error)
+{
+    // Called with _mutex held. Blocks skipped after a failure are only returned to the free list
+    if(!error.empty())
+    {
+        if(!_failed.exchange(true))
+        {
+            _error = error;
+        }
+    }
+    else if(b->written >= write_length(b))
+    {
+        output_file &f = _files[b->file];
+        f.size = std::max(f.size, (unsigned long long) b->offset + b->length);
+        _bytes_written.fetch_add(b->length, std::memory_order_relaxed);
+    }
+
+    _free.push_back(b);
+    _queued--;
+    _cond.notify_all();
+}
+
+void recorder::impl::pwrite_loop(size_t file)
+{
+    output_file &f = _files[file];
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    while(true)
+    {
+        _cond.wait(lock, [&] { return !f.pending.empty() || _stopping; });
+        if(f.pending.empty())
+        {
+            break;
+        }
+
+        block *b = f.pending.front();
+        f.pending.pop_front();
+        lock.unlock();
+
+        std::string error;
+        size_t length = write_length(b);
+        memset(b->data + b->length, 0, length - b->length);
+        while(!_failed.load(std::memory_order_relaxed) && b->written < length)
+        {
+            ssize_t ret = pwrite(f.fd, b->data + b->written, length - b->written, b->offset + (off_t) b->written);
+            if(ret < 0 && errno != EINTR)
+            {
+                error = std::string("write failed: ") + strerror(errno);
+                break;
+            }
+            else if(ret > 0)
+            {
+                b->written += ret;
+            }
+        }
+
+        lock.lock();
+        finish_block(b, error);
+    }
+}
+
+recorder_statistics recorder::impl::stats() const
+{
+    recorder_statistics s;
+    s.samples = _samples.load(std::memory_order_relaxed);
+    s.dropped = _dropped.load(std::memory_order_relaxed);
+    s.bytes_written = _bytes_written.load(std::memory_order_relaxed);
+    s.queue_peak = _queue_peak.load(std::memory_order_relaxed);
+    s.failed = _failed.load(std::memory_order_relaxed);
+
+    long long start = _start_ns.load(std::memory_order_relaxed);
+    s.seconds = start == 0 ? 0 : (now_ns() - start) * 1e-9;
+    s.write_rate = s.seconds > 0 ? s.bytes_written / s.seconds : 0;
+
+    s.direct = true;
+    for(const output_file &f : _files)
+    {
+        s.direct = s.direct && f.direct;
+    }
+    return s;
+}
+
+recorder::recorder(const recorder_config &config) : _impl(new impl(config)) {}
+
+recorder::~recorder() {}
+
+void recorder::write(const sample *samples, size_t count)
+{
+    _impl->write(samples, count);
+}
+
+void recorder::close()
+{
+    _impl->close();
+}
+
+recorder_statistics recorder::stats() const
+{
+    return _impl->stats();
+}
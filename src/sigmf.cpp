@@ -0,0 +1,394 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <freesrp_capture.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+
+using namespace FreeSRP;
+
+class sigmf_writer::impl
+{
+public:
+    impl(const FreeSRP &srp, const sigmf_config &config);
+
+    void write(const sample *samples, size_t count);
+    response send_cmd(command c);
+    void note_gap(unsigned long long samples);
+    void close();
+    unsigned long long samples_written() const { return _written.load(std::memory_order_relaxed); }
+    recorder_statistics stats() const { return _recorder->stats(); }
+
+private:
+    struct capture_segment
+    {
+        unsigned long long sample_start;
+        double frequency;
+        double gain;
+        std::string datetime;
+    };
+
+    struct annotation
+    {
+        unsigned long long sample_start;
+        std::string label;
+        std::string comment;
+    };
+
+    void add_gap(unsigned long long index, unsigned long long count);
+    void write_meta() const;
+
+    const FreeSRP &_srp;
+    sigmf_config _config;
+    capture_header _header;
+    double _bandwidth = 0;
+    std::unique_ptr<recorder> _recorder;
+    std::atomic<unsigned long long> _written{0};
+    unsigned long long _overflows = 0;
+    bool _closed = false;
+
+    // Shared between write() and send_cmd()
+    mutable std::mutex _mutex;
+    unsigned long long _gaps = 0;
+    double _gain = 0;
+    std::vector<capture_segment> _captures;
+    std::vector<annotation> _annotations;
+};
+
+static std::string sigmf_datatype(sample_format format)
+{
+    switch(format)
+    {
+    case FORMAT_CS8: return "ci8";
+    case FORMAT_CS16: return "ci16_le";
+    case FORMAT_CF32: return "cf32_le";
+    default:
+        throw std::runtime_error("sigmf error: " + sample_format_name(format) + " samples cannot be described in SigMF");
+    }
+}
+
+static std::string iso8601(double seconds)
+{
+    time_t whole = (time_t) seconds;
+    char formatted[32];
+    strftime(formatted, sizeof(formatted), "%Y-%m-%dT%H:%M:%S", gmtime(&whole));
+
+    char fraction[16];
+    snprintf(fraction, sizeof(fraction), ".%06dZ", (int) ((seconds - whole) * 1e6));
+    return std::string(formatted) + fraction;
+}
+
+static double now_seconds()
+{
+    return std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static std::string json_string(const std::string &value)
+{
+    std::ostringstream o;
+    o << '"';
+    for(char c : value)
+    {
+        switch(c)
+        {
+        case '"': o << "\\\""; break;
+        case '\\': o << "\\\\"; break;
+        case '\n': o << "\\n"; break;
+        case '\t': o << "\\t"; break;
+        default:
+            if((unsigned char) c < 0x20)
+            {
+                o << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int) c << std::dec;
+            }
+            else
+            {
+                o << c;
+            }
+        }
+    }
+    o << '"';
+    return o.str();
+}
+
+static std::string json_number(double value)
+{
+    std::ostringstream o;
+    o << std::setprecision(15) << value;
+    return o.str();
+}
+
+sigmf_writer::impl::impl(const FreeSRP &srp, const sigmf_config &config) : _srp(srp), _config(config)
+{
+    sigmf_datatype(config.format);
+
+    _header = read_capture_header(srp, config.format);
+    response res = srp.send_cmd({GET_RX_RF_BANDWIDTH, 0});
+    if(res.error == CMD_OK)
+    {
+        _bandwidth = (double) (uint32_t) res.param;
+    }
+    _gain = _header.gain;
+    // Overflows from before the writer was created are not gaps in this recording
+    _overflows = srp.stream_stats().rx.overflows;
+    _captures.push_back({0, _header.center_freq, _header.gain, iso8601(_header.start_time)});
+
+    recorder_config data = config.data;
+    data.paths = {config.path + ".sigmf-data"};
+    data.header = _header;
+    data.write_header = false;
+    _recorder.reset(new recorder(data));
+
+    write_meta();
+}
+
+void sigmf_writer::impl::add_gap(unsigned long long index, unsigned long long count)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _gaps += count;
+    _annotations.push_back({index, "overflow", std::to_string(count) + " samples lost before this sample"});
+}
+
+void sigmf_writer::impl::write(const sample *samples, size_t count)
+{
+    // Samples the library dropped because they were not read in time
+    unsigned long long overflows = _srp.stream_stats().rx.overflows;
+    if(overflows > _overflows)
+    {
+        add_gap(_written.load(std::memory_order_relaxed), overflows - _overflows);
+    }
+    _overflows = overflows;
+
+    recorder_statistics before = _recorder->stats();
+    _recorder->write(samples, count);
+    unsigned long long lost = _recorder->stats().dropped - before.dropped;
+
+    unsigned long long written = _written.load(std::memory_order_relaxed);
+    if(lost > 0 && !before.failed)
+    {
+        // The recorder drops the end of the samples passed to it
+        add_gap(written + count - lost, lost);
+    }
+    _written.store(written + count - lost, std::memory_order_relaxed);
+}
+
+void sigmf_writer::impl::note_gap(unsigned long long samples)
+{
+    if(samples > 0)
+    {
+        add_gap(_written.load(std::memory_order_relaxed), samples);
+    }
+}
+
+response sigmf_writer::impl::send_cmd(command c)
+{
+    response res = _srp.send_cmd(c);
+    if(res.error != CMD_OK)
+    {
+        return res;
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    // The first sample delivered after the FreeSRP acknowledged the change, without the samples that were lost.
+    // Samples buffered in the FreeSRP and in USB transfers were received before the change, so it takes effect
+    // later than this by the pipeline depth and the settling time.
+    unsigned long long index = res.rx_samples > _gaps ? res.rx_samples - _gaps : 0;
+
+    switch(res.cmd)
+    {
+    case SET_RX_LO_FREQ:
+    {
+        double freq = (double) res.param;
+        if(_captures.back().sample_start >= index)
+        {
+            _captures.back().frequency = freq;
+        }
+        else
+        {
+            _captures.push_back({index, freq, _gain, iso8601(now_seconds())});
+        }
+        _annotations.push_back({index, "retune", "center frequency " + json_number(freq) + " Hz"});
+        break;
+    }
+    case SET_RX_RF_GAIN:
+        _gain = (double) (int32_t) (uint32_t) res.param;
+        _annotations.push_back({index, "gain change", "gain " + json_number(_gain) + " dB"});
+        break;
+    case SET_RX_SAMP_FREQ:
+        // Recorded samples are decimated, like core:sample_rate
+        _annotations.push_back({index, "sample rate change", "sample rate " + json_number((double) (uint32_t) res.param / _srp.rx_decimation()) + " Hz"});
+        break;
+    case SET_RX_RF_BANDWIDTH:
+        _annotations.push_back({index, "bandwidth change", "bandwidth " + json_number((double) (uint32_t) res.param) + " Hz"});
+        break;
+    case SET_RX_GC_MODE:
+        _annotations.push_back({index, "gain control change", "gain control mode " + std::to_string(res.param & 0xFF)});
+        break;
+    default:
+        break;
+    }
+
+    return res;
+}
+
+void sigmf_writer::impl::close()
+{
+    if(_closed)
+    {
+        return;
+    }
+    _closed = true;
+
+    // Describe what was written even if the data file could not be finished
+    std::string error;
+    try
+    {
+        _recorder->close();
+    }
+    catch(const std::runtime_error &e)
+    {
+        error = e.what();
+    }
+
+    write_meta();
+
+    if(!error.empty())
+    {
+        throw std::runtime_error(error);
+    }
+}
+
+void sigmf_writer::impl::write_meta() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    std::ostringstream o;
+    o << "{\n";
+    o << "    \"global\": {\n";
+    o << "        \"core:datatype\": " << json_string(sigmf_datatype(_config.format)) << ",\n";
+    o << "        \"core:sample_rate\": " << json_number(_header.samp_rate) << ",\n";
+    o << "        \"core:version\": \"1.0.0\",\n";
+    o << "        \"core:hw\": \"FreeSRP\",\n";
+    o << "        \"core:recorder\": \"libfreesrp\",\n";
+    if(!_config.description.empty())
+    {
+        o << "        \"core:description\": " << json_string(_config.description) << ",\n";
+    }
+    if(!_config.author.empty())
+    {
+        o << "        \"core:author\": " << json_string(_config.author) << ",\n";
+    }
+    o << "        \"core:extensions\": [{\"name\": \"freesrp\", \"version\": \"1.0.0\", \"optional\": true}],\n";
+    o << "        \"freesrp:bandwidth\": " << json_number(_bandwidth) << "\n";
+    o << "    },\n";
+
+    o << "    \"captures\": [";
+    for(size_t i = 0; i < _captures.size(); i++)
+    {
+        const capture_segment &c = _captures[i];
+        o << (i == 0 ? "\n" : ",\n");
+        o << "        {\"core:sample_start\": " << c.sample_start << ", \"core:frequency\": " << json_number(c.frequency)
+          << ", \"core:datetime\": " << json_string(c.datetime) << ", \"freesrp:gain\": " << json_number(c.gain) << "}";
+    }
+    o << "\n    ],\n";
+
+    // SigMF requires annotations in sample order, retunes and gaps are noted from different threads
+    std::vector<annotation> sorted = _annotations;
+    std::stable_sort(sorted.begin(), sorted.end(), [](const annotation &a, const annotation &b) { return a.sample_start < b.sample_start; });
+
+    o << "    \"annotations\": [";
+    for(size_t i = 0; i < sorted.size(); i++)
+    {
+        const annotation &a = sorted[i];
+        o << (i == 0 ? "\n" : ",\n");
+        o << "        {\"core:sample_start\": " << a.sample_start << ", \"core:label\": " << json_string(a.label)
+          << ", \"core:comment\": " << json_string(a.comment) << "}";
+    }
+    o << (sorted.empty() ? "]\n" : "\n    ]\n");
+    o << "}\n";
+
+    // Replace the metadata in one step, so that it is never seen half written
+    std::string path = _config.path + ".sigmf-meta";
+    {
+        std::ofstream f(path + ".tmp", std::ios::out | std::ios::trunc);
+        f << o.str();
+        if(!f)
+        {
+            throw std::runtime_error("sigmf error: could not write '" + path + ".tmp'");
+        }
+    }
+    if(std::rename((path + ".tmp").c_str(), path.c_str()) != 0)
+    {
+        throw std::runtime_error("sigmf error: could not replace '" + path + "'");
+    }
+}
+
+sigmf_writer::sigmf_writer(const FreeSRP &srp, const sigmf_config &config) : _impl(new impl(srp, config)) {}
+
+sigmf_writer::~sigmf_writer()
+{
+    try
+    {
+        _impl->close();
+    }
+    catch(const std::runtime_error &)
+    {
+        // Call close() to see errors
+    }
+}
+
+void sigmf_writer::write(const sample *samples, size_t count)
+{
+    _impl->write(samples, count);
+}
+
+response sigmf_writer::send_cmd(command c)
+{
+    return _impl->send_cmd(c);
+}
+
+void sigmf_writer::note_gap(unsigned long long samples)
+{
+    _impl->note_gap(samples);
+}
+
+void sigmf_writer::close()
+{
+    _impl->close();
+}
+
+unsigned long long sigmf_writer::samples_written() const
+{
+    return _impl->samples_written();
+}
+
+recorder_statistics sigmf_writer::stats() const
+{
+    return _impl->stats();
+}
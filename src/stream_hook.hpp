@@ -0,0 +1,86 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef LIBFREESRP_STREAM_HOOK_HPP
+#define LIBFREESRP_STREAM_HOOK_HPP
+
+#include "freesrp_impl.hpp"
+
+namespace FreeSRP
+{
+    // Runs the RX and TX data path without a FreeSRP, for examples/stream_bench. This is an internal interface and
+    // not installed: it must be used with a library built from the same source tree.
+    //
+    // Transfers are completed by calling the same callbacks libusb would call, and their resubmission is not passed
+    // on to libusb. Only one data path exists per process, so it must not be used while a FreeSRP is streaming.
+    struct stream_hook
+    {
+        // Stop passing transfers to libusb
+        static void detach()
+        {
+            data_path::_submit_transfer = [](libusb_transfer *) { return (int) LIBUSB_SUCCESS; };
+        }
+
+        static void set_rx_callback(std::function<void(const std::vector<sample> &)> callback)
+        {
+            data_path::_rx_custom_callback = callback;
+        }
+
+        static void set_tx_callback(std::function<void(std::vector<sample> &)> callback)
+        {
+            data_path::_tx_custom_callback = callback;
+        }
+
+        // Allocate a transfer like those the library streams with. Free it with free_transfer
+        static libusb_transfer *alloc_transfer(unsigned char endpoint, unsigned char *buffer, int length)
+        {
+            libusb_transfer *transfer = libusb_alloc_transfer(0);
+            libusb_fill_bulk_transfer(transfer, nullptr, endpoint, buffer, length, nullptr, new data_transfer_info{0}, 0);
+            return transfer;
+        }
+
+        static void free_transfer(libusb_transfer *transfer)
+        {
+            delete (data_transfer_info *) transfer->user_data;
+            transfer->buffer = nullptr;
+            libusb_free_transfer(transfer);
+        }
+
+        // Complete a transfer successfully, as libusb does once the FreeSRP has sent or received its data
+        static void complete_rx(libusb_transfer *transfer)
+        {
+            transfer->status = LIBUSB_TRANSFER_COMPLETED;
+            transfer->actual_length = transfer->length;
+            data_path::rx_callback(transfer);
+        }
+
+        static void complete_tx(libusb_transfer *transfer)
+        {
+            transfer->status = LIBUSB_TRANSFER_COMPLETED;
+            transfer->actual_length = transfer->length;
+            data_path::tx_callback(transfer);
+        }
+
+        static bool rx_dequeue(sample &s) { return data_path::_rx_buf.try_dequeue(s); }
+        static bool tx_enqueue(const sample &s) { return data_path::_tx_buf.try_enqueue(s); }
+    };
+}
+
+#endif
@@ -0,0 +1,258 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <freesrp_sweep.hpp>
+#include "fft.hpp"
+#include "worker_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+
+using namespace FreeSRP;
+
+namespace
+{
+    // Samples of one sweep step, shared between the sweep loop and the RX callback
+    struct step_capture
+    {
+        std::mutex mutex;
+        std::condition_variable done;
+        std::atomic<bool> active{false};
+        unsigned long discard = 0;
+        size_t wanted = 0;
+        std::vector<sample> samples;
+    };
+
+    void rx_capture(step_capture &capture, const std::vector<sample> &samples)
+    {
+        if(!capture.active.load(std::memory_order_acquire))
+        {
+            return;
+        }
+
+        // Drop samples that were received while the LO was settling
+        size_t offset = (size_t) std::min<unsigned long>(capture.discard, samples.size());
+        capture.discard -= offset;
+
+        size_t count = std::min(samples.size() - offset, capture.wanted - capture.samples.size());
+        capture.samples.insert(capture.samples.end(), samples.begin() + offset, samples.begin() + offset + count);
+
+        if(capture.samples.size() == capture.wanted)
+        {
+            std::lock_guard<std::mutex> lock(capture.mutex);
+            capture.active.store(false, std::memory_order_release);
+            capture.done.notify_one();
+        }
+    }
+
+    // Average the windowed power spectra of a step's samples and store keep bins around the LO in power, starting
+    // offset bins above the central ones
+    void step_spectrum(const fft &transform, const std::vector<float> &window, const std::vector<sample> &samples,
+                       unsigned int averages, unsigned int keep, unsigned int offset, float *power)
+    {
+        unsigned int n = transform.size();
+        std::vector<std::complex<float>> buf(n);
+        std::vector<float> acc(n, 0.0f);
+
+        for(unsigned int a = 0; a < averages; a++)
+        {
+            const sample *s = samples.data() + (size_t) a * n;
+            for(unsigned int i = 0; i < n; i++)
+            {
+                buf[i] = std::complex<float>(s[i].i * window[i], s[i].q * window[i]);
+            }
+
+            transform.transform(buf.data());
+
+            for(unsigned int i = 0; i < n; i++)
+            {
+                acc[i] += std::norm(buf[i]);
+            }
+        }
+
+        // Normalize so that a full scale (2048) complex tone reads 0 dBFS
+        double window_sum = 0;
+        for(float w : window)
+        {
+            window_sum += w;
+        }
+        double scale = 1.0 / (averages * window_sum * window_sum * 2048.0 * 2048.0);
+
+        // Swap halves so that the lowest frequency comes first, keeping only the bins around the LO
+        unsigned int first = n / 2 - keep / 2 + offset;
+        for(unsigned int j = 0; j < keep; j++)
+        {
+            double p = acc[(first + j + n / 2) % n] * scale;
+            power[j] = (float) (10.0 * std::log10(std::max(p, 1e-20)));
+        }
+    }
+}
+
+sweep_result FreeSRP::sweep(FreeSRP &srp, const sweep_config &config)
+{
+    if(config.stop_freq <= config.start_freq)
+    {
+        throw std::runtime_error("sweep error: stop frequency must be above start frequency");
+    }
+
+    if(config.averages == 0 || config.usable_fraction <= 0 || config.usable_fraction > 1)
+    {
+        throw std::runtime_error("sweep error: invalid averages or usable fraction");
+    }
+
+    fft transform(config.fft_size);
+    unsigned int n = config.fft_size;
+
+    std::vector<float> window(n);
+    for(unsigned int i = 0; i < n; i++)
+    {
+        window[i] = (float) (0.5 - 0.5 * std::cos(2.0 * M_PI * i / n));
+    }
+
+    // Configure the receiver; the FreeSRP reports the sample rate it actually uses
+    radio_config rx;
+    rx.rx_samp_freq = config.samp_rate;
+    rx.rx_rf_bandwidth = config.samp_rate;
+    rx.rx_gc_mode = RF_GAIN_MGC;
+    rx.rx_rf_gain = config.gain;
+
+    radio_config_result applied = srp.apply(rx);
+    if(!applied.ok())
+    {
+        const response &r = applied.failed.front();
+        throw std::runtime_error("sweep error: could not configure receiver, " + std::to_string(r.cmd) + " failed with error " + std::to_string(r.error));
+    }
+
+    // Samples are delivered after RX decimation, so each step only covers the decimated band
+    double samp_rate = (double) applied.rx_samp_freq.res.param / srp.rx_decimation();
+
+    double bin_width = samp_rate / n;
+    unsigned int keep = std::max(2u, ((unsigned int) (n * config.usable_fraction)) & ~1u);
+    double step = keep * bin_width;
+    unsigned long steps = (unsigned long) std::ceil((config.stop_freq - config.start_freq) / step);
+    unsigned long settle = config.settle_samples > 0 ? config.settle_samples : (unsigned long) (samp_rate * 0.002);
+
+    sweep_result result;
+    result.steps = steps;
+    result.freqs.resize(steps * keep);
+    result.power.resize(steps * keep);
+    for(size_t k = 0; k < result.freqs.size(); k++)
+    {
+        result.freqs[k] = config.start_freq + k * bin_width;
+    }
+
+    // Longest a step may take to receive its samples before the stream is considered stalled
+    std::chrono::duration<double> step_timeout(1.0 + (settle + (double) n * config.averages) / samp_rate);
+
+    worker_pool workers(config.threads);
+    std::vector<std::future<void>> spectra;
+
+    // Shared with the RX callback, which may still run after stop_rx has returned
+    std::shared_ptr<step_capture> shared_capture = std::make_shared<step_capture>();
+    step_capture &capture = *shared_capture;
+
+    response res = srp.send_cmd({SET_DATAPATH_EN, 1});
+    if(res.error != CMD_OK)
+    {
+        throw std::runtime_error("sweep error: could not enable datapath, error " + std::to_string(res.error));
+    }
+
+    srp.start_rx([shared_capture](const std::vector<sample> &samples) {
+        rx_capture(*shared_capture, samples);
+    });
+
+    auto start = std::chrono::steady_clock::now();
+
+    try
+    {
+        for(unsigned long k = 0; k < steps; k++)
+        {
+            double lo = config.start_freq + (k * keep + keep / 2) * bin_width;
+
+            // The last step may extend past the stop frequency. Tune it down by whole bins so that the LO stays
+            // within the requested range, and take its bins from further above the LO instead.
+            unsigned int offset = 0;
+            if(lo > config.stop_freq)
+            {
+                offset = (unsigned int) std::ceil((lo - config.stop_freq) / bin_width);
+                lo -= offset * bin_width;
+            }
+
+            res = srp.send_cmd(srp.make_command(SET_RX_LO_FREQ, lo));
+            if(res.error != CMD_OK)
+            {
+                throw std::runtime_error("sweep error: could not tune to " + std::to_string(lo) + " Hz, error " + std::to_string(res.error));
+            }
+
+            capture.samples.clear();
+            capture.samples.reserve((size_t) n * config.averages);
+            capture.wanted = (size_t) n * config.averages;
+            capture.discard = settle;
+            capture.active.store(true, std::memory_order_release);
+
+            {
+                std::unique_lock<std::mutex> lock(capture.mutex);
+                if(!capture.done.wait_for(lock, step_timeout, [&capture]() { return !capture.active.load(std::memory_order_acquire); }))
+                {
+                    capture.active.store(false, std::memory_order_release);
+                    throw std::runtime_error("sweep error: timed out waiting for samples at " + std::to_string(lo) + " Hz");
+                }
+            }
+
+            // Compute this step's spectrum while the LO is retuned for the next one
+            std::shared_ptr<std::vector<sample>> samples = std::make_shared<std::vector<sample>>(std::move(capture.samples));
+            float *power = result.power.data() + k * keep;
+            unsigned int averages = config.averages;
+            spectra.push_back(workers.submit([&transform, &window, samples, averages, keep, offset, power]() {
+                step_spectrum(transform, window, *samples, averages, keep, offset, power);
+            }));
+        }
+
+        for(std::future<void> &f : spectra)
+        {
+            f.get();
+        }
+    }
+    catch(...)
+    {
+        srp.stop_rx();
+        srp.send_cmd({SET_DATAPATH_EN, 0});
+        throw;
+    }
+
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    srp.stop_rx();
+    srp.send_cmd({SET_DATAPATH_EN, 0});
+
+    // The last step may extend past the stop frequency
+    size_t last = std::upper_bound(result.freqs.begin(), result.freqs.end(), config.stop_freq) - result.freqs.begin();
+    result.freqs.resize(last);
+    result.power.resize(last);
+
+    result.rate = (config.stop_freq - config.start_freq) / 1e9 / result.seconds;
+
+    return result;
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBFREESRP_TRACE_HPP
+#define LIBFREESRP_TRACE_HPP
+
+// Static tracepoints (USDT) under the "freesrp" provider, for use with perf, bpftrace or SystemTap, e.g.
+//   bpftrace -e 'usdt:/usr/local/lib/libfreesrp.so:freesrp:rx_callback_end { @[arg0] = count(); }'
+// Tracepoints are only compiled in when building with -DENABLE_USDT=ON. They cost a single nop when not traced.
+//
+// Tracepoints:
+//   transfer_submit(endpoint, length)               RX or TX transfer submitted
+//   transfer_complete(endpoint, status, length)     RX or TX transfer callback entered, length is actual_length
+//   decode_begin(bytes), decode_end(samples)        decoding of an RX transfer
+//   encode_begin(samples), encode_end(bytes)        encoding of a TX transfer
+//   rx_callback_begin(samples), rx_callback_end(samples)
+//   tx_callback_begin(samples), tx_callback_end(samples)
+//   rx_queue_full(dropped)                          RX samples dropped because the queue was full
+//   tx_queue_empty(missing)                         TX samples sent as zeros because the queue was empty
+//   cmd_request(cmd, param, read_from_device)       command issued by send_cmd/send_cmd_async
+//   cmd_cached(cmd, param)                          command answered from the settings cache
+//   cmd_response(cmd, param, error)                 response received from the FreeSRP
+
+#ifdef FREESRP_USDT
+#include <sys/sdt.h>
+
+#define FREESRP_TRACE1(name, a) DTRACE_PROBE1(freesrp, name, a)
+#define FREESRP_TRACE2(name, a, b) DTRACE_PROBE2(freesrp, name, a, b)
+#define FREESRP_TRACE3(name, a, b, c) DTRACE_PROBE3(freesrp, name, a, b, c)
+#else
+#define FREESRP_TRACE1(name, a) do {} while(0)
+#define FREESRP_TRACE2(name, a, b) do {} while(0)
+#define FREESRP_TRACE3(name, a, b, c) do {} while(0)
+#endif
+
+#endif
@@ -0,0 +1,379 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <freesrp_capture.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+// Samples the writer thread copies out of the history at a time
+#define TRIGGERED_CAPTURE_CHUNK 16384
+
+using namespace FreeSRP;
+
+class triggered_capture::impl
+{
+public:
+    explicit impl(const triggered_capture_config &config);
+    ~impl();
+
+    void write(const sample *samples, size_t count);
+    void close();
+    triggered_capture_statistics stats() const;
+
+private:
+    struct event
+    {
+        unsigned long long start;
+        unsigned long long end;
+    };
+
+    bool triggered(const sample *samples, size_t count) const;
+    void queue_event(const event &e);
+    void run_writer();
+    bool write_event(const event &e, unsigned long long number);
+
+    triggered_capture_config _config;
+    size_t _sample_size;
+    unsigned long long _pre;
+    unsigned long long _post;
+    double _threshold_power;    // Threshold in squared 12-bit units
+
+    // History of the last _history.size() samples. The sample with absolute index n is stored at n % _history.size().
+    std::vector<sample> _history;
+    // Absolute index one past the last sample write() has stored
+    std::atomic<unsigned long long> _head;
+    // Absolute index one past the last sample write() may be storing. Set before the samples are overwritten, so the
+    // writer thread can tell whether its copy could have been torn.
+    std::atomic<unsigned long long> _reserved;
+
+    // Only accessed by write()
+    bool _open = false;
+    event _current;
+
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::deque<event> _pending;
+    bool _stop = false;
+    std::thread _writer;
+
+    std::atomic<unsigned long long> _samples;
+    std::atomic<unsigned long long> _triggers;
+    std::atomic<unsigned long long> _events;
+    std::atomic<unsigned long long> _lost;
+    std::atomic<unsigned long long> _merged;
+};
+
+triggered_capture::impl::impl(const triggered_capture_config &config) :
+    _config(config), _head(0), _reserved(0), _samples(0), _triggers(0), _events(0), _lost(0), _merged(0)
+{
+    if(config.prefix.empty())
+    {
+        throw std::runtime_error("triggered capture error: no file prefix given");
+    }
+    if(config.header.samp_rate <= 0)
+    {
+        throw std::runtime_error("triggered capture error: the sample rate is required");
+    }
+    if(config.mode == TRIGGER_PREDICATE && !config.predicate)
+    {
+        throw std::runtime_error("triggered capture error: no predicate given");
+    }
+    if(config.pre_trigger < 0 || config.post_trigger <= 0 || config.max_pending == 0)
+    {
+        throw std::runtime_error("triggered capture error: invalid trigger window");
+    }
+
+    _sample_size = sample_format_size(config.header.format);
+    _pre = (unsigned long long) std::llround(config.pre_trigger * config.header.samp_rate);
+    _post = (unsigned long long) std::llround(config.post_trigger * config.header.samp_rate);
+    unsigned long long history = (unsigned long long) std::llround(config.history * config.header.samp_rate);
+    if(history <= _pre + _post)
+    {
+        throw std::runtime_error("triggered capture error: the history must be longer than the pre- and post-trigger windows");
+    }
+    _history.resize((size_t) history);
+
+    _threshold_power = 2048.0 * 2048.0 * std::pow(10.0, config.threshold / 10.0);
+
+    _writer = std::thread(&impl::run_writer, this);
+}
+
+triggered_capture::impl::~impl()
+{
+    close();
+}
+
+bool triggered_capture::impl::triggered(const sample *samples, size_t count) const
+{
+    if(count == 0)
+    {
+        return false;
+    }
+
+    switch(_config.mode)
+    {
+    case TRIGGER_POWER:
+    {
+        long long sum = 0;
+        for(size_t n = 0; n < count; n++)
+        {
+            sum += samples[n].i * samples[n].i + samples[n].q * samples[n].q;
+        }
+        return (double) sum > _threshold_power * count;
+    }
+    case TRIGGER_LEVEL:
+    {
+        int peak = 0;
+        for(size_t n = 0; n < count; n++)
+        {
+            peak = std::max(peak, samples[n].i * samples[n].i + samples[n].q * samples[n].q);
+        }
+        return (double) peak > _threshold_power;
+    }
+    case TRIGGER_PREDICATE:
+        return _config.predicate(samples, count);
+    }
+
+    return false;
+}
+
+void triggered_capture::impl::write(const sample *samples, size_t count)
+{
+    unsigned long long head = _head.load(std::memory_order_relaxed);
+    size_t capacity = _history.size();
+
+    // Announce the overwrite before touching the history
+    _reserved.store(head + count, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    // Blocks larger than the history only keep their end
+    const sample *src = samples;
+    size_t remaining = count;
+    unsigned long long pos = head;
+    if(remaining > capacity)
+    {
+        src += remaining - capacity;
+        pos += remaining - capacity;
+        remaining = capacity;
+    }
+    while(remaining > 0)
+    {
+        size_t offset = (size_t) (pos % capacity);
+        size_t n = std::min(remaining, capacity - offset);
+        memcpy(&_history[offset], src, n * sizeof(sample));
+        src += n;
+        pos += n;
+        remaining -= n;
+    }
+
+    _head.store(head + count, std::memory_order_release);
+    _samples.fetch_add(count, std::memory_order_relaxed);
+
+    if(triggered(samples, count))
+    {
+        _triggers.fetch_add(1, std::memory_order_relaxed);
+        if(_open)
+        {
+            _merged.fetch_add(1, std::memory_order_relaxed);
+        }
+        else
+        {
+            _open = true;
+            _current.start = head > _pre ? head - _pre : 0;
+            _current.end = head + _post;
+        }
+    }
+
+    if(_open && head + count >= _current.end)
+    {
+        _open = false;
+        queue_event(_current);
+    }
+}
+
+void triggered_capture::impl::queue_event(const event &e)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if(_pending.size() < _config.max_pending)
+        {
+            _pending.push_back(e);
+            _cv.notify_one();
+            return;
+        }
+    }
+
+    _lost.fetch_add(1, std::memory_order_relaxed);
+}
+
+void triggered_capture::impl::run_writer()
+{
+    unsigned long long number = 0;
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    while(true)
+    {
+        _cv.wait(lock, [this] { return _stop || !_pending.empty(); });
+        if(_pending.empty())
+        {
+            break;
+        }
+
+        event e = _pending.front();
+        _pending.pop_front();
+        lock.unlock();
+
+        if(write_event(e, number + 1))
+        {
+            number++;
+            _events.fetch_add(1, std::memory_order_relaxed);
+        }
+        else
+        {
+            _lost.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        lock.lock();
+    }
+}
+
+bool triggered_capture::impl::write_event(const event &e, unsigned long long number)
+{
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), "_%06llu.", number);
+    std::string path = _config.prefix + suffix + sample_format_name(_config.header.format);
+
+    FILE *f = fopen(path.c_str(), "wb");
+    if(f == nullptr)
+    {
+        return false;
+    }
+
+    capture_header header = _config.header;
+    if(header.start_time != 0)
+    {
+        header.start_time += e.start / header.samp_rate;
+    }
+    unsigned char encoded[FREESRP_CAPTURE_HEADER_SIZE];
+    encode_capture_header(header, encoded);
+    bool ok = fwrite(encoded, 1, sizeof(encoded), f) == sizeof(encoded);
+
+    size_t capacity = _history.size();
+    std::vector<sample> chunk(TRIGGERED_CAPTURE_CHUNK);
+    std::vector<unsigned char> converted(TRIGGERED_CAPTURE_CHUNK * _sample_size);
+    for(unsigned long long pos = e.start; ok && pos < e.end; pos += chunk.size())
+    {
+        size_t count = (size_t) std::min((unsigned long long) chunk.size(), e.end - pos);
+        for(size_t copied = 0; copied < count;)
+        {
+            size_t offset = (size_t) ((pos + copied) % capacity);
+            size_t n = std::min(count - copied, capacity - offset);
+            memcpy(&chunk[copied], &_history[offset], n * sizeof(sample));
+            copied += n;
+        }
+
+        // The copy is only valid if write() has not started overwriting its first sample in the meantime
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(_reserved.load(std::memory_order_relaxed) > pos + capacity)
+        {
+            ok = false;
+            break;
+        }
+
+        convert_samples(chunk.data(), count, _config.header.format, converted.data());
+        ok = fwrite(converted.data(), _sample_size, count, f) == count;
+    }
+
+    if(fclose(f) != 0)
+    {
+        ok = false;
+    }
+    if(!ok)
+    {
+        remove(path.c_str());
+    }
+    return ok;
+}
+
+void triggered_capture::impl::close()
+{
+    if(!_writer.joinable())
+    {
+        return;
+    }
+
+    // Keep what has been received of the event in progress
+    if(_open)
+    {
+        _open = false;
+        _current.end = std::min(_current.end, _head.load(std::memory_order_relaxed));
+        if(_current.end > _current.start)
+        {
+            queue_event(_current);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _cv.notify_one();
+    _writer.join();
+}
+
+triggered_capture_statistics triggered_capture::impl::stats() const
+{
+    triggered_capture_statistics s;
+    s.samples = _samples.load(std::memory_order_relaxed);
+    s.triggers = _triggers.load(std::memory_order_relaxed);
+    s.events = _events.load(std::memory_order_relaxed);
+    s.lost = _lost.load(std::memory_order_relaxed);
+    s.merged = _merged.load(std::memory_order_relaxed);
+    return s;
+}
+
+triggered_capture::triggered_capture(const triggered_capture_config &config) : _impl(new impl(config)) {}
+
+triggered_capture::~triggered_capture() {}
+
+void triggered_capture::write(const sample *samples, size_t count)
+{
+    _impl->write(samples, count);
+}
+
+void triggered_capture::close()
+{
+    _impl->close();
+}
+
+triggered_capture_statistics triggered_capture::stats() const
+{
+    return _impl->stats();
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <freesrp_capture.hpp>
+
+#include "codec.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <stdexcept>
+
+// Samples converted at a time for formats other than raw, small enough to stay in L1 cache
+#define PLAYBACK_CHUNK 1024
+
+using namespace FreeSRP;
+
+class tx_playback::impl
+{
+public:
+    impl(const std::string &path, sample_format format, unsigned long long start, bool loop);
+
+    void fill(unsigned char *buffer, size_t count);
+
+    capture_reader reader;
+    std::atomic<unsigned long long> position;
+    std::atomic<unsigned long long> loops{0};
+    std::atomic<bool> finished{false};
+
+private:
+    unsigned long long _start;
+    bool _loop;
+};
+
+tx_playback::impl::impl(const std::string &path, sample_format format, unsigned long long start, bool loop) :
+    reader(path, format), position(start), _start(start), _loop(loop)
+{
+    if(start >= reader.samples())
+    {
+        throw std::runtime_error("tx playback error: start is past the end of '" + path + "'");
+    }
+
+    reader.view(start, (size_t) (reader.samples() - start), ACCESS_SEQUENTIAL);
+}
+
+void tx_playback::impl::fill(unsigned char *buffer, size_t count)
+{
+    unsigned long long pos = position.load(std::memory_order_relaxed);
+    size_t done = 0;
+
+    while(done < count)
+    {
+        if(pos >= reader.samples())
+        {
+            if(!_loop)
+            {
+                memset(buffer + done * FREESRP_BYTES_PER_SAMPLE, 0, (count - done) * FREESRP_BYTES_PER_SAMPLE);
+                finished.store(true, std::memory_order_relaxed);
+                break;
+            }
+
+            pos = _start;
+            loops.fetch_add(1, std::memory_order_relaxed);
+            // Reading restarts at the beginning, which the kernel does not expect
+            reader.view(_start, (size_t) std::min(reader.samples() - _start, (unsigned long long) count), ACCESS_WILLNEED);
+        }
+
+        capture_view v = reader.view(pos, count - done);
+        unsigned char *out = buffer + done * FREESRP_BYTES_PER_SAMPLE;
+
+        if(v.format == FORMAT_RAW)
+        {
+            memcpy(out, v.data, v.count * FREESRP_BYTES_PER_SAMPLE);
+        }
+        else
+        {
+            const unsigned char *in = (const unsigned char *) v.data;
+            size_t in_size = sample_format_size(v.format);
+            sample chunk[PLAYBACK_CHUNK];
+            for(size_t n = 0; n < v.count; n += PLAYBACK_CHUNK)
+            {
+                size_t c = std::min((size_t) PLAYBACK_CHUNK, v.count - n);
+                convert_to_samples(in + n * in_size, c, v.format, chunk);
+                encode_samples(chunk, out + n * FREESRP_BYTES_PER_SAMPLE, c);
+            }
+        }
+
+        done += v.count;
+        pos += v.count;
+    }
+
+    position.store(pos, std::memory_order_relaxed);
+}
+
+tx_playback::tx_playback(const std::string &path, sample_format format, unsigned long long start, bool loop) : _impl(new impl(path, format, start, loop)) {}
+
+tx_playback::~tx_playback() {}
+
+void tx_playback::fill(unsigned char *buffer, size_t count)
+{
+    _impl->fill(buffer, count);
+}
+
+bool tx_playback::finished() const
+{
+    return _impl->finished.load(std::memory_order_relaxed);
+}
+
+unsigned long long tx_playback::position() const
+{
+    return _impl->position.load(std::memory_order_relaxed);
+}
+
+unsigned long long tx_playback::loops() const
+{
+    return _impl->loops.load(std::memory_order_relaxed);
+}
+
+const capture_reader &tx_playback::capture() const
+{
+    return _impl->reader;
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "worker_pool.hpp"
+
+#include <algorithm>
+
+using namespace FreeSRP;
+
+worker_pool::worker_pool(unsigned int num_threads)
+{
+    if(num_threads == 0)
+    {
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    for(unsigned int i = 0; i < num_threads; i++)
+    {
+        _threads.emplace_back([this]() {
+            run();
+        });
+    }
+}
+
+worker_pool::~worker_pool()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _cond.notify_all();
+
+    for(std::thread &t : _threads)
+    {
+        t.join();
+    }
+}
+
+std::future<void> worker_pool::submit(std::function<void()> job)
+{
+    std::packaged_task<void()> task(job);
+    std::future<void> result = task.get_future();
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _jobs.push_back(std::move(task));
+    }
+    _cond.notify_one();
+
+    return result;
+}
+
+void worker_pool::run()
+{
+    while(true)
+    {
+        std::packaged_task<void()> task;
+
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cond.wait(lock, [this]() { return _stop || !_jobs.empty(); });
+
+            // Finish outstanding jobs before stopping
+            if(_jobs.empty())
+            {
+                return;
+            }
+
+            task = std::move(_jobs.front());
+            _jobs.pop_front();
+        }
+
+        task();
+    }
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBFREESRP_WORKER_POOL_HPP
+#define LIBFREESRP_WORKER_POOL_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace FreeSRP
+{
+    // Fixed set of threads running submitted jobs in submission order
+    class worker_pool
+    {
+    public:
+        // 0 threads uses one thread per hardware thread
+        explicit worker_pool(unsigned int num_threads = 0);
+        ~worker_pool();
+
+        unsigned int size() const { return (unsigned int) _threads.size(); }
+
+        std::future<void> submit(std::function<void()> job);
+
+    private:
+        void run();
+
+        std::vector<std::thread> _threads;
+        std::mutex _mutex;
+        std::condition_variable _cond;
+        std::deque<std::packaged_task<void()>> _jobs;
+        bool _stop = false;
+    };
+}
+
+#endif